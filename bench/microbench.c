@@ -0,0 +1,671 @@
+#include "data_structure/object_pool.h"
+#include "data_structure/trie.h"
+#include "module/dns_cache.h"
+#include "module/hot_keys.h"
+#include "module/logger.h"
+#include "network/dns_utility.h"
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static bool alloc_counting = false;
+static size_t alloc_count = 0;
+static size_t alloc_bytes = 0;
+
+void *__wrap_malloc(size_t size) {
+    if (alloc_counting) {
+        ++alloc_count;
+        alloc_bytes += size;
+    }
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    if (alloc_counting) {
+        ++alloc_count;
+        alloc_bytes += count * size;
+    }
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    if (alloc_counting) {
+        ++alloc_count;
+        alloc_bytes += size;
+    }
+    return __real_realloc(ptr, size);
+}
+
+/* Slab pools do not go through malloc, so the objects they hand out are counted by the growth of the objects in use. */
+static void pool_usage(size_t *objects, size_t *bytes) {
+    object_pool_stats_t stats[OBJECT_POOL_LIMIT];
+    size_t count = object_pool_collect(stats, OBJECT_POOL_LIMIT);
+    *objects = 0;
+    *bytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t used = stats[i].object_count - stats[i].free_count;
+        *objects += used;
+        *bytes += used * stats[i].object_size;
+    }
+    return;
+}
+
+typedef struct benchmark {
+    const char *name;
+    size_t iterations;
+    void (*setup)(void *context);
+    void (*op)(void *context, size_t i);
+    void (*teardown)(void *context);
+    void *context;
+    size_t output_bytes;
+} benchmark_t;
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void run_benchmark(benchmark_t *benchmark) {
+    if (benchmark->setup)
+        benchmark->setup(benchmark->context);
+    size_t pool_objects, pool_bytes;
+    pool_usage(&pool_objects, &pool_bytes);
+    alloc_count = 0;
+    alloc_bytes = 0;
+    alloc_counting = true;
+    uint64_t begin = now_ns();
+    for (size_t i = 0; i < benchmark->iterations; ++i)
+        benchmark->op(benchmark->context, i);
+    uint64_t end = now_ns();
+    alloc_counting = false;
+    size_t objects, bytes_in_use;
+    pool_usage(&objects, &bytes_in_use);
+    if (objects > pool_objects)
+        alloc_count += objects - pool_objects;
+    if (bytes_in_use > pool_bytes)
+        alloc_bytes += bytes_in_use - pool_bytes;
+    size_t allocs = alloc_count;
+    size_t bytes = alloc_bytes;
+    if (benchmark->teardown)
+        benchmark->teardown(benchmark->context);
+
+    double n = (double)benchmark->iterations;
+    printf("{\"benchmark\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.2f,\"allocs_per_op\":%.2f,\"bytes_per_op\":%.2f",
+           benchmark->name,
+           benchmark->iterations,
+           (double)(end - begin) / n,
+           (double)allocs / n,
+           (double)bytes / n);
+    if (benchmark->output_bytes)
+        printf(",\"output_bytes\":%zu", benchmark->output_bytes);
+    printf("}\n");
+    fflush(stdout);
+    return;
+}
+
+static void report_skipped(const char *name, const char *reason) {
+    printf("{\"benchmark\":\"%s\",\"skipped\":\"%s\"}\n", name, reason);
+    fflush(stdout);
+    return;
+}
+
+/* Packet construction. */
+
+typedef struct packet {
+    uint8_t data[4096];
+    size_t length;
+} packet_t;
+
+static inline void packet_u16(packet_t *packet, uint16_t value) {
+    value = htons(value);
+    memcpy(packet->data + packet->length, &value, sizeof(value));
+    packet->length += sizeof(value);
+}
+
+static inline void packet_u32(packet_t *packet, uint32_t value) {
+    value = htonl(value);
+    memcpy(packet->data + packet->length, &value, sizeof(value));
+    packet->length += sizeof(value);
+}
+
+static inline void packet_bytes(packet_t *packet, const void *bytes, size_t length) {
+    memcpy(packet->data + packet->length, bytes, length);
+    packet->length += length;
+}
+
+static void packet_name(packet_t *packet, const char *name) {
+    name_field_t *name_field = name_field_create(name, strlen(name));
+    packet_bytes(packet, name_field->name, name_field->length);
+    name_field_destroy(name_field);
+}
+
+static void packet_header(packet_t *packet, uint16_t flags, uint16_t qdcount, uint16_t ancount) {
+    packet->length = 0;
+    packet_u16(packet, 0x1234);
+    packet_u16(packet, flags);
+    packet_u16(packet, qdcount);
+    packet_u16(packet, ancount);
+    packet_u16(packet, 0);
+    packet_u16(packet, 0);
+}
+
+static void packet_question(packet_t *packet, const char *name, uint16_t qtype) {
+    packet_name(packet, name);
+    packet_u16(packet, qtype);
+    packet_u16(packet, 1);
+}
+
+static void packet_record_tail(packet_t *packet, uint16_t type, uint32_t ttl, const void *rdata, uint16_t rd_length) {
+    packet_u16(packet, type);
+    packet_u16(packet, 1);
+    packet_u32(packet, ttl);
+    packet_u16(packet, rd_length);
+    packet_bytes(packet, rdata, rd_length);
+}
+
+static const char *const bench_qname = "www.example.com";
+static const char *const bench_target = "edge.cdn.example.net";
+
+static void build_query(packet_t *packet) {
+    packet_header(packet, 0x0100, 1, 0);
+    packet_question(packet, bench_qname, 1);
+}
+
+/* www.example.com CNAME edge.cdn.example.net, followed by two A records, without compression. */
+static void build_response_plain(packet_t *packet) {
+    packet_header(packet, 0x8180, 1, 3);
+    packet_question(packet, bench_qname, 1);
+    name_field_t *target = name_field_create(bench_target, strlen(bench_target));
+    packet_name(packet, bench_qname);
+    packet_record_tail(packet, 5, 300, target->name, target->length);
+    for (uint8_t i = 1; i <= 2; ++i) {
+        uint8_t address[4] = {93, 184, 216, i};
+        packet_name(packet, bench_target);
+        packet_record_tail(packet, 1, 300, address, sizeof(address));
+    }
+    name_field_destroy(target);
+}
+
+/* The same answer as build_response_plain, with owner names compressed as a real resolver emits them. */
+static void build_response_compressed(packet_t *packet) {
+    packet_header(packet, 0x8180, 1, 3);
+    packet_question(packet, bench_qname, 1);
+    static const uint8_t question_pointer[2] = {0xc0, 0x0c};
+    packet_bytes(packet, question_pointer, sizeof(question_pointer));
+    uint16_t target_offset = packet->length + 10;
+    name_field_t *target = name_field_create(bench_target, strlen(bench_target));
+    packet_record_tail(packet, 5, 300, target->name, target->length);
+    name_field_destroy(target);
+    for (uint8_t i = 1; i <= 2; ++i) {
+        uint8_t address[4] = {93, 184, 216, i};
+        uint8_t target_pointer[2] = {0xc0 | (target_offset >> 8), target_offset & 0xff};
+        packet_bytes(packet, target_pointer, sizeof(target_pointer));
+        packet_record_tail(packet, 1, 300, address, sizeof(address));
+    }
+}
+
+/* A round-robin style answer with many A records sharing the question name. */
+static void build_response_many(packet_t *packet, uint16_t answers) {
+    packet_header(packet, 0x8180, 1, answers);
+    packet_question(packet, bench_qname, 1);
+    static const uint8_t question_pointer[2] = {0xc0, 0x0c};
+    for (uint16_t i = 0; i < answers; ++i) {
+        uint8_t address[4] = {10, 0, (uint8_t)(i >> 8), (uint8_t)i};
+        packet_bytes(packet, question_pointer, sizeof(question_pointer));
+        packet_record_tail(packet, 1, 60, address, sizeof(address));
+    }
+}
+
+/* parse_dns_message / dns_message_view / convert_dns_message_to_stream / clone_dns_message / dns_response. */
+
+typedef struct message_context {
+    packet_t packet;
+    dns_message_t **messages;
+    size_t count;
+    dns_message_t *message;
+    uint8_t *buffer;
+    dns_message_view_t view;
+    dns_rrsets_t *rrsets;
+} message_context_t;
+
+static void parse_setup(void *context) {
+    message_context_t *p = context;
+    p->messages = malloc(sizeof(dns_message_t *) * p->count);
+}
+
+static void parse_op(void *context, size_t i) {
+    message_context_t *p = context;
+    p->messages[i] = parse_dns_message(p->packet.data, p->packet.length);
+}
+
+static void messages_teardown(void *context) {
+    message_context_t *p = context;
+    for (size_t i = 0; i < p->count; ++i)
+        dns_message_destroy(p->messages[i]);
+    free(p->messages);
+    p->messages = NULL;
+}
+
+static void view_op(void *context, size_t i) {
+    (void)i;
+    message_context_t *p = context;
+    dns_message_view_t view;
+    dns_message_view_init(&view, p->packet.data, p->packet.length);
+    const question_t *question = dns_message_view_question(&view);
+    __asm__ volatile("" : : "r"(question) : "memory");
+    dns_message_view_release(&view);
+}
+
+static void serialize_setup(void *context) {
+    message_context_t *p = context;
+    p->message = parse_dns_message(p->packet.data, p->packet.length);
+    p->buffer = malloc(1 << 16);
+}
+
+static void serialize_op(void *context, size_t i) {
+    (void)i;
+    message_context_t *p = context;
+    uint8_t *end = convert_dns_message_to_stream(p->message, p->buffer, 1 << 16);
+    __asm__ volatile("" : : "r"(end) : "memory");
+}
+
+static void serialize_teardown(void *context) {
+    message_context_t *p = context;
+    dns_message_destroy(p->message);
+    p->message = NULL;
+    free(p->buffer);
+    p->buffer = NULL;
+}
+
+static size_t serialized_length(const packet_t *packet) {
+    uint8_t *buffer = malloc(1 << 16);
+    dns_message_t *message = parse_dns_message(packet->data, packet->length);
+    uint8_t *end = convert_dns_message_to_stream(message, buffer, 1 << 16);
+    size_t length = end ? (size_t)(end - buffer) : 0;
+    dns_message_destroy(message);
+    free(buffer);
+    return length;
+}
+
+static void clone_setup(void *context) {
+    message_context_t *p = context;
+    p->message = parse_dns_message(p->packet.data, p->packet.length);
+    p->messages = malloc(sizeof(dns_message_t *) * p->count);
+}
+
+static void clone_op(void *context, size_t i) {
+    message_context_t *p = context;
+    p->messages[i] = clone_dns_message(p->message);
+}
+
+static void clone_teardown(void *context) {
+    message_context_t *p = context;
+    messages_teardown(p);
+    dns_message_destroy(p->message);
+    p->message = NULL;
+}
+
+static void response_setup(void *context) {
+    message_context_t *p = context;
+    p->message = parse_dns_message(p->packet.data, p->packet.length);
+    p->buffer = malloc(1 << 16);
+    dns_message_view_init(&p->view, p->packet.data, p->packet.length);
+    dns_message_view_question(&p->view);
+    p->rrsets = NULL;
+    for (forward_list_node_t *ptr = p->message->answers; ptr; ptr = ptr->next) {
+        const resource_record_t *record = ptr->value;
+        p->rrsets = dns_rrsets_append(p->rrsets, record->name->name, record->name->length, record->type, record->class, 300, record->rdata, record->rd_length);
+    }
+}
+
+static size_t response_build(message_context_t *p) {
+    dns_response_t response;
+    dns_response_init(&response, p->buffer, 1 << 16, &p->view, 0);
+    for (size_t i = 0; p->rrsets && i < p->rrsets->count; ++i)
+        dns_response_add_rrset(&response, p->rrsets->items[i], 0);
+    return dns_response_finish(&response);
+}
+
+static void response_op(void *context, size_t i) {
+    (void)i;
+    size_t length = response_build(context);
+    __asm__ volatile("" : : "r"(length) : "memory");
+}
+
+static void response_teardown(void *context) {
+    message_context_t *p = context;
+    if (p->rrsets)
+        dns_rrsets_destroy(p->rrsets);
+    p->rrsets = NULL;
+    dns_message_view_release(&p->view);
+    serialize_teardown(p);
+}
+
+static size_t response_length(message_context_t *context) {
+    response_setup(context);
+    size_t length = response_build(context);
+    response_teardown(context);
+    return length;
+}
+
+static void bench_messages(size_t iterations) {
+    static const struct {
+        const char *name;
+        void (*build)(packet_t *);
+    } shapes[] = {
+        {"query", build_query},
+        {"response_plain", build_response_plain},
+        {"response_compressed", build_response_compressed},
+    };
+    message_context_t context;
+    char name[128];
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]) + 1; ++s) {
+        const char *shape;
+        if (s < sizeof(shapes) / sizeof(shapes[0])) {
+            shape = shapes[s].name;
+            shapes[s].build(&context.packet);
+        } else {
+            shape = "response_many_answers";
+            build_response_many(&context.packet, 32);
+        }
+        context.count = iterations;
+
+        snprintf(name, sizeof(name), "parse_dns_message/%s", shape);
+        benchmark_t parse = {name, iterations, parse_setup, parse_op, messages_teardown, &context, 0};
+        run_benchmark(&parse);
+
+        snprintf(name, sizeof(name), "dns_message_view/%s", shape);
+        benchmark_t view = {name, iterations, NULL, view_op, NULL, &context, 0};
+        run_benchmark(&view);
+
+        snprintf(name, sizeof(name), "convert_dns_message_to_stream/%s", shape);
+        benchmark_t serialize = {name, iterations, serialize_setup, serialize_op, serialize_teardown, &context, serialized_length(&context.packet)};
+        run_benchmark(&serialize);
+
+        snprintf(name, sizeof(name), "clone_dns_message/%s", shape);
+        benchmark_t clone = {name, iterations, clone_setup, clone_op, clone_teardown, &context, 0};
+        run_benchmark(&clone);
+
+        snprintf(name, sizeof(name), "dns_response/%s", shape);
+        benchmark_t response = {name, iterations, response_setup, response_op, response_teardown, &context, response_length(&context)};
+        run_benchmark(&response);
+    }
+    return;
+}
+
+/* convert_dns_message_to_stream / dns_response with name compression on and off, on responses with several answers. */
+
+static void bench_compression(size_t iterations) {
+    static const char *const modes[] = {"uncompressed", "compressed"};
+    message_context_t context;
+    char name[128];
+    for (size_t s = 0; s < 2; ++s) {
+        const char *shape = s ? "response_many_answers" : "response_plain";
+        if (s)
+            build_response_many(&context.packet, 32);
+        else
+            build_response_plain(&context.packet);
+        context.count = iterations;
+        for (size_t compressed = 0; compressed < 2; ++compressed) {
+            dns_use_name_compression(compressed);
+
+            snprintf(name, sizeof(name), "convert_dns_message_to_stream/%s/%s", shape, modes[compressed]);
+            benchmark_t serialize = {name, iterations, serialize_setup, serialize_op, serialize_teardown, &context, serialized_length(&context.packet)};
+            run_benchmark(&serialize);
+
+            snprintf(name, sizeof(name), "dns_response/%s/%s", shape, modes[compressed]);
+            benchmark_t response = {name, iterations, response_setup, response_op, response_teardown, &context, response_length(&context)};
+            run_benchmark(&response);
+        }
+    }
+    dns_use_name_compression(true);
+    return;
+}
+
+/* trie_insert / trie_find. */
+
+enum { trie_key_size = 32 };
+
+typedef struct trie_context {
+    trie_t trie;
+    uint8_t *keys;
+    uint8_t *lengths;
+    size_t count;
+} trie_context_t;
+
+static size_t make_name_key(uint8_t *key, size_t i) {
+    char name[trie_key_size];
+    int length = snprintf(name, sizeof(name), "h%zu.example.com", i);
+    name_field_t *name_field = name_field_create(name, length);
+    memcpy(key, name_field->name, name_field->length);
+    size_t result = name_field->length;
+    name_field_destroy(name_field);
+    return result;
+}
+
+static void trie_keys_create(trie_context_t *p, size_t count) {
+    p->count = count;
+    p->keys = malloc(trie_key_size * count);
+    p->lengths = malloc(count);
+    for (size_t i = 0; i < count; ++i)
+        p->lengths[i] = make_name_key(p->keys + i * trie_key_size, i);
+}
+
+static void trie_keys_destroy(trie_context_t *p) {
+    free(p->keys);
+    p->keys = NULL;
+    free(p->lengths);
+    p->lengths = NULL;
+}
+
+static void trie_insert_op(void *context, size_t i) {
+    trie_context_t *p = context;
+    trie_insert(p->trie, p->keys + i * trie_key_size, p->lengths[i]);
+}
+
+static void trie_find_op(void *context, size_t i) {
+    trie_context_t *p = context;
+    size_t k = (i * 2654435761u) % p->count;
+    trie_node_t *node = trie_find(p->trie, p->keys + k * trie_key_size, p->lengths[k]);
+    __asm__ volatile("" : : "r"(node) : "memory");
+}
+
+static size_t physical_memory(void) {
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages <= 0 || page_size <= 0)
+        return (size_t)-1;
+    return (size_t)pages * (size_t)page_size;
+}
+
+static void bench_trie(const size_t *scales, size_t scale_count) {
+    char name[128];
+    double bytes_per_key = 0;
+    for (size_t s = 0; s < scale_count; ++s) {
+        size_t count = scales[s];
+        snprintf(name, sizeof(name), "trie_insert/%zu", count);
+        if (bytes_per_key * count > physical_memory() / 2) {
+            report_skipped(name, "insufficient memory");
+            snprintf(name, sizeof(name), "trie_find/%zu", count);
+            report_skipped(name, "insufficient memory");
+            continue;
+        }
+        trie_context_t context;
+        trie_keys_create(&context, count);
+        context.trie = trie_create();
+
+        benchmark_t insert = {name, count, NULL, trie_insert_op, NULL, &context, 0};
+        run_benchmark(&insert);
+        bytes_per_key = (double)alloc_bytes / count;
+
+        snprintf(name, sizeof(name), "trie_find/%zu", count);
+        benchmark_t find = {name, count, NULL, trie_find_op, NULL, &context, 0};
+        run_benchmark(&find);
+
+        trie_destroy(context.trie, NULL);
+        trie_keys_destroy(&context);
+    }
+    return;
+}
+
+/* dns_cache_insert / dns_cache_answer. */
+
+typedef struct cache_context {
+    question_t *questions;
+    resource_record_t *records;
+    forward_list_node_t *answers;
+    size_t count;
+    size_t hit_percent;
+    packet_t query;
+    dns_message_view_t view;
+    uint8_t buffer[4096];
+} cache_context_t;
+
+static void cache_context_create(cache_context_t *p, size_t count) {
+    p->count = count;
+    p->questions = malloc(sizeof(question_t) * count * 2);
+    p->records = malloc(sizeof(resource_record_t) * count * 2);
+    p->answers = malloc(sizeof(forward_list_node_t) * count * 2);
+    for (size_t i = 0; i < count * 2; ++i) {
+        char name[trie_key_size];
+        int length = snprintf(name, sizeof(name), "h%zu.example.com", i);
+        p->questions[i].qname = name_field_create(name, length);
+        p->questions[i].canonical_qname = p->questions[i].qname;
+        p->questions[i].qtype = 1;
+        p->questions[i].qclass = 1;
+        p->records[i].name = p->questions[i].qname;
+        p->records[i].type = 1;
+        p->records[i].class = 1;
+        p->records[i].ttl = 3600;
+        p->records[i].rd_length = 4;
+        p->records[i].rdata = malloc(4);
+        memcpy(p->records[i].rdata, &i, 4);
+        p->answers[i].value = &p->records[i];
+        p->answers[i].next = NULL;
+    }
+    build_query(&p->query);
+    dns_message_view_init(&p->view, p->query.data, p->query.length);
+    dns_message_view_question(&p->view);
+}
+
+static void cache_context_destroy(cache_context_t *p) {
+    for (size_t i = 0; i < p->count * 2; ++i) {
+        name_field_destroy(p->questions[i].qname);
+        free(p->records[i].rdata);
+    }
+    free(p->questions);
+    p->questions = NULL;
+    free(p->records);
+    p->records = NULL;
+    free(p->answers);
+    p->answers = NULL;
+    dns_message_view_release(&p->view);
+}
+
+static void cache_insert_op(void *context, size_t i) {
+    cache_context_t *p = context;
+    dns_cache_insert(&p->questions[i], &p->answers[i]);
+}
+
+static void cache_answer_op(void *context, size_t i) {
+    cache_context_t *p = context;
+    size_t k = (i * 2654435761u) % p->count;
+    /* The second half of the key set is never inserted, so it always misses. */
+    if ((i * 40503u) % 100 >= p->hit_percent)
+        k += p->count;
+    dns_response_t response;
+    dns_response_init(&response, p->buffer, sizeof(p->buffer), &p->view, 0);
+    size_t count = dns_cache_answer(&p->questions[k], &response);
+    __asm__ volatile("" : : "r"(count) : "memory");
+}
+
+static void bench_cache(size_t count, size_t iterations) {
+    static const size_t hit_percents[] = {0, 50, 90, 100};
+    char name[128];
+    cache_context_t context;
+    cache_context_create(&context, count);
+    dns_cache_init(-1, -1, true);
+
+    snprintf(name, sizeof(name), "dns_cache_insert/%zu", count);
+    benchmark_t insert = {name, count, NULL, cache_insert_op, NULL, &context, 0};
+    run_benchmark(&insert);
+
+    for (size_t h = 0; h < sizeof(hit_percents) / sizeof(hit_percents[0]); ++h) {
+        context.hit_percent = hit_percents[h];
+        snprintf(name, sizeof(name), "dns_cache_answer/%zu/hit%zu", count, hit_percents[h]);
+        benchmark_t query = {name, iterations, NULL, cache_answer_op, NULL, &context, 0};
+        run_benchmark(&query);
+    }
+    cache_context_destroy(&context);
+    return;
+}
+
+/* hot_keys_query. */
+
+static void hot_keys_op(void *context, size_t i) {
+    static const struct sockaddr_in client = {.sin_family = AF_INET, .sin_addr = {.s_addr = 0x0100007f}};
+    cache_context_t *p = context;
+    hot_keys_query(&p->questions[(i * 2654435761u) % (p->count * 2)], &client);
+}
+
+static void bench_hot_keys(size_t count, size_t iterations) {
+    char name[128];
+    cache_context_t context;
+    cache_context_create(&context, count);
+    hot_keys_init(10);
+
+    snprintf(name, sizeof(name), "hot_keys_query/%zu", count * 2);
+    benchmark_t query = {name, iterations, NULL, hot_keys_op, NULL, &context, 0};
+    run_benchmark(&query);
+    cache_context_destroy(&context);
+    return;
+}
+
+/* Entry point. */
+
+static size_t parse_scales(char *arg, size_t *scales, size_t capacity) {
+    size_t count = 0;
+    for (char *token = strtok(arg, ","); token && count < capacity; token = strtok(NULL, ","))
+        scales[count++] = strtoul(token, NULL, 10);
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    size_t iterations = 200000;
+    size_t cache_keys = 10000;
+    size_t trie_scales[16] = {10000, 1000000, 10000000};
+    size_t trie_scale_count = 3;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc)
+            iterations = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--cache-keys") == 0 && i + 1 < argc)
+            cache_keys = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--trie-keys") == 0 && i + 1 < argc)
+            trie_scale_count = parse_scales(argv[++i], trie_scales, sizeof(trie_scales) / sizeof(trie_scales[0]));
+        else {
+            fprintf(stderr, "Usage: %s [--iterations n] [--cache-keys n] [--trie-keys n[,n...]]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    logger_init("/dev/null", 0, false);
+    bench_messages(iterations);
+    bench_compression(iterations);
+    bench_trie(trie_scales, trie_scale_count);
+    bench_cache(cache_keys, iterations);
+    bench_hot_keys(cache_keys, iterations);
+    return 0;
+}
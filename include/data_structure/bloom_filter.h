@@ -0,0 +1,102 @@
+/**
+ * @file bloom_filter.h
+ * @brief Header file for a split-block Bloom filter data structure.
+ *
+ * The filter is an array of 64-byte blocks, one cache line each. The high 32 bits of a hash select
+ * the block and the low 32 bits set one bit in each of the eight 64-bit words of that block,
+ * so every query touches exactly one cache line. Hashes that differ only in their low 32 bits
+ * share a block.
+ */
+
+#pragma once
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @def BLOOM_FILTER_BLOCK_SIZE
+ * @brief The size of a block in bytes.
+ */
+#define BLOOM_FILTER_BLOCK_SIZE 64
+
+/**
+ * @def BLOOM_FILTER_BITS_PER_KEY
+ * @brief The number of bits reserved for each expected key.
+ */
+#define BLOOM_FILTER_BITS_PER_KEY 16
+
+/**
+ * @struct bloom_filter
+ * @brief A split-block Bloom filter.
+ */
+typedef struct bloom_filter {
+    uint64_t *blocks;   /**< The blocks, 8 words each. */
+    size_t block_count; /**< The number of blocks. */
+    size_t key_count;   /**< The number of keys added. */
+    bool owned;         /**< Whether the blocks are freed with the filter. */
+} bloom_filter_t;
+
+/**
+ * @brief Creates an empty Bloom filter.
+ *
+ * @param expected_key_count The number of keys the filter is sized for.
+ * @return Pointer to the newly created Bloom filter.
+ */
+bloom_filter_t *bloom_filter_create(size_t expected_key_count);
+
+/**
+ * @brief Creates a read-only Bloom filter over blocks stored elsewhere, such as a mapped file.
+ *
+ * @param data Pointer to the blocks, aligned to BLOOM_FILTER_BLOCK_SIZE.
+ * @param size Size of the blocks in bytes, a multiple of BLOOM_FILTER_BLOCK_SIZE.
+ * @return Pointer to the newly created Bloom filter.
+ */
+bloom_filter_t *bloom_filter_wrap(const void *data, size_t size);
+
+/**
+ * @brief Destroys a Bloom filter.
+ *
+ * @param filter Pointer to the Bloom filter to be destroyed.
+ */
+void bloom_filter_destroy(bloom_filter_t *filter);
+
+/**
+ * @brief Adds a hash to the Bloom filter.
+ *
+ * Several threads may add to the same filter concurrently.
+ *
+ * @param filter Pointer to the Bloom filter.
+ * @param hash The 64-bit hash of the key.
+ */
+void bloom_filter_add(bloom_filter_t *filter, uint64_t hash);
+
+/**
+ * @brief Checks if a hash may have been added to the Bloom filter.
+ *
+ * @param filter Pointer to the Bloom filter.
+ * @param hash The 64-bit hash of the key.
+ * @return false if the hash was definitely not added, true otherwise.
+ */
+bool bloom_filter_contains(const bloom_filter_t *filter, uint64_t hash);
+
+/**
+ * @brief Gets the size of the blocks of a Bloom filter.
+ *
+ * @param filter Pointer to the Bloom filter.
+ * @return Size of the blocks in bytes.
+ */
+size_t bloom_filter_size(const bloom_filter_t *filter);
+
+/**
+ * @brief Measures the false-positive rate of a Bloom filter.
+ *
+ * @param filter Pointer to the Bloom filter.
+ * @param probe_count The number of random hashes to probe.
+ * @return The fraction of random hashes reported as contained.
+ */
+double bloom_filter_false_positive_rate(const bloom_filter_t *filter, size_t probe_count);
+
+#endif
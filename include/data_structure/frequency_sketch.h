@@ -0,0 +1,94 @@
+/**
+ * @file frequency_sketch.h
+ * @brief Header file for a count-min sketch of access frequencies.
+ *
+ * The sketch keeps 4-bit saturating counters in 64-byte blocks. A hash selects one block and one
+ * counter in each of four pairs of words of that block, so every update and estimate touches a
+ * single cache line; the estimate is the smallest of the four counters. Once the number of
+ * increments reaches ten times the expected number of keys, every counter is halved, so the
+ * sketch follows changes in popularity instead of accumulating counts forever.
+ */
+
+#pragma once
+#ifndef FREQUENCY_SKETCH_H
+#define FREQUENCY_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @def FREQUENCY_SKETCH_BLOCK_SIZE
+ * @brief The size of a block in bytes.
+ */
+#define FREQUENCY_SKETCH_BLOCK_SIZE 64
+
+/**
+ * @def FREQUENCY_SKETCH_MAX
+ * @brief The largest value of a counter.
+ */
+#define FREQUENCY_SKETCH_MAX 15
+
+/**
+ * @struct frequency_sketch
+ * @brief A count-min sketch with periodic aging.
+ */
+typedef struct frequency_sketch {
+    uint64_t *blocks;   /**< The blocks, 8 words of 16 counters each. */
+    size_t block_count; /**< The number of blocks, a power of two. */
+    size_t sample_size; /**< The number of increments after which the counters are halved. */
+    size_t additions;   /**< The number of increments since the counters were last halved. */
+    size_t expected;    /**< The number of keys the sketch is sized for. */
+} frequency_sketch_t;
+
+/**
+ * @brief Creates an empty frequency sketch.
+ *
+ * @param expected_count The number of distinct keys the sketch is sized for.
+ * @return Pointer to the newly created sketch.
+ */
+frequency_sketch_t *frequency_sketch_create(size_t expected_count);
+
+/**
+ * @brief Destroys a frequency sketch.
+ *
+ * @param sketch Pointer to the sketch to be destroyed.
+ */
+void frequency_sketch_destroy(frequency_sketch_t *sketch);
+
+/**
+ * @brief Resizes a frequency sketch for more keys, keeping its counts.
+ *
+ * The estimate of every key is the same after the resize. Does nothing if the sketch is already
+ * sized for at least that many keys.
+ *
+ * @param sketch Pointer to the sketch.
+ * @param expected_count The number of distinct keys the sketch is sized for.
+ */
+void frequency_sketch_reserve(frequency_sketch_t *sketch, size_t expected_count);
+
+/**
+ * @brief Records an access to a key.
+ *
+ * @param sketch Pointer to the sketch.
+ * @param hash The 64-bit hash of the key.
+ */
+void frequency_sketch_increment(frequency_sketch_t *sketch, uint64_t hash);
+
+/**
+ * @brief Estimates the number of recent accesses to a key.
+ *
+ * @param sketch Pointer to the sketch.
+ * @param hash The 64-bit hash of the key.
+ * @return The estimate, at most FREQUENCY_SKETCH_MAX.
+ */
+unsigned frequency_sketch_estimate(const frequency_sketch_t *sketch, uint64_t hash);
+
+/**
+ * @brief Gets the memory used by a frequency sketch.
+ *
+ * @param sketch Pointer to the sketch.
+ * @return Size in bytes.
+ */
+size_t frequency_sketch_size(const frequency_sketch_t *sketch);
+
+#endif
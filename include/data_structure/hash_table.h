@@ -0,0 +1,124 @@
+/**
+ * @file hash_table.h
+ * @brief Header file for an open-addressing hash table.
+ *
+ * The table follows the SwissTable layout: the slots are split into groups of 16, and every slot
+ * has a control byte that is either empty or holds the low 7 bits of the hash of its value.
+ * A lookup compares the control bytes of a whole group at once (with SSE2 where available)
+ * and only looks at the slots whose control byte matches, so a lookup usually touches one
+ * control group and one slot. The table stores the full hash with each value and leaves
+ * the comparison of keys to the caller. Removed slots become tombstones that are dropped
+ * when the table is rehashed.
+ */
+
+#pragma once
+#ifndef HASH_TABLE_H
+#define HASH_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @def HASH_TABLE_GROUP_SIZE
+ * @brief The number of slots whose control bytes are compared at once.
+ */
+#define HASH_TABLE_GROUP_SIZE 16
+
+/**
+ * @struct hash_table_slot
+ * @brief A slot of the hash table.
+ */
+typedef struct hash_table_slot {
+    uint64_t hash; /**< The hash of the value. */
+    void *value;   /**< The value. */
+} hash_table_slot_t;
+
+/**
+ * @struct hash_table
+ * @brief An open-addressing hash table.
+ */
+typedef struct hash_table {
+    uint8_t *control;         /**< The control bytes, one per slot. */
+    hash_table_slot_t *slots; /**< The slots. */
+    size_t capacity;          /**< The number of slots, a power of two and a multiple of HASH_TABLE_GROUP_SIZE. */
+    size_t count;             /**< The number of values. */
+    size_t growth_left;       /**< The number of empty slots that can be filled before the table is rehashed. */
+} hash_table_t;
+
+/**
+ * @brief Compares a value with a key.
+ *
+ * @param value The value stored in the table.
+ * @param key The key looked up.
+ * @return true if the value has the key, false otherwise.
+ */
+typedef bool (*hash_table_match_t)(const void *value, const void *key);
+
+/**
+ * @brief Creates an empty hash table.
+ *
+ * @param expected_count The number of values the table is sized for; it grows beyond that as needed.
+ * @return Pointer to the newly created hash table.
+ */
+hash_table_t *hash_table_create(size_t expected_count);
+
+/**
+ * @brief Destroys a hash table.
+ *
+ * @param table Pointer to the hash table.
+ * @param value_destroy Function used to destroy the values, or NULL.
+ */
+void hash_table_destroy(hash_table_t *table, void (*value_destroy)(void *));
+
+/**
+ * @brief Removes all values from a hash table, keeping its capacity.
+ *
+ * @param table Pointer to the hash table.
+ * @param value_destroy Function used to destroy the values, or NULL.
+ */
+void hash_table_clear(hash_table_t *table, void (*value_destroy)(void *));
+
+/**
+ * @brief Finds a value in a hash table.
+ *
+ * @param table Pointer to the hash table.
+ * @param hash The hash of the key.
+ * @param match Function comparing a value with the key, called only for values with the same hash.
+ * @param key The key.
+ * @return The value, or NULL if there is none with the key.
+ */
+void *hash_table_find(const hash_table_t *table, uint64_t hash, hash_table_match_t match, const void *key);
+
+/**
+ * @brief Puts a value into a hash table, replacing the value with the same key.
+ *
+ * @param table Pointer to the hash table.
+ * @param hash The hash of the key.
+ * @param match Function comparing a value with the key, called only for values with the same hash.
+ * @param key The key of the value.
+ * @param value The value, not NULL.
+ * @return The value replaced, or NULL if there was none.
+ */
+void *hash_table_put(hash_table_t *table, uint64_t hash, hash_table_match_t match, const void *key, void *value);
+
+/**
+ * @brief Removes a value from a hash table.
+ *
+ * @param table Pointer to the hash table.
+ * @param hash The hash of the key.
+ * @param match Function comparing a value with the key, called only for values with the same hash.
+ * @param key The key.
+ * @return The value removed, or NULL if there was none with the key.
+ */
+void *hash_table_remove(hash_table_t *table, uint64_t hash, hash_table_match_t match, const void *key);
+
+/**
+ * @brief Gets the memory used by a hash table, excluding its values.
+ *
+ * @param table Pointer to the hash table.
+ * @return Size in bytes.
+ */
+size_t hash_table_size(const hash_table_t *table);
+
+#endif
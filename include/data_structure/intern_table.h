@@ -0,0 +1,95 @@
+/**
+ * @file intern_table.h
+ * @brief Header file for a table of reference-counted interned byte strings.
+ *
+ * Interning a string returns the one shared copy of it, so equal strings are represented by the
+ * same pointer and compared by address. Every acquisition holds a reference that is given back
+ * with intern_table_release; the copy is freed when its last reference is released. The caller
+ * supplies the hash of each string, and may attach a value to each interned string, so the
+ * table can serve as an index keyed by the strings.
+ */
+
+#pragma once
+#ifndef INTERN_TABLE_H
+#define INTERN_TABLE_H
+
+#include "data_structure/hash_table.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @struct interned
+ * @brief An interned string.
+ */
+typedef struct interned {
+    void *value;       /**< The value attached by the user of the table, NULL when the string is interned. */
+    uint32_t refcount; /**< The number of references held. */
+    uint32_t length;   /**< The length of the string. */
+    uint8_t data[];    /**< The string. */
+} interned_t;
+
+/**
+ * @struct intern_table
+ * @brief A table of interned strings.
+ */
+typedef struct intern_table {
+    hash_table_t *table; /**< The strings, indexed by hash. */
+    size_t bytes;        /**< The bytes allocated for the strings, allocator overhead included. */
+} intern_table_t;
+
+/**
+ * @brief Creates an empty intern table.
+ *
+ * @param expected_count The number of strings the table is sized for; it grows beyond that as needed.
+ * @return Pointer to the newly created intern table.
+ */
+intern_table_t *intern_table_create(size_t expected_count);
+
+/**
+ * @brief Destroys an intern table and the strings left in it.
+ *
+ * @param table Pointer to the intern table.
+ */
+void intern_table_destroy(intern_table_t *table);
+
+/**
+ * @brief Finds an interned string without taking a reference.
+ *
+ * @param table Pointer to the intern table.
+ * @param data The string.
+ * @param length The length of the string.
+ * @param hash The hash of the string.
+ * @return The interned string, or NULL if the string is not interned.
+ */
+interned_t *intern_table_find(const intern_table_t *table, const uint8_t *data, size_t length, uint64_t hash);
+
+/**
+ * @brief Interns a string and takes a reference to it.
+ *
+ * @param table Pointer to the intern table.
+ * @param data The string.
+ * @param length The length of the string.
+ * @param hash The hash of the string.
+ * @return The interned string.
+ */
+interned_t *intern_table_acquire(intern_table_t *table, const uint8_t *data, size_t length, uint64_t hash);
+
+/**
+ * @brief Releases a reference to an interned string, freeing it with its last reference.
+ *
+ * @param table Pointer to the intern table.
+ * @param interned The interned string.
+ * @param hash The hash of the string.
+ */
+void intern_table_release(intern_table_t *table, const interned_t *interned, uint64_t hash);
+
+/**
+ * @brief Gets the memory used by an intern table and its strings.
+ *
+ * @param table Pointer to the intern table.
+ * @return Size in bytes.
+ */
+size_t intern_table_size(const intern_table_t *table);
+
+#endif
@@ -7,6 +7,8 @@
 #ifndef LIST_H
 #define LIST_H
 
+#include <stdbool.h>
+
 /**
  * @struct list_node
  * @brief A node in the doubly linked list.
@@ -19,4 +21,34 @@ typedef struct list_node {
     struct list_node *next; /**< Pointer to the next node in the list. */
 } list_node_t;
 
+/**
+ * @brief Initializes the sentinel of an empty circular list.
+ *
+ * @param head Pointer to the sentinel, whose next node is the front of the list and previous node the back.
+ */
+void list_init(list_node_t *head);
+
+/**
+ * @brief Checks if a circular list is empty.
+ *
+ * @param head Pointer to the sentinel.
+ * @return true if the list has no node besides the sentinel, false otherwise.
+ */
+bool list_empty(const list_node_t *head);
+
+/**
+ * @brief Links a node into a circular list after a given node.
+ *
+ * @param position Pointer to the node, or the sentinel, to link after.
+ * @param node Pointer to the node to be linked.
+ */
+void list_insert_after(list_node_t *position, list_node_t *node);
+
+/**
+ * @brief Unlinks a node from the circular list it is in.
+ *
+ * @param node Pointer to the node to be unlinked.
+ */
+void list_remove(list_node_t *node);
+
 #endif
@@ -0,0 +1,110 @@
+/**
+ * @file miss_ratio_curve.h
+ * @brief Header file for an online estimate of the miss-ratio curve of an LRU cache.
+ *
+ * The estimate follows SHARDS with a fixed sample size: a key is sampled when its spatial hash is
+ * below a threshold, so every access to a sampled key is seen and the sampled keys are a uniform
+ * fraction of all keys. The reuse distance of each sampled access, the number of distinct sampled
+ * keys accessed since the previous access to the same key, is counted with a Fenwick tree over the
+ * last access times and scaled up by the sampling rate. Once the sample is full, the key with the
+ * largest hash is dropped and the threshold lowered to it, so the memory stays constant however
+ * many keys there are. The histogram of distances gives the hit ratio of an LRU cache of any size;
+ * it is halved periodically so that the curve follows the traffic.
+ */
+
+#pragma once
+#ifndef MISS_RATIO_CURVE_H
+#define MISS_RATIO_CURVE_H
+
+#include "data_structure/hash_table.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @def MISS_RATIO_CURVE_BIN_COUNT
+ * @brief The number of bins of the histogram: distance 0, then one bin per power of two.
+ */
+#define MISS_RATIO_CURVE_BIN_COUNT 48
+
+/**
+ * @struct miss_ratio_sample
+ * @brief A sampled key.
+ */
+typedef struct miss_ratio_sample {
+    uint64_t key;        /**< The hash of the key. */
+    uint32_t value;      /**< The spatial hash compared with the threshold. */
+    uint32_t time;       /**< The time of the last access, an index of the Fenwick tree. */
+    uint32_t heap_index; /**< The position of the sample in the heap. */
+} miss_ratio_sample_t;
+
+/**
+ * @struct miss_ratio_curve
+ * @brief The state of the estimate.
+ */
+typedef struct miss_ratio_curve {
+    size_t sample_limit;            /**< The largest number of sampled keys. */
+    size_t sample_count;            /**< The number of sampled keys. */
+    miss_ratio_sample_t *samples;   /**< The sampled keys, sample_limit + 1 of them. */
+    uint32_t *heap;                 /**< The samples ordered as a max-heap by spatial hash. */
+    hash_table_t *index;            /**< The samples, indexed by key. */
+    uint32_t *tree;                 /**< The Fenwick tree marking the last access time of each sample. */
+    uint32_t time_limit;            /**< The number of times in the tree, after which the times are compacted. */
+    uint32_t now;                   /**< The time of the last sampled access. */
+    uint64_t threshold;             /**< Keys whose spatial hash is below this are sampled. */
+    double bins[MISS_RATIO_CURVE_BIN_COUNT]; /**< The weighted counts of accesses by scaled distance. */
+    double sampled;                 /**< The weighted count of sampled accesses, reuses or not. */
+    double accesses;                /**< The count of all accesses. */
+    uint64_t window;                /**< The number of accesses after which the counts are halved. */
+} miss_ratio_curve_t;
+
+/**
+ * @brief Creates an empty estimate.
+ *
+ * @param sample_limit The largest number of sampled keys, which bounds the memory used.
+ * @param window The number of accesses after which the counts are halved, 0 to never halve them.
+ * @return Pointer to the newly created estimate.
+ */
+miss_ratio_curve_t *miss_ratio_curve_create(size_t sample_limit, uint64_t window);
+
+/**
+ * @brief Destroys an estimate.
+ *
+ * @param curve Pointer to the estimate.
+ */
+void miss_ratio_curve_destroy(miss_ratio_curve_t *curve);
+
+/**
+ * @brief Records an access to a key.
+ *
+ * @param curve Pointer to the estimate.
+ * @param key The 64-bit hash of the key.
+ */
+void miss_ratio_curve_access(miss_ratio_curve_t *curve, uint64_t key);
+
+/**
+ * @brief Estimates the hit ratio of an LRU cache holding a number of keys.
+ *
+ * @param curve Pointer to the estimate.
+ * @param size The number of keys the cache holds.
+ * @return The estimated fraction of accesses that hit, between 0 and 1.
+ */
+double miss_ratio_curve_hit_ratio(const miss_ratio_curve_t *curve, size_t size);
+
+/**
+ * @brief Gets the fraction of keys currently sampled.
+ *
+ * @param curve Pointer to the estimate.
+ * @return The sampling rate, between 0 and 1.
+ */
+double miss_ratio_curve_sample_rate(const miss_ratio_curve_t *curve);
+
+/**
+ * @brief Gets the memory used by an estimate.
+ *
+ * @param curve Pointer to the estimate.
+ * @return Size in bytes.
+ */
+size_t miss_ratio_curve_size(const miss_ratio_curve_t *curve);
+
+#endif
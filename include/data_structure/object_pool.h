@@ -0,0 +1,125 @@
+/**
+ * @file object_pool.h
+ * @brief Header file for slab pools of fixed-size objects.
+ *
+ * A pool carves objects of one size out of 2 MiB slabs that are never returned to the system,
+ * so long-lived objects freed in any order do not fragment the heap. Each thread keeps a small
+ * cache of free objects per pool and only takes the pool lock to move a batch of objects
+ * between its cache and the pool. Objects may be freed by a thread other than the one that
+ * allocated them; the cache of a thread is returned to the pools when the thread exits.
+ * Objects are aligned to the size of a pointer.
+ *
+ * Pools are defined statically with OBJECT_POOL_INITIALIZER and register themselves on first use.
+ */
+
+#pragma once
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @def OBJECT_POOL_LIMIT
+ * @brief The maximum number of pools in a process.
+ */
+#define OBJECT_POOL_LIMIT 16
+
+/**
+ * @def OBJECT_POOL_SLAB_SIZE
+ * @brief The size of a slab in bytes, one huge page on x86.
+ */
+#define OBJECT_POOL_SLAB_SIZE (2 << 20)
+
+/**
+ * @def OBJECT_POOL_INITIALIZER
+ * @brief Static initializer of a pool.
+ *
+ * @param pool_name The name of the pool in the statistics.
+ * @param size The size of an object in bytes.
+ */
+#define OBJECT_POOL_INITIALIZER(pool_name, size) {.name = (pool_name), .object_size = (size), .mutex = PTHREAD_MUTEX_INITIALIZER}
+
+/**
+ * @struct object_pool
+ * @brief A pool of fixed-size objects.
+ */
+typedef struct object_pool {
+    const char *name;        /**< The name of the pool. */
+    size_t object_size;      /**< The size of an object, rounded up to the object alignment on first use. */
+    atomic_size_t index;     /**< The registry slot of the pool plus one, 0 until first use. */
+    size_t batch;            /**< The number of objects moved between a thread cache and the pool at once. */
+    pthread_mutex_t mutex;   /**< The lock of the fields below. */
+    void *free_list;         /**< The free objects held by the pool. */
+    size_t free_count;       /**< The number of free objects held by the pool. */
+    uint8_t *slab_cursor;    /**< The first byte of the current slab not yet carved. */
+    uint8_t *slab_end;       /**< The end of the current slab. */
+    size_t slab_count;       /**< The number of slabs. */
+    size_t huge_slab_count;  /**< The number of slabs backed by explicit huge pages. */
+    size_t object_count;     /**< The number of objects carved. */
+} object_pool_t;
+
+/**
+ * @struct object_pool_stats
+ * @brief Usage statistics of a pool.
+ */
+typedef struct object_pool_stats {
+    const char *name;       /**< The name of the pool. */
+    size_t object_size;     /**< The size of an object. */
+    size_t slab_count;      /**< The number of slabs. */
+    size_t huge_slab_count; /**< The number of slabs backed by explicit huge pages. */
+    size_t reserved_bytes;  /**< The bytes reserved by the slabs. */
+    size_t object_count;    /**< The number of objects carved. */
+    size_t free_count;      /**< The number of free objects, in the pool or in thread caches. */
+} object_pool_stats_t;
+
+/**
+ * @brief Chooses how slabs allocated from now on are backed.
+ *
+ * With huge pages, a slab is first requested from the explicit huge page pool and, failing that,
+ * mapped at a 2 MiB boundary and advised for transparent huge pages.
+ *
+ * @param enable Whether to back slabs with huge pages.
+ */
+void object_pool_use_huge_pages(bool enable);
+
+/**
+ * @brief Allocates an object from a pool.
+ *
+ * @param pool Pointer to the pool.
+ * @return Pointer to the object, with undefined contents, or NULL if no slab could be mapped.
+ */
+void *object_pool_alloc(object_pool_t *pool);
+
+/**
+ * @brief Returns an object to a pool.
+ *
+ * @param pool Pointer to the pool the object was allocated from.
+ * @param object Pointer to the object.
+ */
+void object_pool_free(object_pool_t *pool, void *object);
+
+/**
+ * @brief Collects the usage statistics of the registered pools.
+ *
+ * The counts of objects in thread caches are read without stopping the threads, so they may
+ * be slightly out of date.
+ *
+ * @param stats Array receiving the statistics.
+ * @param capacity The number of elements of the array.
+ * @return The number of pools whose statistics were written.
+ */
+size_t object_pool_collect(object_pool_stats_t *stats, size_t capacity);
+
+/**
+ * @brief Prints the usage statistics of the registered pools.
+ *
+ * @param stream The stream to print to.
+ */
+void object_pool_report(FILE *stream);
+
+#endif
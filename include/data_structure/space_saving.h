@@ -0,0 +1,106 @@
+/**
+ * @file space_saving.h
+ * @brief Header file for a space-saving summary of the most frequent keys of a stream.
+ *
+ * The summary keeps a fixed number of counters, each holding a key, its count and the largest
+ * amount by which the count may overestimate it. A key that has a counter gets its count raised;
+ * a key that has none takes over the counter with the smallest count, starting from that count,
+ * which becomes its error. Every key occurring more than total / capacity times is therefore in
+ * the summary, and no count is more than total / capacity too high. The counters are found by a
+ * linear-probing index of the key hashes and ordered in a min-heap by count, so an update touches
+ * a few cache lines and allocates nothing. The counts are halved once the total reaches a window,
+ * so the summary follows the current traffic.
+ */
+
+#pragma once
+#ifndef SPACE_SAVING_H
+#define SPACE_SAVING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @struct space_saving_counter
+ * @brief The counter of a key.
+ */
+typedef struct space_saving_counter {
+    uint64_t hash;       /**< The hash of the key. */
+    uint64_t count;      /**< The estimated count of the key, never below the true count. */
+    uint64_t error;      /**< The largest amount by which the count may exceed the true count. */
+    uint32_t heap_index; /**< The position of the counter in the heap. */
+    uint32_t length;     /**< The length of the key. */
+} space_saving_counter_t;
+
+/**
+ * @struct space_saving
+ * @brief A space-saving summary.
+ */
+typedef struct space_saving {
+    size_t capacity;                  /**< The number of counters. */
+    size_t count;                     /**< The number of counters in use. */
+    size_t key_size;                  /**< The largest length of a key. */
+    space_saving_counter_t *counters; /**< The counters. */
+    uint8_t *keys;                    /**< The keys, key_size bytes for each counter. */
+    uint32_t *heap;                   /**< The counters ordered as a min-heap by count. */
+    uint32_t *index;                  /**< The linear-probing index, holding 1 + the number of a counter, or 0 when empty. */
+    size_t index_mask;                /**< The number of slots of the index minus one. */
+    uint64_t total;                   /**< The total count since the counts were last halved. */
+    uint64_t window;                  /**< The total after which the counts are halved, 0 to never halve them. */
+} space_saving_t;
+
+/**
+ * @brief Creates an empty summary.
+ *
+ * @param capacity The number of counters.
+ * @param key_size The largest length of a key; longer keys are truncated.
+ * @param window The total count after which the counts are halved, 0 to never halve them.
+ * @return Pointer to the newly created summary.
+ */
+space_saving_t *space_saving_create(size_t capacity, size_t key_size, uint64_t window);
+
+/**
+ * @brief Destroys a summary.
+ *
+ * @param summary Pointer to the summary.
+ */
+void space_saving_destroy(space_saving_t *summary);
+
+/**
+ * @brief Counts occurrences of a key.
+ *
+ * @param summary Pointer to the summary.
+ * @param key The key.
+ * @param length The length of the key.
+ * @param hash The hash of the key.
+ * @param weight The number of occurrences.
+ */
+void space_saving_offer(space_saving_t *summary, const uint8_t *const key, size_t length, uint64_t hash, uint64_t weight);
+
+/**
+ * @brief Gets the key of a counter.
+ *
+ * @param summary Pointer to the summary.
+ * @param counter Pointer to a counter of the summary.
+ * @return The key, counter->length bytes long.
+ */
+const uint8_t *space_saving_key(const space_saving_t *summary, const space_saving_counter_t *counter);
+
+/**
+ * @brief Gets the counters with the largest counts.
+ *
+ * @param summary Pointer to the summary.
+ * @param top The array receiving the counters, from the largest count down.
+ * @param n The size of the array.
+ * @return The number of counters written, at most n.
+ */
+size_t space_saving_top(const space_saving_t *summary, const space_saving_counter_t **top, size_t n);
+
+/**
+ * @brief Gets the memory used by a summary.
+ *
+ * @param summary Pointer to the summary.
+ * @return Size in bytes.
+ */
+size_t space_saving_size(const space_saving_t *summary);
+
+#endif
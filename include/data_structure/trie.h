@@ -72,6 +72,16 @@ void trie_destroy(trie_t p, void (*value_destroy)(void *));
  */
 trie_node_t *trie_find(trie_t rt, const trie_radix_t *binary_string, size_t len);
 
+/**
+ * @brief Creates the path of a binary string in the trie without counting it.
+ *
+ * @param rt Pointer to the root of the trie.
+ * @param binary_string Pointer to the binary string whose path is created.
+ * @param len Length of the binary string.
+ * @return Pointer to the last node of the path.
+ */
+trie_node_t *trie_reserve(trie_t rt, const trie_radix_t *binary_string, size_t len);
+
 /**
  * @brief Inserts a binary string into the trie.
  *
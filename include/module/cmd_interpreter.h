@@ -7,6 +7,8 @@
 #ifndef CMD_INTERPRETER_H
 #define CMD_INTERPRETER_H
 
+#include "module/rate_limit.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -18,13 +20,24 @@
  * This structure represents the command line options. Each option is represented by a member in the structure.
  */
 typedef struct cmd_opt {
-    size_t debug_level;            /**< The debug level. */
-    size_t cache_size;             /**< The cache size. */
-    uint16_t listen_port;          /**< The listening port number. */
-    const char *hosts_file_name;   /**< The name of the hosts file. */
-    const char *isp_dns_server_ip; /**< The IP address of the ISP DNS server. */
-    const char *log_file_name;     /**< The name of the log file. */
-    bool stderr_enable;            /**< Flag to enable standard error output. */
+    size_t debug_level;                    /**< The debug level. */
+    size_t cache_size;                     /**< The cache size. */
+    size_t cache_memory;                   /**< The cache memory limit in bytes. */
+    bool cache_admission;                  /**< Flag to admit cache entries by frequency (TinyLFU) rather than plain LRU. */
+    uint16_t listen_port;                  /**< The listening port number. */
+    const char *hosts_file_name;           /**< The name of the hosts file. */
+    const char *isp_dns_server_ip;         /**< The IP address of the ISP DNS server. */
+    const char *log_file_name;             /**< The name of the log file. */
+    bool stderr_enable;                    /**< Flag to enable standard error output. */
+    const char *replay_file_name;          /**< The name of the trace to replay, or NULL to serve on the network. */
+    bool huge_pages;                       /**< Flag to back object pools with huge pages. */
+    const char *cache_file_name;           /**< The name of the cache snapshot, or NULL to start cold. */
+    unsigned cache_save_interval;          /**< The number of seconds between cache snapshots, 0 to save only on shutdown. */
+    const char *shared_cache_name;         /**< The name of the shared-memory segment holding the cache, or NULL for a private cache. */
+    size_t hot_key_count;                  /**< The number of most frequent names and clients to report, 0 to disable tracking. */
+    uint32_t client_rate_limit;            /**< The number of queries per second allowed from each client, 0 for no limit. */
+    rate_limit_action_t rate_limit_action; /**< What a client over its limit gets. */
+    uint32_t response_rate_limit;          /**< The number of identical responses per second allowed to each /24 network, 0 for no limit. */
 } cmd_opt_t;
 
 /**
@@ -8,30 +8,99 @@
 #define DNS_CACHE_H
 
 #include "data_structure/forward_list.h"
-#include "data_structure/trie.h"
 #include "network/dns_utility.h"
 
+#include <stdbool.h>
+#include <stdio.h>
+
 /**
  * @brief Initializes the DNS cache.
  *
- * @param item_limit The maximum number of items that the cache can hold.
+ * RRsets are evicted to keep the cache within both limits. The memory counted is the index, the
+ * frequency sketch and the allocations of the RRsets, allocator overhead included.
+ *
+ * Without admission the cache is a plain LRU list. With admission it follows W-TinyLFU: a count-min
+ * sketch records how often each key is looked up, new RRsets wait in a small LRU window, and an RRset
+ * leaving the window only displaces the least valuable RRset of the segmented LRU main space if its
+ * key was looked up more often, so names seen once do not push out popular ones.
+ *
+ * @param item_limit The maximum number of resource records that the cache can hold.
+ * @param memory_limit The maximum number of bytes that the cache can use.
+ * @param admission Whether to filter insertions by frequency.
+ */
+void dns_cache_init(size_t item_limit, size_t memory_limit, bool admission);
+
+/**
+ * @brief Moves the DNS cache into a shared-memory segment used by every relay process on the host.
+ *
+ * Once shared, the RRsets are stored in and answered from the segment instead of the cache of the
+ * process, with the same CNAME handling; the limits and the admission policy given to
+ * dns_cache_init() no longer apply, and the segment is not saved to snapshots since it outlives
+ * the process. See shared_cache.h for its layout.
+ *
+ * @param name The name of the segment.
+ * @param size The size of the segment in bytes if it is created, (size_t)-1 for the default of 64 MiB.
+ * @return true if the segment is in use, false if it could not be opened and the cache stays private.
+ */
+bool dns_cache_share(const char *const name, size_t size);
+
+/**
+ * @brief Inserts the answers to a question into the DNS cache.
+ *
+ * The answers are grouped into RRsets, each expiring with the smallest TTL among its records, and every
+ * RRset is stored under its owner name, its type and its class, replacing the RRset stored under the
+ * same key. Only the RRsets owned by the question name or by the names it is aliased to through the
+ * CNAME chain of the answers are stored. Owner names are interned, so each name is stored once
+ * however many RRsets refer to it.
+ *
+ * @param question Pointer to the question that was answered.
+ * @param answers The list of answers.
+ */
+void dns_cache_insert(const question_t *const question, forward_list_t answers);
+
+/**
+ * @brief Appends the cached answers to a question directly to a response.
+ *
+ * When the name has no RRset of the question type but a CNAME, the chain of cached CNAME RRsets is
+ * followed and written out, up to a fixed length and without revisiting a name, so one cached
+ * target serves every alias of it. A chain that does not end in an RRset of the question type is a
+ * miss and leaves the response unchanged.
+ *
+ * @param question Pointer to the question to be answered.
+ * @param response Pointer to the response the answers are written into.
+ * @return The number of answers appended.
  */
-void dns_cache_init(size_t item_limit);
+size_t dns_cache_answer(const question_t *const question, dns_response_t *const response);
 
 /**
- * @brief Inserts a question and its corresponding resource record into the DNS cache.
+ * @brief Writes the content of the DNS cache to a snapshot file.
+ *
+ * The snapshot holds every cached RRset with its owner and its absolute expiry time, in the order
+ * of the segments it is in, followed by the frequency sketch. It is written to a temporary file
+ * that is then renamed over the snapshot.
+ *
+ * @param filename The name of the snapshot file.
+ * @return true if the snapshot was written, false otherwise or if the cache is shared.
+ */
+bool dns_cache_save(const char *const filename);
+
+/**
+ * @brief Warms the DNS cache up from a snapshot file written by dns_cache_save().
+ *
+ * The snapshot is mapped and the RRsets that have not expired yet are inserted back into the
+ * segments they were saved from, after which the limits of the cache are enforced. A missing or
+ * corrupted snapshot leaves the cache empty.
  *
- * @param question Pointer to the question to be inserted.
- * @param resource_record Pointer to the resource record to be inserted.
+ * @param filename The name of the snapshot file.
+ * @return true if the snapshot was loaded, false otherwise or if the cache is shared.
  */
-void dns_cache_insert(const question_t *const question, const resource_record_t *const resource_record);
+bool dns_cache_load(const char *const filename);
 
 /**
- * @brief Queries the DNS cache for a specific question.
+ * @brief Prints the size of the cache and its live bytes by category.
  *
- * @param question Pointer to the question to be queried.
- * @return Pointer to the node in the forward list containing the query result.
+ * @param stream The stream to print to.
  */
-forward_list_node_t *dns_cache_query(const question_t *const question);
+void dns_cache_report(FILE *stream);
 
 #endif
@@ -0,0 +1,57 @@
+/**
+ * @file hot_keys.h
+ * @brief Header file for tracking the names and clients that dominate the load.
+ *
+ * Three space-saving summaries of constant size follow the most frequent query names, the most
+ * frequent client addresses and the most frequent names relayed upstream on a cache miss. To keep
+ * the cost per query down, only a random sample of about one query in HOT_KEYS_SAMPLE_PERIOD is
+ * counted, and its count is scaled up by the period; the other queries only decrement a counter.
+ * The counts are halved periodically, so the report shows the current heavy hitters.
+ */
+
+#pragma once
+#ifndef HOT_KEYS_H
+#define HOT_KEYS_H
+
+#include "network/dns_utility.h"
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * @def HOT_KEYS_SAMPLE_PERIOD
+ * @brief The average number of queries between two sampled queries.
+ */
+#define HOT_KEYS_SAMPLE_PERIOD 64
+
+/**
+ * @brief Initializes the summaries.
+ *
+ * @param report_count The number of keys of each summary to report, 0 to disable tracking.
+ */
+void hot_keys_init(size_t report_count);
+
+/**
+ * @brief Counts a query received from a client.
+ *
+ * @param question Pointer to the question of the query.
+ * @param client_address Pointer to the address of the client.
+ */
+void hot_keys_query(const question_t *const question, const struct sockaddr_in *const client_address);
+
+/**
+ * @brief Counts the query last passed to hot_keys_query() as relayed upstream.
+ *
+ * @param question Pointer to the question of the query.
+ */
+void hot_keys_miss(const question_t *const question);
+
+/**
+ * @brief Prints the most frequent keys of each summary with their estimated counts.
+ *
+ * @param stream The stream to print to.
+ */
+void hot_keys_report(FILE *stream);
+
+#endif
@@ -40,6 +40,14 @@ void logger_init(const char *const filename, const size_t debug_level, const boo
  */
 int logger_write(const log_level level, const char *const format, ...);
 
+/**
+ * @brief Check whether logs of a level are written.
+ *
+ * @param level The log level.
+ * @return true if logs of the level are written, false otherwise.
+ */
+bool logger_enabled(const log_level level);
+
 /**
  * @brief Log hex data.
  *
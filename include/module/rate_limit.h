@@ -0,0 +1,92 @@
+/**
+ * @file rate_limit.h
+ * @brief Header file for limiting the rate of queries per client and of identical responses.
+ *
+ * Both limits are token buckets refilled once per second from the relay clock and kept in
+ * fixed-size, set-associative tables of 4 entries per cache line, so nothing is allocated per
+ * client. The tables are lossy: a key missing from its set takes over the entry refilled longest
+ * ago and starts with a full bucket, which errs on the side of letting traffic through.
+ *
+ * The client limit counts the queries of each client address. The response limit follows DNS
+ * response rate limiting: it counts the responses to each /24 client network by question name,
+ * type and response code, with NXDOMAIN responses counted by the parent of the question name so
+ * that random subdomains of a domain share a bucket. A response over the limit is dropped, except
+ * every RATE_LIMIT_SLIP_PERIOD-th one, which slips out truncated so that a real client can still retry
+ * over TCP while a spoofed victim receives no more than a small fraction of the traffic.
+ */
+
+#pragma once
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include "network/dns_utility.h"
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @def RATE_LIMIT_BURST_SECONDS
+ * @brief The number of seconds of traffic a bucket holds, allowing short bursts above the rate.
+ */
+#define RATE_LIMIT_BURST_SECONDS 2
+
+/**
+ * @def RATE_LIMIT_SLIP_PERIOD
+ * @brief One in this many responses over the response limit is sent truncated instead of dropped.
+ */
+#define RATE_LIMIT_SLIP_PERIOD 2
+
+/**
+ * @brief What a client over its limit gets.
+ */
+typedef enum rate_limit_action {
+    RATE_LIMIT_ACTION_DROP,     /**< Nothing: the query is dropped. */
+    RATE_LIMIT_ACTION_REFUSE,   /**< An empty REFUSED response. */
+    RATE_LIMIT_ACTION_TRUNCATE, /**< An empty truncated response, sending the client to TCP. */
+} rate_limit_action_t;
+
+/**
+ * @brief The outcome of the response limit for a response.
+ */
+typedef enum rate_limit_verdict {
+    RATE_LIMIT_PASS, /**< The response is within the limit and is sent. */
+    RATE_LIMIT_DROP, /**< The response is over the limit and is dropped. */
+    RATE_LIMIT_SLIP, /**< The response is over the limit and is replaced by an empty truncated response. */
+} rate_limit_verdict_t;
+
+/**
+ * @brief Initializes the limits.
+ *
+ * @param client_rate The number of queries per second allowed from each client address, 0 for no limit.
+ * @param response_rate The number of identical responses per second allowed to each /24 client network, 0 for no limit.
+ */
+void rate_limit_init(uint32_t client_rate, uint32_t response_rate);
+
+/**
+ * @brief Takes a token for a query from the bucket of its client.
+ *
+ * @param client_address Pointer to the address of the client.
+ * @return true if the query is within the limit, false if the client is over it.
+ */
+bool rate_limit_client(const struct sockaddr_in *const client_address);
+
+/**
+ * @brief Takes a token for a response from the bucket of its client network, question and response code.
+ *
+ * @param client_address Pointer to the address of the client.
+ * @param question Pointer to the question answered.
+ * @param rcode The response code.
+ * @return Whether the response is sent, dropped or slipped.
+ */
+rate_limit_verdict_t rate_limit_response(const struct sockaddr_in *const client_address, const question_t *const question, const uint8_t rcode);
+
+/**
+ * @brief Prints the limits and the occupancy of the tables.
+ *
+ * @param stream The stream to print to.
+ */
+void rate_limit_report(FILE *stream);
+
+#endif
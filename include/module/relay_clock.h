@@ -0,0 +1,29 @@
+/**
+ * @file relay_clock.h
+ * @brief This file provides the clock shared by time-dependent modules.
+ */
+
+#pragma once
+#ifndef RELAY_CLOCK_H
+#define RELAY_CLOCK_H
+
+#include <time.h>
+
+/**
+ * @brief Switch to a simulated clock and set its current time.
+ *
+ * Once called, relay_clock_now() returns the simulated time instead of the wall clock,
+ * so that TTL expiry only depends on the timestamps fed in.
+ *
+ * @param now The simulated current time.
+ */
+void relay_clock_simulate(time_t now);
+
+/**
+ * @brief Get the current time.
+ *
+ * @return The simulated time if the clock is simulated, otherwise the wall clock time.
+ */
+time_t relay_clock_now(void);
+
+#endif
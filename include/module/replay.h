@@ -0,0 +1,93 @@
+/**
+ * @file replay.h
+ * @brief This file provides offline replay of recorded DNS traffic.
+ *
+ * A trace is either a classic pcap capture (Ethernet, Linux cooked or raw IPv4 link types)
+ * or a dump in the following length-prefixed format, all integers in network byte order:
+ *
+ * @code
+ * "DNSRPLY1"                                    8-byte magic
+ * repeated:
+ *     uint64_t timestamp                        microseconds since the epoch
+ *     uint32_t address                          IPv4 address of the sender
+ *     uint16_t port                             UDP port of the sender
+ *     uint16_t length                           length of the DNS message
+ *     uint8_t  message[length]                  the DNS message
+ * @endcode
+ *
+ * Queries in the trace are fed to the relay in recorded order. Responses in the trace
+ * form the recorded response set used to answer the queries the relay sends upstream.
+ */
+
+#pragma once
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * @brief Structure representing a frame handed to the relay during replay.
+ */
+typedef struct replay_frame {
+    time_t time;                /**< The recorded time of the frame, in seconds. */
+    struct sockaddr_in address; /**< The address the frame is received from. */
+    const uint8_t *data;        /**< The DNS message. */
+    size_t length;              /**< The length of the DNS message. */
+} replay_frame_t;
+
+/**
+ * @brief Load a trace and enter replay mode.
+ *
+ * @param filename The name of the trace file.
+ */
+void replay_load(const char *const filename);
+
+/**
+ * @brief Check if the relay is in replay mode.
+ *
+ * @return true if a trace is loaded, false otherwise.
+ */
+bool replay_active(void);
+
+/**
+ * @brief Get the next recorded query.
+ *
+ * @param frame The frame to fill in.
+ * @return true if a query is available, false at the end of the trace.
+ */
+bool replay_next_query(replay_frame_t *const frame);
+
+/**
+ * @brief Get the next pending response from the simulated upstream server.
+ *
+ * The frame stays valid until the next call.
+ *
+ * @param frame The frame to fill in.
+ * @return true if a response is pending, false otherwise.
+ */
+bool replay_next_upstream(replay_frame_t *const frame);
+
+/**
+ * @brief Take a message the relay would send on its socket.
+ *
+ * Queries are answered from the recorded response set, responses to clients are counted and dropped.
+ *
+ * @param buffer The DNS message.
+ * @param length The length of the DNS message.
+ * @param address The destination address.
+ */
+void replay_transmit(const uint8_t *const buffer, const size_t length, const struct sockaddr_in *const address);
+
+/**
+ * @brief Print the replay counters.
+ *
+ * @param stream The stream to print to.
+ */
+void replay_report(FILE *stream);
+
+#endif
@@ -7,7 +7,7 @@
 #ifndef RULE_TABLE_H
 #define RULE_TABLE_H
 
-#include "data_structure/forward_list.h"
+#include "network/dns_utility.h"
 
 #include <stdbool.h>
 
@@ -17,24 +17,79 @@ static const char *const banned_ip = "0.0.0.0";
 /**
  * @brief Load a rule table from a file.
  *
+ * The file is either a hosts file or a snapshot produced by compile_rule_table().
+ *
+ * Each line of a hosts file is an IP address followed by one or more names, and anything after '#' is a comment.
+ * The file is memory-mapped, split into chunks on line boundaries and parsed and inserted by several threads.
+ *
+ * A snapshot is mapped read-only and queried in place, so loading it costs no parsing and
+ * relay processes on the same host share its pages.
+ *
  * @param filename The name of the file containing the rule table.
  */
 void load_rule_table(const char *const filename);
 
+/**
+ * @brief Compile a hosts file into a rule table snapshot.
+ *
+ * A snapshot is pointer-free: a 64-byte header, a table of 16-byte entries sorted by name,
+ * the names in wire format, the RRsets of configured names, and a Bloom filter of the banned names
+ * aligned to its 64-byte blocks. All offsets are relative to their section, in host byte order.
+ * The snapshot is written to a temporary file and renamed into place, so relays mapping the
+ * previous snapshot are not disturbed.
+ *
+ * @param hosts_filename The name of the hosts file.
+ * @param snapshot_filename The name of the snapshot to write.
+ */
+void compile_rule_table(const char *const hosts_filename, const char *const snapshot_filename);
+
+/**
+ * @brief Reload the rule table in the background.
+ *
+ * A new table is built on a separate thread from the given file and swapped in with a single
+ * atomic pointer exchange. The previous table is freed by that thread once the reader has
+ * passed a quiescent point, so lookups never wait. If the new file cannot be loaded,
+ * the previous table stays in use. Requests made while a reload is running are ignored.
+ *
+ * @param filename The name of the file containing the rule table.
+ */
+void reload_rule_table(const char *const filename);
+
+/**
+ * @brief Mark the beginning of a section that looks up the rule table.
+ *
+ * RRsets returned by get_configured() stay valid until the matching rule_table_reader_leave().
+ */
+void rule_table_reader_enter(void);
+
+/**
+ * @brief Mark the end of a section that looks up the rule table.
+ */
+void rule_table_reader_leave(void);
+
 /**
  * @brief Check if a name is banned.
  *
- * @param name The name to check.
+ * A banned name blocks its whole subtree, and a banned "*.name" blocks the subdomains of name only.
+ * The lookup walks the labels from the top and stops at the first banned ancestor. A Bloom filter
+ * of the banned names built at load time rejects most clean names before the exact lookup.
+ *
+ * @param name The wire-format name to check.
  * @return true if the name is banned, false otherwise.
  */
-bool is_banned(const char *const name);
+bool is_banned(const name_field_t *const name);
 
 /**
- * @brief Get the configuration for a given name.
+ * @brief Get the configured RRset of a given name, type and class.
+ *
+ * The RRset does not store its owner, which is the name looked up. In a snapshot it is
+ * used in place.
  *
- * @param name The name to get the configuration for.
- * @return A list of configurations for the given name.
+ * @param name The wire-format name to get the configuration for.
+ * @param type The type of the RRset.
+ * @param class The class of the RRset.
+ * @return The RRset, or NULL if none is configured.
  */
-forward_list_t get_configured(const char *const name);
+const dns_rrset_t *get_configured(const name_field_t *const name, const uint16_t type, const uint16_t class);
 
 #endif
@@ -0,0 +1,105 @@
+/**
+ * @file shared_cache.h
+ * @brief Header file for a DNS cache shared by the relay processes of a host.
+ *
+ * The cache lives in a named POSIX shared-memory segment and holds no pointers: every structure is
+ * found by its offset from the start of the segment, so each process may map it at any address.
+ * The segment is a set-associative table of fixed-size slots. Each slot holds one RRset with its
+ * owner name, and a set is chosen by the hash of the owner, type and class. Within a set, an expired
+ * or least recently used slot is replaced. The sets are guarded by stripes of process-shared,
+ * robust mutexes. A process that dies holding a stripe leaves it to the next process that locks
+ * it, which empties the stripe, since its slots may be half-written, and goes on.
+ *
+ * Processes attach one at a time under a lock on the segment. The first one creates and initializes
+ * it, and later ones use it with the size it was created with; a segment left not ready by a process
+ * that died while initializing it is initialized again by the next one. The segment outlives the
+ * processes and is removed by unlinking it from /dev/shm.
+ */
+
+#pragma once
+#ifndef SHARED_CACHE_H
+#define SHARED_CACHE_H
+
+#include "network/dns_rrset.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * @def SHARED_CACHE_SLOT_SIZE
+ * @brief The size of a slot in bytes; larger RRsets are not cached.
+ */
+#define SHARED_CACHE_SLOT_SIZE 256
+
+/**
+ * @def SHARED_CACHE_RRSET_MAX_SIZE
+ * @brief The largest RRset, owner included, that fits in a slot.
+ */
+#define SHARED_CACHE_RRSET_MAX_SIZE (SHARED_CACHE_SLOT_SIZE - 2 * sizeof(uint64_t))
+
+/**
+ * @struct shared_cache
+ * @brief A mapping of a shared cache segment.
+ */
+typedef struct shared_cache {
+    uint8_t *base; /**< The start of the mapping. */
+    size_t size;   /**< The size of the mapping. */
+} shared_cache_t;
+
+/**
+ * @brief Opens a shared cache segment, creating it if it does not exist.
+ *
+ * @param name The name of the segment, with or without the leading slash.
+ * @param size The size of the segment in bytes if it is created.
+ * @return Pointer to the mapping, or NULL if the segment could not be opened or is of another version.
+ */
+shared_cache_t *shared_cache_attach(const char *const name, size_t size);
+
+/**
+ * @brief Unmaps a shared cache segment, leaving it to the other processes.
+ *
+ * @param cache Pointer to the mapping.
+ */
+void shared_cache_detach(shared_cache_t *cache);
+
+/**
+ * @brief Stores an RRset, replacing the one stored under the same owner, type and class.
+ *
+ * @param cache Pointer to the mapping.
+ * @param rrset The RRset with its owner and an absolute expiry time.
+ * @param hash The hash of the owner, type and class.
+ * @param now The current time.
+ * @return true if the RRset was stored, false if it does not fit in a slot.
+ */
+bool shared_cache_put(shared_cache_t *cache, const dns_rrset_t *const rrset, uint64_t hash, time_t now);
+
+/**
+ * @brief Copies out the RRset stored under an owner, type and class, if it has not expired.
+ *
+ * A slot whose RRset does not pass dns_rrset_valid() is emptied instead of copied.
+ *
+ * @param cache Pointer to the mapping.
+ * @param owner The owner name in canonical wire format.
+ * @param owner_length The length of the owner name.
+ * @param type The type of the RRset.
+ * @param class The class of the RRset.
+ * @param hash The hash of the owner, type and class.
+ * @param now The current time.
+ * @param rrset The buffer receiving the RRset with its owner, at least SHARED_CACHE_RRSET_MAX_SIZE bytes and aligned for it.
+ * @return true if the RRset was found, false otherwise.
+ */
+bool shared_cache_get(shared_cache_t *cache, const uint8_t *const owner, const size_t owner_length, const uint16_t type, const uint16_t class,
+                      uint64_t hash, time_t now, dns_rrset_t *rrset);
+
+/**
+ * @brief Prints the occupancy of the segment and its counters, summed over all processes.
+ *
+ * @param cache Pointer to the mapping.
+ * @param stream The stream to print to.
+ */
+void shared_cache_report(const shared_cache_t *cache, FILE *stream);
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * @file statistics.h
+ * @brief This file provides counters for the outcome of processed messages.
+ */
+
+#pragma once
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief Enumeration of statistics counters.
+ */
+typedef enum statistics_counter {
+    STATISTICS_QUERY,            /**< Queries received from clients. */
+    STATISTICS_RESPONSE,         /**< Responses received from the upstream server. */
+    STATISTICS_BANNED,           /**< Queries answered with NXDOMAIN by the rule table. */
+    STATISTICS_CONFIGURED,       /**< Queries answered from the rule table. */
+    STATISTICS_CACHED,           /**< Queries answered from the cache. */
+    STATISTICS_RELAYED,          /**< Queries relayed to the upstream server. */
+    STATISTICS_MALFORMED,        /**< Messages dropped as malformed or unsupported. */
+    STATISTICS_CLIENT_LIMITED,   /**< Queries not served because their client was over its rate limit. */
+    STATISTICS_RESPONSE_DROPPED, /**< Responses dropped by the response rate limit. */
+    STATISTICS_RESPONSE_SLIPPED, /**< Responses replaced by truncated ones by the response rate limit. */
+    STATISTICS_COUNTER_COUNT,
+} statistics_counter_t;
+
+/**
+ * @brief Increment a counter.
+ *
+ * @param counter The counter to increment.
+ */
+void statistics_increment(const statistics_counter_t counter);
+
+/**
+ * @brief Get the value of a counter.
+ *
+ * @param counter The counter to read.
+ * @return The value of the counter.
+ */
+uint64_t statistics_get(const statistics_counter_t counter);
+
+/**
+ * @brief Print all counters.
+ *
+ * @param stream The stream to print to.
+ */
+void statistics_report(FILE *stream);
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * @file dns_rrset.h
+ * @brief This file provides a compact, contiguous representation of DNS resource record sets.
+ *
+ * An RRset is a single allocation: a fixed header, the owner name if it is stored at all, and
+ * the records, each a 2-byte rdata length in host byte order followed by the rdata. All records
+ * of an RRset share one TTL, as RFC 2181 section 5.2 requires. The block holds no pointers,
+ * so it can also be stored in a file and used where it is mapped.
+ */
+
+#pragma once
+#ifndef DNS_RRSET_H
+#define DNS_RRSET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** @brief The alignment of an RRset, in memory and in a snapshot. */
+#define DNS_RRSET_ALIGNMENT 4
+
+/**
+ * @brief Structure representing an RRset.
+ */
+typedef struct dns_rrset {
+    uint16_t type;        /**< The type of the records. */
+    uint16_t class;       /**< The class of the records. */
+    uint32_t ttl;         /**< The TTL of the records. */
+    uint16_t count;       /**< The number of records. */
+    uint8_t owner_length; /**< The length of the stored owner name, 0 if the owner is where the RRset is kept. */
+    uint8_t reserved;     /**< Zero. */
+    uint32_t size;        /**< The number of bytes following the header. */
+    uint8_t data[];       /**< The owner name, then the records. */
+} dns_rrset_t;
+
+/**
+ * @brief Structure representing a set of RRsets, such as all RRsets of a name.
+ */
+typedef struct dns_rrsets {
+    size_t count;         /**< The number of RRsets. */
+    dns_rrset_t *items[]; /**< The RRsets. */
+} dns_rrsets_t;
+
+/**
+ * @brief Create an empty RRset.
+ *
+ * @param owner The owner name in wire format, or NULL if it is not stored.
+ * @param owner_length The length of the owner name.
+ * @param type The type of the records.
+ * @param class The class of the records.
+ * @param ttl The TTL of the records.
+ * @return The new RRset.
+ */
+dns_rrset_t *dns_rrset_create(const uint8_t *const owner, const size_t owner_length, const uint16_t type, const uint16_t class, const uint32_t ttl);
+
+/**
+ * @brief Append a record to an RRset, lowering the TTL of the RRset to that of the record if it is smaller.
+ *
+ * @param rrset The RRset, which may be moved.
+ * @param ttl The TTL of the record.
+ * @param rdata The rdata of the record.
+ * @param rd_length The length of the rdata.
+ * @return The RRset.
+ */
+dns_rrset_t *dns_rrset_append(dns_rrset_t *rrset, const uint32_t ttl, const uint8_t *const rdata, const uint16_t rd_length);
+
+/**
+ * @brief Get the owner name stored in an RRset.
+ *
+ * @param rrset The RRset.
+ * @return The owner name, or NULL if it is not stored.
+ */
+const uint8_t *dns_rrset_owner(const dns_rrset_t *const rrset);
+
+/**
+ * @brief Get the first record of an RRset.
+ *
+ * @param rrset The RRset.
+ * @return The first record, a 2-byte rdata length followed by the rdata.
+ */
+const uint8_t *dns_rrset_records(const dns_rrset_t *const rrset);
+
+/**
+ * @brief Get the rdata length of a record.
+ *
+ * @param record The record.
+ * @return The length of its rdata.
+ */
+uint16_t dns_rrset_rd_length(const uint8_t *const record);
+
+/**
+ * @brief Get the record following a record.
+ *
+ * @param record The record.
+ * @return The next record.
+ */
+const uint8_t *dns_rrset_next(const uint8_t *const record);
+
+/**
+ * @brief Get the size of an RRset, header included.
+ *
+ * @param rrset The RRset.
+ * @return The size in bytes.
+ */
+size_t dns_rrset_size(const dns_rrset_t *const rrset);
+
+/**
+ * @brief Check whether a block of bytes holds a well-formed RRset.
+ *
+ * @param data The bytes, aligned to DNS_RRSET_ALIGNMENT.
+ * @param size The number of bytes available.
+ * @return true if an RRset whose records all lie within the bytes starts there, false otherwise.
+ */
+bool dns_rrset_valid(const void *const data, const size_t size);
+
+/**
+ * @brief Clone an RRset.
+ *
+ * @param rrset The RRset.
+ * @return The copy.
+ */
+dns_rrset_t *dns_rrset_clone(const dns_rrset_t *const rrset);
+
+/**
+ * @brief Destroy an RRset.
+ *
+ * @param rrset The RRset.
+ */
+void dns_rrset_destroy(void *rrset);
+
+/**
+ * @brief Append a record to the RRset of a set with the same owner, type and class, creating that RRset if there is none.
+ *
+ * @param rrsets The set, which may be NULL or moved.
+ * @param owner The owner name in wire format, or NULL if it is not stored.
+ * @param owner_length The length of the owner name.
+ * @param type The type of the record.
+ * @param class The class of the record.
+ * @param ttl The TTL of the record.
+ * @param rdata The rdata of the record.
+ * @param rd_length The length of the rdata.
+ * @return The set.
+ */
+dns_rrsets_t *dns_rrsets_append(dns_rrsets_t *rrsets, const uint8_t *const owner, const size_t owner_length, const uint16_t type, const uint16_t class,
+                                const uint32_t ttl, const uint8_t *const rdata, const uint16_t rd_length);
+
+/**
+ * @brief Find an RRset in a set.
+ *
+ * @param rrsets The set, which may be NULL.
+ * @param type The type of the RRset.
+ * @param class The class of the RRset.
+ * @return The first RRset of the type and class, or NULL if there is none.
+ */
+dns_rrset_t *dns_rrsets_find(const dns_rrsets_t *const rrsets, const uint16_t type, const uint16_t class);
+
+/**
+ * @brief Destroy a set and its RRsets.
+ *
+ * @param rrsets The set.
+ */
+void dns_rrsets_destroy(void *rrsets);
+
+#endif
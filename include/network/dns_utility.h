@@ -8,11 +8,33 @@
 #define DNS_UTILITY_H
 
 #include "data_structure/forward_list.h"
+#include "network/dns_rrset.h"
 
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
+/** @brief The maximum length of a name in wire format, including the root label. */
+#define DNS_NAME_MAX_LENGTH 255
+
+/** @brief The maximum number of compression pointers followed while reading a name. */
+#define DNS_NAME_POINTER_LIMIT 16
+
+/** @brief The size of the fields following the name of a question. */
+#define DNS_QUESTION_FIXED_SIZE 4
+
+/** @brief The size of the fields between the name and the rdata of a resource record. */
+#define DNS_RESOURCE_RECORD_FIXED_SIZE 10
+
+/** @brief The largest offset a compression pointer can hold. */
+#define DNS_NAME_OFFSET_MAX 0x3fff
+
+/** @brief The number of suffix offsets remembered for name compression, a power of two. */
+#define DNS_COMPRESSION_SLOT_COUNT 64
+
+/** @brief The number of slots a suffix may occupy in the name compression table. */
+#define DNS_COMPRESSION_BUCKET_SIZE 2
+
 /**
  * @brief Structure representing a DNS header.
  */
@@ -51,9 +73,10 @@ typedef struct name_field {
  * @brief Structure representing a question in a DNS message.
  */
 typedef struct question {
-    name_field_t *qname; /**< The domain name. */
-    uint16_t qtype;      /**< The type of the query. */
-    uint16_t qclass;     /**< The class of the query. */
+    name_field_t *qname;           /**< The domain name, as sent by the client. */
+    name_field_t *canonical_qname; /**< The domain name in lowercase, used for lookups. */
+    uint16_t qtype;                /**< The type of the query. */
+    uint16_t qclass;               /**< The class of the query. */
 } question_t;
 
 /**
@@ -79,6 +102,54 @@ typedef struct dns_message {
     forward_list_t additionals; /**< The list of additionals. */
 } dns_message_t;
 
+/**
+ * @brief Structure representing a DNS message decoded on demand.
+ *
+ * Only the header is decoded up front. The first question and the answers are parsed when
+ * they are first asked for, and the end offsets of the sections are recorded on the way,
+ * so a message that is relayed unchanged never has its records decoded.
+ */
+typedef struct dns_message_view {
+    const uint8_t *base;    /**< The DNS message. */
+    size_t length;          /**< The length of the DNS message. */
+    dns_header_t header;    /**< The DNS header, in host byte order. */
+    size_t question_end;    /**< The offset after the question section, 0 until known. */
+    question_t *question;   /**< The first question, NULL until parsed. */
+    forward_list_t answers; /**< The answers, NULL until parsed. */
+    bool answers_parsed;    /**< Whether the answers have been parsed. */
+} dns_message_view_t;
+
+/**
+ * @brief Structure remembering where name suffixes were written, for RFC 1035 name compression.
+ *
+ * A fixed-size table of buckets indexed by a hash of the suffix, with the rest of the hash kept
+ * as a tag. A full bucket drops its oldest suffix, which only loses a compression opportunity.
+ * A name repeating the one before it, as the owners of an RRset do, skips the table.
+ */
+typedef struct dns_name_compressor {
+    uint16_t offsets[DNS_COMPRESSION_SLOT_COUNT]; /**< Offsets of written suffixes, 0 for an empty slot. */
+    uint16_t tags[DNS_COMPRESSION_SLOT_COUNT];    /**< The hash tags of the suffixes. */
+    uint8_t last_name[DNS_NAME_MAX_LENGTH];       /**< The last name written, uncompressed. */
+    size_t last_length;                           /**< The length of the last name, 0 if none. */
+    uint16_t last_offset;                         /**< Where the last name can be pointed to. */
+} dns_name_compressor_t;
+
+/**
+ * @brief Structure representing a DNS response being written into a buffer.
+ *
+ * The header and question are copied from the query; answers are appended one RRset at a
+ * time, with names compressed against everything written before them. Answers owned by the
+ * question name are written with the name exactly as the client sent it.
+ */
+typedef struct dns_response {
+    uint8_t *buffer;                  /**< The buffer the response is written into. */
+    size_t capacity;                  /**< The size of the buffer. */
+    size_t length;                    /**< The number of bytes written. */
+    const question_t *question;       /**< The question being answered. */
+    uint16_t ancount;                 /**< The number of answers written. */
+    dns_name_compressor_t compressor; /**< The suffixes written so far. */
+} dns_response_t;
+
 /**
  * @brief Create a name field.
  *
@@ -88,30 +159,158 @@ typedef struct dns_message {
  */
 name_field_t *name_field_create(const char *const name, size_t length);
 
+/**
+ * @brief Convert ASCII uppercase letters to lowercase.
+ *
+ * Bytes outside 'A' to 'Z' are copied unchanged, so a wire-format name, whose label lengths
+ * never exceed 63, can be converted as a whole. Uses AVX2 or SSE2 where available.
+ *
+ * @param destination The buffer to write to, which may be the same as source.
+ * @param source The bytes to convert.
+ * @param length The number of bytes.
+ */
+void ascii_to_lower(uint8_t *const destination, const uint8_t *const source, const size_t length);
+
+/**
+ * @brief Create the canonical, lowercase form of a name field.
+ *
+ * @param name_field The name field.
+ * @return A pointer to the created name field.
+ */
+name_field_t *canonicalize_name_field(const name_field_t *const name_field);
+
 /**
  * @brief Get the name from a name field.
  *
  * @param name_field The name field.
- * @return The name.
+ * @return The name, "." for the root.
  */
 char *get_name_from_name_field(const name_field_t *const name_field);
 
 /**
- * @brief Parse a DNS message from a string.
+ * @brief Parse a DNS message.
+ *
+ * Every read is checked against the length of the message. A compression pointer must point
+ * before itself and at most DNS_NAME_POINTER_LIMIT of them are followed per name, so the work
+ * per name is bounded. Compressed names in the rdata of NS, CNAME, SOA, PTR and MX records
+ * are expanded, so the records can be sent in another message.
  *
- * @param base The string containing the DNS message.
- * @return A pointer to the parsed DNS message.
+ * @param base The DNS message.
+ * @param length The length of the DNS message.
+ * @return A pointer to the parsed DNS message, or NULL if the message is malformed.
  */
-dns_message_t *parse_dns_message(const char *const base);
+dns_message_t *parse_dns_message(const uint8_t *const base, const size_t length);
+
+/**
+ * @brief Initialize a view of a DNS message, decoding only the header.
+ *
+ * @param view The view to initialize.
+ * @param base The DNS message, which must outlive the view.
+ * @param length The length of the DNS message.
+ * @return true if the header is complete, false otherwise.
+ */
+bool dns_message_view_init(dns_message_view_t *const view, const uint8_t *const base, const size_t length);
+
+/**
+ * @brief Get the first question of a viewed DNS message, parsing the question section on first use.
+ *
+ * @param view The view.
+ * @return The first question, or NULL if there is none or the question section is malformed.
+ */
+const question_t *dns_message_view_question(dns_message_view_t *const view);
+
+/**
+ * @brief Get the answers of a viewed DNS message, parsing the answer section on first use.
+ *
+ * @param view The view.
+ * @return The list of answers, or NULL if there is none or the answer section is malformed.
+ */
+forward_list_t dns_message_view_answers(dns_message_view_t *const view);
+
+/**
+ * @brief Release what a view has parsed.
+ *
+ * @param view The view.
+ */
+void dns_message_view_release(dns_message_view_t *const view);
+
+/**
+ * @brief Choose whether names are compressed in the messages written from now on.
+ *
+ * Compression is on by default. Without it, every name is written in full, which is only
+ * useful to measure what compression saves.
+ *
+ * @param enable Whether to compress names.
+ */
+void dns_use_name_compression(bool enable);
+
+/**
+ * @brief Initialize a name compressor for a new message.
+ *
+ * @param compressor The name compressor.
+ */
+void dns_name_compressor_init(dns_name_compressor_t *const compressor);
+
+/**
+ * @brief Start a response to a viewed query.
+ *
+ * Copies the header and question section of the query, sets the QR flag and the response
+ * code, and clears the record counts.
+ *
+ * @param response The response to start.
+ * @param buffer The buffer to write the response into.
+ * @param capacity The size of the buffer.
+ * @param query The view of the query, whose question must have been parsed.
+ * @param rcode The response code.
+ */
+void dns_response_init(dns_response_t *const response, uint8_t *const buffer, const size_t capacity, const dns_message_view_t *const query, const uint8_t rcode);
+
+/**
+ * @brief Append the records of an RRset to a response as answers.
+ *
+ * An RRset without a stored owner is owned by the question name. Records that do not fit
+ * are left out and the response is marked as truncated.
+ *
+ * @param response The response.
+ * @param rrset The RRset.
+ * @param ttl_base The amount subtracted from the TTL of the RRset, such as the current time for an absolute expiry.
+ * @return The number of answers appended.
+ */
+size_t dns_response_add_rrset(dns_response_t *const response, const dns_rrset_t *const rrset, const uint32_t ttl_base);
+
+/**
+ * @brief Append the records of an RRset to a response as answers, under an owner kept outside the RRset.
+ *
+ * @param response The response.
+ * @param rrset The RRset, whose stored owner is ignored.
+ * @param owner The canonical owner name in wire format, or NULL if it is the question name.
+ * @param owner_length The length of the owner name.
+ * @param ttl_base The amount subtracted from the TTL of the RRset, such as the current time for an absolute expiry.
+ * @return The number of answers appended.
+ */
+size_t dns_response_add_records(dns_response_t *const response, const dns_rrset_t *const rrset, const uint8_t *owner, size_t owner_length,
+                                const uint32_t ttl_base);
+
+/**
+ * @brief Finish a response.
+ *
+ * @param response The response.
+ * @return The length of the response in bytes.
+ */
+size_t dns_response_finish(dns_response_t *const response);
 
 /**
  * @brief Convert a DNS message to a byte stream.
  *
+ * Names are compressed as described in RFC 1035, including those in the rdata of the types
+ * defined there.
+ *
  * @param dns_message The DNS message.
  * @param buffer The buffer to store the byte stream.
- * @return A pointer to the byte stream.
+ * @param capacity The size of the buffer in bytes.
+ * @return A pointer past the end of the byte stream, or NULL if it does not fit in the buffer.
  */
-uint8_t *convert_dns_message_to_stream(const dns_message_t *const dns_message, uint8_t *const buffer);
+uint8_t *convert_dns_message_to_stream(const dns_message_t *const dns_message, uint8_t *const buffer, const size_t capacity);
 
 /**
  * @brief Clone a DNS header.
@@ -0,0 +1,90 @@
+#include "data_structure/bloom_filter.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOOM_FILTER_WORD_COUNT (BLOOM_FILTER_BLOCK_SIZE / sizeof(uint64_t))
+
+static const uint32_t bloom_filter_salt[BLOOM_FILTER_WORD_COUNT] = {
+    0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du, 0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u};
+
+static inline uint64_t *bloom_filter_block(const bloom_filter_t *filter, uint64_t hash) {
+    size_t index = ((hash >> 32) * filter->block_count) >> 32;
+    return filter->blocks + index * BLOOM_FILTER_WORD_COUNT;
+}
+
+static inline uint64_t bloom_filter_mask(uint64_t hash, size_t word) {
+    return (uint64_t)1 << (((uint32_t)hash * bloom_filter_salt[word]) >> 26);
+}
+
+bloom_filter_t *bloom_filter_create(size_t expected_key_count) {
+    bloom_filter_t *filter = malloc(sizeof(bloom_filter_t));
+    assert(filter);
+    size_t block_count = (expected_key_count * BLOOM_FILTER_BITS_PER_KEY + BLOOM_FILTER_BLOCK_SIZE * 8 - 1) / (BLOOM_FILTER_BLOCK_SIZE * 8);
+    filter->block_count = block_count ? block_count : 1;
+    filter->blocks = aligned_alloc(BLOOM_FILTER_BLOCK_SIZE, filter->block_count * BLOOM_FILTER_BLOCK_SIZE);
+    assert(filter->blocks);
+    memset(filter->blocks, 0, filter->block_count * BLOOM_FILTER_BLOCK_SIZE);
+    filter->key_count = 0;
+    filter->owned = true;
+    return filter;
+}
+
+bloom_filter_t *bloom_filter_wrap(const void *data, size_t size) {
+    assert(data);
+    assert(size && size % BLOOM_FILTER_BLOCK_SIZE == 0);
+    bloom_filter_t *filter = malloc(sizeof(bloom_filter_t));
+    assert(filter);
+    filter->blocks = (uint64_t *)data;
+    filter->block_count = size / BLOOM_FILTER_BLOCK_SIZE;
+    filter->key_count = 0;
+    filter->owned = false;
+    return filter;
+}
+
+void bloom_filter_destroy(bloom_filter_t *filter) {
+    assert(filter);
+    if (filter->owned)
+        free(filter->blocks);
+    filter->blocks = NULL;
+    free(filter);
+    return;
+}
+
+void bloom_filter_add(bloom_filter_t *filter, uint64_t hash) {
+    assert(filter && filter->owned);
+    uint64_t *block = bloom_filter_block(filter, hash);
+    for (size_t i = 0; i < BLOOM_FILTER_WORD_COUNT; ++i)
+        __atomic_fetch_or(&block[i], bloom_filter_mask(hash, i), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&filter->key_count, 1, __ATOMIC_RELAXED);
+    return;
+}
+
+bool bloom_filter_contains(const bloom_filter_t *filter, uint64_t hash) {
+    assert(filter);
+    const uint64_t *block = bloom_filter_block(filter, hash);
+    uint64_t missing = 0;
+    for (size_t i = 0; i < BLOOM_FILTER_WORD_COUNT; ++i)
+        missing |= ~block[i] & bloom_filter_mask(hash, i);
+    return missing == 0;
+}
+
+size_t bloom_filter_size(const bloom_filter_t *filter) {
+    assert(filter);
+    return filter->block_count * BLOOM_FILTER_BLOCK_SIZE;
+}
+
+double bloom_filter_false_positive_rate(const bloom_filter_t *filter, size_t probe_count) {
+    assert(filter);
+    uint64_t state = 0x9e3779b97f4a7c15u;
+    size_t positive = 0;
+    for (size_t i = 0; i < probe_count; ++i) {
+        uint64_t hash = (state += 0x9e3779b97f4a7c15u);
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9u;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebu;
+        hash ^= hash >> 31;
+        positive += bloom_filter_contains(filter, hash);
+    }
+    return probe_count ? (double)positive / probe_count : 0;
+}
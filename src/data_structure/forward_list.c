@@ -1,10 +1,13 @@
 #include "data_structure/forward_list.h"
+#include "data_structure/object_pool.h"
 
 #include <assert.h>
 #include <stdlib.h>
 
+static object_pool_t forward_list_node_pool = OBJECT_POOL_INITIALIZER("forward_list_node", sizeof(forward_list_node_t));
+
 forward_list_node_t *forward_list_node_create(forward_list_node_t *next) {
-    forward_list_node_t *p = malloc(sizeof(forward_list_node_t));
+    forward_list_node_t *p = object_pool_alloc(&forward_list_node_pool);
     assert(p);
     p->value = NULL;
     p->next = next;
@@ -16,7 +19,7 @@ void forward_list_node_destroy(forward_list_node_t *p, void (*value_destroy)(voi
         (*value_destroy)(p->value);
     p->value = NULL;
     p->next = NULL;
-    free(p);
+    object_pool_free(&forward_list_node_pool, p);
     return;
 }
 
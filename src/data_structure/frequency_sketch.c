@@ -0,0 +1,121 @@
+#include "data_structure/frequency_sketch.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FREQUENCY_SKETCH_WORD_COUNT (FREQUENCY_SKETCH_BLOCK_SIZE / sizeof(uint64_t))
+#define FREQUENCY_SKETCH_DEPTH 4
+#define FREQUENCY_SKETCH_SAMPLE_FACTOR 10
+
+/* The table hash is remixed so that the sketch does not reuse the bits that placed the key in the table. */
+static inline uint64_t spread(uint64_t hash) {
+    hash = (hash ^ (hash >> 31)) * 0x7fb5d329728ea185u;
+    return hash ^ (hash >> 27);
+}
+
+static inline uint64_t *block_of(const frequency_sketch_t *sketch, const uint64_t spread_hash) {
+    return sketch->blocks + ((spread_hash >> 32) & (sketch->block_count - 1)) * FREQUENCY_SKETCH_WORD_COUNT;
+}
+
+/* Row i uses words 2i and 2i + 1 of the block; the low bits of the hash pick the word and the counter in it. */
+static inline size_t word_of(const uint64_t spread_hash, const size_t row) {
+    return row * 2 + ((spread_hash >> row) & 1);
+}
+
+static inline unsigned shift_of(const uint64_t spread_hash, const size_t row) {
+    return ((spread_hash >> (8 + row * 4)) & 15) * 4;
+}
+
+static void allocate(frequency_sketch_t *sketch, size_t expected_count) {
+    size_t block_count = 1;
+    while (block_count * FREQUENCY_SKETCH_WORD_COUNT < expected_count)
+        block_count *= 2;
+    sketch->blocks = aligned_alloc(FREQUENCY_SKETCH_BLOCK_SIZE, block_count * FREQUENCY_SKETCH_BLOCK_SIZE);
+    assert(sketch->blocks);
+    sketch->block_count = block_count;
+    sketch->expected = block_count * FREQUENCY_SKETCH_WORD_COUNT;
+    sketch->sample_size = sketch->expected * FREQUENCY_SKETCH_SAMPLE_FACTOR;
+    return;
+}
+
+frequency_sketch_t *frequency_sketch_create(size_t expected_count) {
+    frequency_sketch_t *sketch = malloc(sizeof(frequency_sketch_t));
+    assert(sketch);
+    allocate(sketch, expected_count);
+    memset(sketch->blocks, 0, sketch->block_count * FREQUENCY_SKETCH_BLOCK_SIZE);
+    sketch->additions = 0;
+    return sketch;
+}
+
+void frequency_sketch_destroy(frequency_sketch_t *sketch) {
+    assert(sketch);
+    free(sketch->blocks);
+    free(sketch);
+    return;
+}
+
+/*
+ * A block is picked by the low bits of the block hash, so a key in block i of the old sketch lands in
+ * block i + k * old_block_count of the new one. Each block is copied to all of those places, so every
+ * key keeps its estimate, and the collisions carried over fade as the counters are halved.
+ */
+void frequency_sketch_reserve(frequency_sketch_t *sketch, size_t expected_count) {
+    assert(sketch);
+    if (expected_count <= sketch->expected)
+        return;
+    uint64_t *old_blocks = sketch->blocks;
+    size_t old_block_count = sketch->block_count;
+    allocate(sketch, expected_count);
+    for (size_t i = 0; i < sketch->block_count; i += old_block_count)
+        memcpy(sketch->blocks + i * FREQUENCY_SKETCH_WORD_COUNT, old_blocks, old_block_count * FREQUENCY_SKETCH_BLOCK_SIZE);
+    free(old_blocks);
+    return;
+}
+
+/* Halving drops the low bit of every counter; the odd counters each lose half an increment more than the count suggests. */
+static void age(frequency_sketch_t *sketch) {
+    size_t odd = 0;
+    for (size_t i = 0; i < sketch->block_count * FREQUENCY_SKETCH_WORD_COUNT; ++i) {
+        odd += __builtin_popcountll(sketch->blocks[i] & 0x1111111111111111u);
+        sketch->blocks[i] = (sketch->blocks[i] >> 1) & 0x7777777777777777u;
+    }
+    sketch->additions = (sketch->additions - odd / FREQUENCY_SKETCH_DEPTH) / 2;
+    return;
+}
+
+void frequency_sketch_increment(frequency_sketch_t *sketch, uint64_t hash) {
+    assert(sketch);
+    uint64_t h = spread(hash);
+    uint64_t *block = block_of(sketch, h);
+    bool added = false;
+    for (size_t row = 0; row < FREQUENCY_SKETCH_DEPTH; ++row) {
+        uint64_t *word = &block[word_of(h, row)];
+        unsigned shift = shift_of(h, row);
+        if (((*word >> shift) & 15) != FREQUENCY_SKETCH_MAX) {
+            *word += (uint64_t)1 << shift;
+            added = true;
+        }
+    }
+    if (added && ++sketch->additions >= sketch->sample_size)
+        age(sketch);
+    return;
+}
+
+unsigned frequency_sketch_estimate(const frequency_sketch_t *sketch, uint64_t hash) {
+    assert(sketch);
+    uint64_t h = spread(hash);
+    const uint64_t *block = block_of(sketch, h);
+    unsigned estimate = FREQUENCY_SKETCH_MAX;
+    for (size_t row = 0; row < FREQUENCY_SKETCH_DEPTH; ++row) {
+        unsigned count = (block[word_of(h, row)] >> shift_of(h, row)) & 15;
+        estimate = count < estimate ? count : estimate;
+    }
+    return estimate;
+}
+
+size_t frequency_sketch_size(const frequency_sketch_t *sketch) {
+    assert(sketch);
+    return sizeof(frequency_sketch_t) + sketch->block_count * FREQUENCY_SKETCH_BLOCK_SIZE;
+}
@@ -0,0 +1,183 @@
+#include "data_structure/hash_table.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define HASH_TABLE_EMPTY 0x80
+#define HASH_TABLE_DELETED 0xfe
+#define HASH_TABLE_MIN_CAPACITY HASH_TABLE_GROUP_SIZE
+
+static inline uint8_t control_of(const uint64_t hash) {
+    return hash & 0x7f;
+}
+
+static inline size_t group_of(const hash_table_t *table, const uint64_t hash) {
+    return (hash >> 7) & (table->capacity / HASH_TABLE_GROUP_SIZE - 1);
+}
+
+static inline uint32_t group_match(const uint8_t *const group, const uint8_t control) {
+#if defined(__SSE2__)
+    __m128i bytes = _mm_load_si128((const __m128i *)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)control)));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < HASH_TABLE_GROUP_SIZE; ++i)
+        mask |= (uint32_t)(group[i] == control) << i;
+    return mask;
+#endif
+}
+
+/* Empty and deleted slots are the ones whose control byte has the high bit set. */
+static inline uint32_t group_match_free(const uint8_t *const group) {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < HASH_TABLE_GROUP_SIZE; ++i)
+        mask |= (uint32_t)(group[i] >> 7) << i;
+    return mask;
+#endif
+}
+
+static inline size_t max_count(const size_t capacity) {
+    return capacity - capacity / 8;
+}
+
+static void allocate(hash_table_t *table, const size_t capacity) {
+    table->control = aligned_alloc(HASH_TABLE_GROUP_SIZE, capacity);
+    table->slots = malloc(sizeof(hash_table_slot_t) * capacity);
+    assert(table->control && table->slots);
+    memset(table->control, HASH_TABLE_EMPTY, capacity);
+    table->capacity = capacity;
+    table->count = 0;
+    table->growth_left = max_count(capacity);
+    return;
+}
+
+/* Groups are probed triangularly, which visits every group once when their number is a power of two. */
+static void insert_new(hash_table_t *table, const uint64_t hash, void *value) {
+    size_t group = group_of(table, hash);
+    for (size_t step = 1;; ++step) {
+        uint32_t free_slots = group_match_free(table->control + group * HASH_TABLE_GROUP_SIZE);
+        if (free_slots) {
+            size_t index = group * HASH_TABLE_GROUP_SIZE + __builtin_ctz(free_slots);
+            table->growth_left -= table->control[index] == HASH_TABLE_EMPTY;
+            table->control[index] = control_of(hash);
+            table->slots[index].hash = hash;
+            table->slots[index].value = value;
+            ++table->count;
+            return;
+        }
+        group = (group + step) & (table->capacity / HASH_TABLE_GROUP_SIZE - 1);
+    }
+}
+
+/* Deleted slots are dropped on a rehash; the table only doubles if it is more than half full. */
+static void rehash(hash_table_t *table) {
+    uint8_t *control = table->control;
+    hash_table_slot_t *slots = table->slots;
+    size_t capacity = table->capacity;
+    allocate(table, table->count * 2 > max_count(capacity) ? capacity * 2 : capacity);
+    for (size_t i = 0; i < capacity; ++i)
+        if (!(control[i] & HASH_TABLE_EMPTY))
+            insert_new(table, slots[i].hash, slots[i].value);
+    free(control);
+    free(slots);
+    return;
+}
+
+hash_table_t *hash_table_create(size_t expected_count) {
+    hash_table_t *table = malloc(sizeof(hash_table_t));
+    assert(table);
+    size_t capacity = HASH_TABLE_MIN_CAPACITY;
+    while (max_count(capacity) < expected_count)
+        capacity *= 2;
+    allocate(table, capacity);
+    return table;
+}
+
+void hash_table_destroy(hash_table_t *table, void (*value_destroy)(void *)) {
+    assert(table);
+    hash_table_clear(table, value_destroy);
+    free(table->control);
+    free(table->slots);
+    free(table);
+    return;
+}
+
+void hash_table_clear(hash_table_t *table, void (*value_destroy)(void *)) {
+    assert(table);
+    if (value_destroy)
+        for (size_t i = 0; i < table->capacity; ++i)
+            if (!(table->control[i] & HASH_TABLE_EMPTY))
+                (*value_destroy)(table->slots[i].value);
+    memset(table->control, HASH_TABLE_EMPTY, table->capacity);
+    table->count = 0;
+    table->growth_left = max_count(table->capacity);
+    return;
+}
+
+static hash_table_slot_t *find_slot(const hash_table_t *table, const uint64_t hash, hash_table_match_t match, const void *key) {
+    size_t group = group_of(table, hash);
+    for (size_t step = 1;; ++step) {
+        const uint8_t *control = table->control + group * HASH_TABLE_GROUP_SIZE;
+        for (uint32_t candidates = group_match(control, control_of(hash)); candidates; candidates &= candidates - 1) {
+            hash_table_slot_t *slot = &table->slots[group * HASH_TABLE_GROUP_SIZE + __builtin_ctz(candidates)];
+            if (slot->hash == hash && (*match)(slot->value, key))
+                return slot;
+        }
+        if (group_match(control, HASH_TABLE_EMPTY))
+            return NULL;
+        group = (group + step) & (table->capacity / HASH_TABLE_GROUP_SIZE - 1);
+    }
+}
+
+void *hash_table_find(const hash_table_t *table, uint64_t hash, hash_table_match_t match, const void *key) {
+    assert(table);
+    hash_table_slot_t *slot = find_slot(table, hash, match, key);
+    return slot ? slot->value : NULL;
+}
+
+void *hash_table_put(hash_table_t *table, uint64_t hash, hash_table_match_t match, const void *key, void *value) {
+    assert(table && value);
+    hash_table_slot_t *slot = find_slot(table, hash, match, key);
+    if (slot) {
+        void *replaced = slot->value;
+        slot->value = value;
+        return replaced;
+    }
+    if (!table->growth_left)
+        rehash(table);
+    insert_new(table, hash, value);
+    return NULL;
+}
+
+/*
+ * A lookup only probes past a group that was full. A group with an empty slot has not been full
+ * since the last rehash, because removals never turn a slot back to empty otherwise, so a slot
+ * removed from it can be marked empty instead of deleted.
+ */
+void *hash_table_remove(hash_table_t *table, uint64_t hash, hash_table_match_t match, const void *key) {
+    assert(table);
+    hash_table_slot_t *slot = find_slot(table, hash, match, key);
+    if (!slot)
+        return NULL;
+    size_t index = slot - table->slots;
+    if (group_match(table->control + index / HASH_TABLE_GROUP_SIZE * HASH_TABLE_GROUP_SIZE, HASH_TABLE_EMPTY)) {
+        table->control[index] = HASH_TABLE_EMPTY;
+        ++table->growth_left;
+    } else
+        table->control[index] = HASH_TABLE_DELETED;
+    --table->count;
+    return slot->value;
+}
+
+size_t hash_table_size(const hash_table_t *table) {
+    assert(table);
+    return sizeof(hash_table_t) + table->capacity * (sizeof(uint8_t) + sizeof(hash_table_slot_t));
+}
@@ -0,0 +1,81 @@
+#include "data_structure/intern_table.h"
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct intern_key {
+    const uint8_t *data;
+    size_t length;
+} intern_key_t;
+
+static bool intern_match(const void *value, const void *key) {
+    const interned_t *interned = value;
+    const intern_key_t *p = key;
+    return interned->length == p->length && memcmp(interned->data, p->data, p->length) == 0;
+}
+
+static bool identity_match(const void *value, const void *key) {
+    return value == key;
+}
+
+static inline size_t footprint(const interned_t *interned) {
+    return malloc_usable_size((void *)interned) + sizeof(size_t);
+}
+
+intern_table_t *intern_table_create(size_t expected_count) {
+    intern_table_t *table = malloc(sizeof(intern_table_t));
+    assert(table);
+    table->table = hash_table_create(expected_count);
+    table->bytes = 0;
+    return table;
+}
+
+void intern_table_destroy(intern_table_t *table) {
+    assert(table);
+    hash_table_destroy(table->table, free);
+    free(table);
+    return;
+}
+
+interned_t *intern_table_find(const intern_table_t *table, const uint8_t *data, size_t length, uint64_t hash) {
+    assert(table);
+    intern_key_t key = {data, length};
+    return hash_table_find(table->table, hash, intern_match, &key);
+}
+
+interned_t *intern_table_acquire(intern_table_t *table, const uint8_t *data, size_t length, uint64_t hash) {
+    assert(table && length <= UINT32_MAX);
+    intern_key_t key = {data, length};
+    interned_t *interned = hash_table_find(table->table, hash, intern_match, &key);
+    if (!interned) {
+        interned = malloc(sizeof(interned_t) + length);
+        assert(interned);
+        interned->value = NULL;
+        interned->refcount = 0;
+        interned->length = length;
+        memcpy(interned->data, data, length);
+        hash_table_put(table->table, hash, intern_match, &key, interned);
+        table->bytes += footprint(interned);
+    }
+    ++interned->refcount;
+    return interned;
+}
+
+/* The hash is not stored with the string, which keeps the header of a short name to 16 bytes. */
+void intern_table_release(intern_table_t *table, const interned_t *interned, uint64_t hash) {
+    assert(table && interned && interned->refcount);
+    interned_t *p = (interned_t *)interned;
+    if (--p->refcount)
+        return;
+    hash_table_remove(table->table, hash, identity_match, p);
+    table->bytes -= footprint(p);
+    free(p);
+    return;
+}
+
+size_t intern_table_size(const intern_table_t *table) {
+    assert(table);
+    return sizeof(intern_table_t) + hash_table_size(table->table) + table->bytes;
+}
@@ -20,3 +20,30 @@ void list_node_destroy(list_node_t *p) {
     p = NULL;
     return;
 }
+
+void list_init(list_node_t *head) {
+    head->value = NULL;
+    head->prev = head;
+    head->next = head;
+    return;
+}
+
+bool list_empty(const list_node_t *head) {
+    return head->next == head;
+}
+
+void list_insert_after(list_node_t *position, list_node_t *node) {
+    node->prev = position;
+    node->next = position->next;
+    position->next->prev = node;
+    position->next = node;
+    return;
+}
+
+void list_remove(list_node_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = NULL;
+    node->next = NULL;
+    return;
+}
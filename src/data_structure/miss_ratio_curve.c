@@ -0,0 +1,219 @@
+#include "data_structure/miss_ratio_curve.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MISS_RATIO_CURVE_MODULUS (1u << 24)
+#define MISS_RATIO_CURVE_TIME_FACTOR 4
+
+/* The key is remixed so that sampling does not depend on the bits that index it elsewhere. */
+static inline uint32_t spatial_hash(uint64_t key) {
+    key = (key ^ (key >> 33)) * 0x62a9d9ed799705f5u;
+    return (key ^ (key >> 28)) & (MISS_RATIO_CURVE_MODULUS - 1);
+}
+
+static bool sample_matches(const void *value, const void *key) {
+    return ((const miss_ratio_sample_t *)value)->key == *(const uint64_t *)key;
+}
+
+static void tree_add(miss_ratio_curve_t *curve, uint32_t time, int32_t delta) {
+    for (; time <= curve->time_limit; time += time & -time)
+        curve->tree[time] += delta;
+    return;
+}
+
+static uint32_t tree_prefix(const miss_ratio_curve_t *curve, uint32_t time) {
+    uint32_t sum = 0;
+    for (; time; time -= time & -time)
+        sum += curve->tree[time];
+    return sum;
+}
+
+static inline void heap_set(miss_ratio_curve_t *curve, const size_t position, const uint32_t sample) {
+    curve->heap[position] = sample;
+    curve->samples[sample].heap_index = position;
+    return;
+}
+
+static void heap_sift_up(miss_ratio_curve_t *curve, size_t position) {
+    uint32_t sample = curve->heap[position];
+    while (position && curve->samples[curve->heap[(position - 1) / 2]].value < curve->samples[sample].value) {
+        heap_set(curve, position, curve->heap[(position - 1) / 2]);
+        position = (position - 1) / 2;
+    }
+    heap_set(curve, position, sample);
+    return;
+}
+
+static void heap_sift_down(miss_ratio_curve_t *curve, size_t position) {
+    uint32_t sample = curve->heap[position];
+    for (size_t child; (child = position * 2 + 1) < curve->sample_count; position = child) {
+        if (child + 1 < curve->sample_count && curve->samples[curve->heap[child + 1]].value > curve->samples[curve->heap[child]].value)
+            ++child;
+        if (curve->samples[curve->heap[child]].value <= curve->samples[sample].value)
+            break;
+        heap_set(curve, position, curve->heap[child]);
+    }
+    heap_set(curve, position, sample);
+    return;
+}
+
+/* The sample with the largest spatial hash leaves; the last sample of the array takes its place there. */
+static void evict_top(miss_ratio_curve_t *curve) {
+    uint32_t index = curve->heap[0];
+    miss_ratio_sample_t *sample = &curve->samples[index];
+    hash_table_remove(curve->index, sample->key, sample_matches, &sample->key);
+    tree_add(curve, sample->time, -1);
+    --curve->sample_count;
+    if (curve->sample_count) {
+        heap_set(curve, 0, curve->heap[curve->sample_count]);
+        heap_sift_down(curve, 0);
+    }
+    if (index != curve->sample_count) {
+        *sample = curve->samples[curve->sample_count];
+        curve->heap[sample->heap_index] = index;
+        hash_table_put(curve->index, sample->key, sample_matches, &sample->key, sample);
+    }
+    return;
+}
+
+static int time_compare(const void *a, const void *b) {
+    uint32_t x = (*(miss_ratio_sample_t *const *)a)->time, y = (*(miss_ratio_sample_t *const *)b)->time;
+    return (x > y) - (x < y);
+}
+
+/* Once the times run out, the samples are renumbered in the order of their last access. */
+static void compact(miss_ratio_curve_t *curve) {
+    miss_ratio_sample_t **order = malloc(sizeof(miss_ratio_sample_t *) * (curve->sample_count + 1));
+    assert(order);
+    for (size_t i = 0; i < curve->sample_count; ++i)
+        order[i] = &curve->samples[i];
+    qsort(order, curve->sample_count, sizeof(miss_ratio_sample_t *), time_compare);
+    memset(curve->tree, 0, sizeof(uint32_t) * (curve->time_limit + 1));
+    for (size_t i = 0; i < curve->sample_count; ++i) {
+        order[i]->time = i + 1;
+        tree_add(curve, i + 1, 1);
+    }
+    curve->now = curve->sample_count;
+    free(order);
+    return;
+}
+
+miss_ratio_curve_t *miss_ratio_curve_create(size_t sample_limit, uint64_t window) {
+    assert(sample_limit);
+    miss_ratio_curve_t *curve = calloc(1, sizeof(miss_ratio_curve_t));
+    assert(curve);
+    curve->sample_limit = sample_limit;
+    curve->samples = malloc(sizeof(miss_ratio_sample_t) * (sample_limit + 1));
+    curve->heap = malloc(sizeof(uint32_t) * (sample_limit + 1));
+    curve->index = hash_table_create(sample_limit + 1);
+    curve->time_limit = sample_limit * MISS_RATIO_CURVE_TIME_FACTOR;
+    curve->tree = calloc(curve->time_limit + 1, sizeof(uint32_t));
+    assert(curve->samples && curve->heap && curve->tree);
+    curve->threshold = MISS_RATIO_CURVE_MODULUS;
+    curve->window = window;
+    return curve;
+}
+
+void miss_ratio_curve_destroy(miss_ratio_curve_t *curve) {
+    assert(curve);
+    hash_table_destroy(curve->index, NULL);
+    free(curve->tree);
+    free(curve->heap);
+    free(curve->samples);
+    free(curve);
+    return;
+}
+
+/* A distance of 0 has its own bin; bin b holds the distances from 2^(b-1) up to 2^b. */
+static inline size_t bin_of(const double distance) {
+    if (distance < 1)
+        return 0;
+    if (distance >= (double)((uint64_t)1 << (MISS_RATIO_CURVE_BIN_COUNT - 2)))
+        return MISS_RATIO_CURVE_BIN_COUNT - 1;
+    return 64 - __builtin_clzll((uint64_t)distance);
+}
+
+static void age(miss_ratio_curve_t *curve) {
+    for (size_t i = 0; i < MISS_RATIO_CURVE_BIN_COUNT; ++i)
+        curve->bins[i] /= 2;
+    curve->sampled /= 2;
+    curve->accesses /= 2;
+    return;
+}
+
+/* Each sampled access weighs the inverse of the sampling rate at the time, like its distance. */
+void miss_ratio_curve_access(miss_ratio_curve_t *curve, uint64_t key) {
+    assert(curve);
+    curve->accesses += 1;
+    if (curve->window && curve->accesses >= curve->window)
+        age(curve);
+    uint32_t value = spatial_hash(key);
+    if (value >= curve->threshold)
+        return;
+    double weight = (double)MISS_RATIO_CURVE_MODULUS / curve->threshold;
+    curve->sampled += weight;
+    if (curve->now == curve->time_limit)
+        compact(curve);
+    uint32_t now = ++curve->now;
+    miss_ratio_sample_t *sample = hash_table_find(curve->index, key, sample_matches, &key);
+    if (sample) {
+        uint32_t distance = tree_prefix(curve, now - 1) - tree_prefix(curve, sample->time);
+        tree_add(curve, sample->time, -1);
+        tree_add(curve, now, 1);
+        sample->time = now;
+        curve->bins[bin_of(distance * weight)] += weight;
+        return;
+    }
+    uint32_t index = curve->sample_count++;
+    sample = &curve->samples[index];
+    sample->key = key;
+    sample->value = value;
+    sample->time = now;
+    hash_table_put(curve->index, key, sample_matches, &sample->key, sample);
+    tree_add(curve, now, 1);
+    heap_set(curve, index, index);
+    heap_sift_up(curve, index);
+    if (curve->sample_count > curve->sample_limit) {
+        curve->threshold = curve->samples[curve->heap[0]].value;
+        while (curve->sample_count && curve->samples[curve->heap[0]].value >= curve->threshold)
+            evict_top(curve);
+    }
+    return;
+}
+
+/*
+ * The sampled accesses are scaled to all accesses; the difference between the two counts, which
+ * sampling error makes nonzero, is credited to the smallest distances as SHARDS does. Inside a
+ * bin the hits are interpolated linearly.
+ */
+double miss_ratio_curve_hit_ratio(const miss_ratio_curve_t *curve, size_t size) {
+    assert(curve);
+    if (curve->accesses <= 0 || !size)
+        return 0;
+    double hits = curve->bins[0] + curve->accesses - curve->sampled;
+    for (size_t bin = 1; bin < MISS_RATIO_CURVE_BIN_COUNT; ++bin) {
+        double low = (double)((uint64_t)1 << (bin - 1)), high = (double)((uint64_t)1 << bin);
+        if (size >= high)
+            hits += curve->bins[bin];
+        else {
+            hits += curve->bins[bin] * (size - low) / (high - low);
+            break;
+        }
+    }
+    double ratio = hits / curve->accesses;
+    return ratio < 0 ? 0 : ratio > 1 ? 1 : ratio;
+}
+
+double miss_ratio_curve_sample_rate(const miss_ratio_curve_t *curve) {
+    assert(curve);
+    return (double)curve->threshold / MISS_RATIO_CURVE_MODULUS;
+}
+
+size_t miss_ratio_curve_size(const miss_ratio_curve_t *curve) {
+    assert(curve);
+    return sizeof(miss_ratio_curve_t) + (sizeof(miss_ratio_sample_t) + sizeof(uint32_t)) * (curve->sample_limit + 1) + hash_table_size(curve->index) +
+           sizeof(uint32_t) * (curve->time_limit + 1);
+}
@@ -0,0 +1,254 @@
+#include "data_structure/object_pool.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define OBJECT_POOL_ALIGNMENT sizeof(void *)
+#define OBJECT_POOL_BATCH_BYTES (64 << 10)
+#define OBJECT_POOL_BATCH_MIN 4
+#define OBJECT_POOL_BATCH_MAX 256
+
+typedef struct object_pool_cache {
+    void *head;
+    atomic_size_t count;
+} object_pool_cache_t;
+
+typedef struct object_pool_thread {
+    object_pool_cache_t caches[OBJECT_POOL_LIMIT];
+    struct object_pool_thread *prev;
+    struct object_pool_thread *next;
+} object_pool_thread_t;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static object_pool_t *pools[OBJECT_POOL_LIMIT];
+static size_t pool_count = 0;
+static object_pool_thread_t *threads = NULL;
+static pthread_key_t thread_key;
+static pthread_once_t thread_key_once = PTHREAD_ONCE_INIT;
+static atomic_bool huge_pages = false;
+static __thread object_pool_thread_t *current_thread = NULL;
+
+static inline void *next_of(void *object) {
+    return *(void **)object;
+}
+
+static inline void set_next(void *object, void *next) {
+    *(void **)object = next;
+    return;
+}
+
+static void cache_return(object_pool_t *pool, object_pool_cache_t *cache, size_t count) {
+    void *head = cache->head, *tail = head;
+    for (size_t i = 1; i < count; ++i)
+        tail = next_of(tail);
+    cache->head = next_of(tail);
+    atomic_store_explicit(&cache->count, atomic_load_explicit(&cache->count, memory_order_relaxed) - count, memory_order_relaxed);
+    pthread_mutex_lock(&pool->mutex);
+    set_next(tail, pool->free_list);
+    pool->free_list = head;
+    pool->free_count += count;
+    pthread_mutex_unlock(&pool->mutex);
+    return;
+}
+
+static void thread_release(void *arg) {
+    object_pool_thread_t *thread = arg;
+    pthread_mutex_lock(&registry_mutex);
+    for (size_t i = 0; i < pool_count; ++i) {
+        size_t count = atomic_load_explicit(&thread->caches[i].count, memory_order_relaxed);
+        if (count)
+            cache_return(pools[i], &thread->caches[i], count);
+    }
+    if (thread->prev)
+        thread->prev->next = thread->next;
+    else
+        threads = thread->next;
+    if (thread->next)
+        thread->next->prev = thread->prev;
+    pthread_mutex_unlock(&registry_mutex);
+    free(thread);
+    current_thread = NULL;
+    return;
+}
+
+static void thread_key_create(void) {
+    pthread_key_create(&thread_key, thread_release);
+    return;
+}
+
+static object_pool_thread_t *thread_register(void) {
+    pthread_once(&thread_key_once, thread_key_create);
+    object_pool_thread_t *thread = calloc(1, sizeof(object_pool_thread_t));
+    assert(thread);
+    pthread_mutex_lock(&registry_mutex);
+    thread->next = threads;
+    if (threads)
+        threads->prev = thread;
+    threads = thread;
+    pthread_mutex_unlock(&registry_mutex);
+    pthread_setspecific(thread_key, thread);
+    current_thread = thread;
+    return thread;
+}
+
+static size_t pool_register(object_pool_t *pool) {
+    pthread_mutex_lock(&registry_mutex);
+    size_t index = atomic_load_explicit(&pool->index, memory_order_relaxed);
+    if (!index) {
+        if (pool_count == OBJECT_POOL_LIMIT)
+            abort();
+        if (pool->object_size < sizeof(void *))
+            pool->object_size = sizeof(void *);
+        pool->object_size = (pool->object_size + OBJECT_POOL_ALIGNMENT - 1) / OBJECT_POOL_ALIGNMENT * OBJECT_POOL_ALIGNMENT;
+        size_t batch = OBJECT_POOL_BATCH_BYTES / pool->object_size;
+        pool->batch = batch < OBJECT_POOL_BATCH_MIN ? OBJECT_POOL_BATCH_MIN : batch > OBJECT_POOL_BATCH_MAX ? OBJECT_POOL_BATCH_MAX : batch;
+        pools[pool_count++] = pool;
+        index = pool_count;
+        atomic_store_explicit(&pool->index, index, memory_order_release);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return index;
+}
+
+static inline object_pool_cache_t *pool_cache(object_pool_t *pool) {
+    size_t index = atomic_load_explicit(&pool->index, memory_order_acquire);
+    if (__builtin_expect(!index, 0))
+        index = pool_register(pool);
+    object_pool_thread_t *thread = current_thread;
+    if (__builtin_expect(!thread, 0))
+        thread = thread_register();
+    return &thread->caches[index - 1];
+}
+
+/* Transparent huge pages only back 2 MiB aligned ranges, so the slab is cut out of a larger mapping. */
+static uint8_t *slab_map(bool *huge) {
+    *huge = false;
+    if (atomic_load(&huge_pages)) {
+        void *slab = mmap(NULL, OBJECT_POOL_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (slab != MAP_FAILED) {
+            *huge = true;
+            return slab;
+        }
+        uint8_t *mapping = mmap(NULL, OBJECT_POOL_SLAB_SIZE * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            return NULL;
+        uint8_t *begin = (uint8_t *)(((uintptr_t)mapping + OBJECT_POOL_SLAB_SIZE - 1) / OBJECT_POOL_SLAB_SIZE * OBJECT_POOL_SLAB_SIZE);
+        if (begin > mapping)
+            munmap(mapping, begin - mapping);
+        if (mapping + OBJECT_POOL_SLAB_SIZE * 2 > begin + OBJECT_POOL_SLAB_SIZE)
+            munmap(begin + OBJECT_POOL_SLAB_SIZE, mapping + OBJECT_POOL_SLAB_SIZE * 2 - begin - OBJECT_POOL_SLAB_SIZE);
+        madvise(begin, OBJECT_POOL_SLAB_SIZE, MADV_HUGEPAGE);
+        return begin;
+    }
+    void *slab = mmap(NULL, OBJECT_POOL_SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return slab == MAP_FAILED ? NULL : slab;
+}
+
+/* Called with the pool locked. Free objects are handed out before new ones are carved. */
+static void *pool_take(object_pool_t *pool, size_t count, size_t *taken) {
+    void *head = NULL;
+    size_t n = 0;
+    while (n < count && pool->free_list) {
+        void *object = pool->free_list;
+        pool->free_list = next_of(object);
+        set_next(object, head);
+        head = object;
+        ++n;
+    }
+    pool->free_count -= n;
+    while (n < count) {
+        if (pool->slab_cursor + pool->object_size > pool->slab_end) {
+            bool huge;
+            uint8_t *slab = slab_map(&huge);
+            if (!slab)
+                break;
+            pool->slab_cursor = slab;
+            pool->slab_end = slab + OBJECT_POOL_SLAB_SIZE;
+            ++pool->slab_count;
+            pool->huge_slab_count += huge;
+        }
+        void *object = pool->slab_cursor;
+        pool->slab_cursor += pool->object_size;
+        ++pool->object_count;
+        set_next(object, head);
+        head = object;
+        ++n;
+    }
+    *taken = n;
+    return head;
+}
+
+void object_pool_use_huge_pages(bool enable) {
+    atomic_store(&huge_pages, enable);
+    return;
+}
+
+void *object_pool_alloc(object_pool_t *pool) {
+    assert(pool);
+    object_pool_cache_t *cache = pool_cache(pool);
+    if (__builtin_expect(!cache->head, 0)) {
+        size_t taken;
+        pthread_mutex_lock(&pool->mutex);
+        cache->head = pool_take(pool, pool->batch, &taken);
+        pthread_mutex_unlock(&pool->mutex);
+        if (!taken)
+            return NULL;
+        atomic_store_explicit(&cache->count, taken, memory_order_relaxed);
+    }
+    void *object = cache->head;
+    cache->head = next_of(object);
+    atomic_store_explicit(&cache->count, atomic_load_explicit(&cache->count, memory_order_relaxed) - 1, memory_order_relaxed);
+    return object;
+}
+
+void object_pool_free(object_pool_t *pool, void *object) {
+    assert(pool && object);
+    object_pool_cache_t *cache = pool_cache(pool);
+    set_next(object, cache->head);
+    cache->head = object;
+    size_t count = atomic_load_explicit(&cache->count, memory_order_relaxed) + 1;
+    atomic_store_explicit(&cache->count, count, memory_order_relaxed);
+    if (__builtin_expect(count >= pool->batch * 2, 0))
+        cache_return(pool, cache, pool->batch);
+    return;
+}
+
+size_t object_pool_collect(object_pool_stats_t *stats, size_t capacity) {
+    pthread_mutex_lock(&registry_mutex);
+    size_t count = pool_count < capacity ? pool_count : capacity;
+    for (size_t i = 0; i < count; ++i) {
+        object_pool_t *pool = pools[i];
+        object_pool_stats_t *p = &stats[i];
+        p->name = pool->name;
+        p->object_size = pool->object_size;
+        pthread_mutex_lock(&pool->mutex);
+        p->slab_count = pool->slab_count;
+        p->huge_slab_count = pool->huge_slab_count;
+        p->reserved_bytes = pool->slab_count * (size_t)OBJECT_POOL_SLAB_SIZE;
+        p->object_count = pool->object_count;
+        p->free_count = pool->free_count;
+        pthread_mutex_unlock(&pool->mutex);
+        for (object_pool_thread_t *thread = threads; thread; thread = thread->next)
+            p->free_count += atomic_load_explicit(&thread->caches[i].count, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    return count;
+}
+
+void object_pool_report(FILE *stream) {
+    object_pool_stats_t stats[OBJECT_POOL_LIMIT];
+    size_t count = object_pool_collect(stats, OBJECT_POOL_LIMIT);
+    for (size_t i = 0; i < count; ++i) {
+        const object_pool_stats_t *p = &stats[i];
+        size_t free_count = p->free_count < p->object_count ? p->free_count : p->object_count;
+        fprintf(stream, "pool.%s.object_size=%zu\n", p->name, p->object_size);
+        fprintf(stream, "pool.%s.slabs=%zu\n", p->name, p->slab_count);
+        fprintf(stream, "pool.%s.huge_slabs=%zu\n", p->name, p->huge_slab_count);
+        fprintf(stream, "pool.%s.reserved_bytes=%zu\n", p->name, p->reserved_bytes);
+        fprintf(stream, "pool.%s.objects=%zu\n", p->name, p->object_count);
+        fprintf(stream, "pool.%s.in_use=%zu\n", p->name, p->object_count - free_count);
+        fprintf(stream, "pool.%s.free=%zu\n", p->name, free_count);
+    }
+    return;
+}
@@ -0,0 +1,175 @@
+#include "data_structure/space_saving.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline uint8_t *counter_key(const space_saving_t *summary, const size_t counter) {
+    return summary->keys + counter * summary->key_size;
+}
+
+static inline void heap_set(space_saving_t *summary, const size_t position, const uint32_t counter) {
+    summary->heap[position] = counter;
+    summary->counters[counter].heap_index = position;
+    return;
+}
+
+static void heap_sift_up(space_saving_t *summary, size_t position) {
+    uint32_t counter = summary->heap[position];
+    while (position && summary->counters[summary->heap[(position - 1) / 2]].count > summary->counters[counter].count) {
+        heap_set(summary, position, summary->heap[(position - 1) / 2]);
+        position = (position - 1) / 2;
+    }
+    heap_set(summary, position, counter);
+    return;
+}
+
+static void heap_sift_down(space_saving_t *summary, size_t position) {
+    uint32_t counter = summary->heap[position];
+    for (size_t child; (child = position * 2 + 1) < summary->count; position = child) {
+        if (child + 1 < summary->count && summary->counters[summary->heap[child + 1]].count < summary->counters[summary->heap[child]].count)
+            ++child;
+        if (summary->counters[summary->heap[child]].count >= summary->counters[counter].count)
+            break;
+        heap_set(summary, position, summary->heap[child]);
+    }
+    heap_set(summary, position, counter);
+    return;
+}
+
+/* Returns the slot of the key in the index, or the empty slot where it would go. */
+static size_t index_find(const space_saving_t *summary, const uint8_t *const key, const size_t length, const uint64_t hash) {
+    size_t slot = hash & summary->index_mask;
+    for (uint32_t entry; (entry = summary->index[slot]); slot = (slot + 1) & summary->index_mask) {
+        const space_saving_counter_t *counter = &summary->counters[entry - 1];
+        if (counter->hash == hash && counter->length == length && !memcmp(counter_key(summary, entry - 1), key, length))
+            break;
+    }
+    return slot;
+}
+
+/* The entries after the removed one move back into the hole unless it lies between them and their home slot. */
+static void index_remove(space_saving_t *summary, size_t slot) {
+    for (size_t next = (slot + 1) & summary->index_mask; summary->index[next]; next = (next + 1) & summary->index_mask) {
+        size_t home = summary->counters[summary->index[next] - 1].hash & summary->index_mask;
+        if (((next - home) & summary->index_mask) >= ((next - slot) & summary->index_mask)) {
+            summary->index[slot] = summary->index[next];
+            slot = next;
+        }
+    }
+    summary->index[slot] = 0;
+    return;
+}
+
+static void halve(space_saving_t *summary) {
+    for (size_t i = 0; i < summary->count; ++i) {
+        summary->counters[i].count /= 2;
+        summary->counters[i].error /= 2;
+    }
+    summary->total /= 2;
+    return;
+}
+
+space_saving_t *space_saving_create(size_t capacity, size_t key_size, uint64_t window) {
+    assert(capacity && capacity < UINT32_MAX / 2 && key_size);
+    space_saving_t *summary = calloc(1, sizeof(space_saving_t));
+    assert(summary);
+    summary->capacity = capacity;
+    summary->key_size = key_size;
+    summary->window = window;
+    size_t slots = 1;
+    while (slots < capacity * 2)
+        slots <<= 1;
+    summary->index_mask = slots - 1;
+    summary->counters = malloc(sizeof(space_saving_counter_t) * capacity);
+    summary->keys = malloc(capacity * key_size);
+    summary->heap = malloc(sizeof(uint32_t) * capacity);
+    summary->index = calloc(slots, sizeof(uint32_t));
+    assert(summary->counters && summary->keys && summary->heap && summary->index);
+    return summary;
+}
+
+void space_saving_destroy(space_saving_t *summary) {
+    assert(summary);
+    free(summary->index);
+    free(summary->heap);
+    free(summary->keys);
+    free(summary->counters);
+    free(summary);
+    return;
+}
+
+void space_saving_offer(space_saving_t *summary, const uint8_t *const key, size_t length, uint64_t hash, uint64_t weight) {
+    assert(summary && key);
+    if (length > summary->key_size)
+        length = summary->key_size;
+    summary->total += weight;
+    if (summary->window && summary->total >= summary->window)
+        halve(summary);
+
+    size_t slot = index_find(summary, key, length, hash);
+    if (summary->index[slot]) {
+        space_saving_counter_t *counter = &summary->counters[summary->index[slot] - 1];
+        counter->count += weight;
+        heap_sift_down(summary, counter->heap_index);
+        return;
+    }
+
+    uint32_t number;
+    uint64_t floor = 0;
+    bool appended = summary->count < summary->capacity;
+    if (appended) {
+        number = summary->count++;
+        heap_set(summary, number, number);
+    } else {
+        /* The key takes over the smallest counter, whose count bounds how often it may have been missed. */
+        number = summary->heap[0];
+        space_saving_counter_t *victim = &summary->counters[number];
+        floor = victim->count;
+        index_remove(summary, index_find(summary, counter_key(summary, number), victim->length, victim->hash));
+        slot = index_find(summary, key, length, hash);
+    }
+    space_saving_counter_t *counter = &summary->counters[number];
+    counter->hash = hash;
+    counter->count = floor + weight;
+    counter->error = floor;
+    counter->length = length;
+    memcpy(counter_key(summary, number), key, length);
+    summary->index[slot] = number + 1;
+    if (appended)
+        heap_sift_up(summary, counter->heap_index);
+    else
+        heap_sift_down(summary, counter->heap_index);
+    return;
+}
+
+const uint8_t *space_saving_key(const space_saving_t *summary, const space_saving_counter_t *counter) {
+    assert(summary && counter);
+    return counter_key(summary, counter - summary->counters);
+}
+
+static int count_compare(const void *a, const void *b) {
+    uint64_t x = (*(const space_saving_counter_t *const *)a)->count, y = (*(const space_saving_counter_t *const *)b)->count;
+    return (x < y) - (x > y);
+}
+
+size_t space_saving_top(const space_saving_t *summary, const space_saving_counter_t **top, size_t n) {
+    assert(summary && top);
+    const space_saving_counter_t **order = malloc(sizeof(space_saving_counter_t *) * (summary->count + 1));
+    assert(order);
+    for (size_t i = 0; i < summary->count; ++i)
+        order[i] = &summary->counters[i];
+    qsort(order, summary->count, sizeof(space_saving_counter_t *), count_compare);
+    if (n > summary->count)
+        n = summary->count;
+    memcpy(top, order, sizeof(space_saving_counter_t *) * n);
+    free(order);
+    return n;
+}
+
+size_t space_saving_size(const space_saving_t *summary) {
+    assert(summary);
+    return sizeof(space_saving_t) + (sizeof(space_saving_counter_t) + summary->key_size + sizeof(uint32_t)) * summary->capacity +
+           sizeof(uint32_t) * (summary->index_mask + 1);
+}
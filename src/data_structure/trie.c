@@ -1,11 +1,14 @@
 #include "data_structure/trie.h"
+#include "data_structure/object_pool.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
+static object_pool_t trie_node_pool = OBJECT_POOL_INITIALIZER("trie_node", sizeof(trie_node_t));
+
 static inline trie_node_t *trie_node_create(trie_node_t *fa) {
-    trie_node_t *p = malloc(sizeof(trie_node_t));
+    trie_node_t *p = object_pool_alloc(&trie_node_pool);
     assert(p);
     p->count = 0;
     p->fa = fa;
@@ -21,7 +24,7 @@ static inline void trie_node_destroy(trie_node_t *p) {
     for (size_t i = 0; i < TRIE_RADIX; ++i)
         p->ch[i] = NULL;
     p->value = NULL;
-    free(p);
+    object_pool_free(&trie_node_pool, p);
     return;
 }
 
@@ -56,7 +59,7 @@ trie_node_t *trie_find(trie_t rt, const trie_radix_t *binary_string, size_t len)
     return p;
 }
 
-trie_node_t *trie_insert(trie_t rt, const trie_radix_t *binary_string, size_t len) {
+trie_node_t *trie_reserve(trie_t rt, const trie_radix_t *binary_string, size_t len) {
     assert(rt);
     trie_node_t *p = rt;
     for (size_t i = 0; i < len; ++i) {
@@ -64,6 +67,11 @@ trie_node_t *trie_insert(trie_t rt, const trie_radix_t *binary_string, size_t le
             p->ch[binary_string[i]] = trie_node_create(p);
         p = p->ch[binary_string[i]];
     }
+    return p;
+}
+
+trie_node_t *trie_insert(trie_t rt, const trie_radix_t *binary_string, size_t len) {
+    trie_node_t *p = trie_reserve(rt, binary_string, len);
     ++p->count;
     return p;
 }
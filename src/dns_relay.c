@@ -1,223 +1,315 @@
 #include "dns_relay.h"
+#include "data_structure/object_pool.h"
 #include "module/cmd_interpreter.h"
 #include "module/dns_cache.h"
+#include "module/hot_keys.h"
 #include "module/id_translation.h"
 #include "module/logger.h"
+#include "module/rate_limit.h"
+#include "module/relay_clock.h"
+#include "module/replay.h"
 #include "module/rule_table.h"
+#include "module/statistics.h"
 #include "network/dns_utility.h"
 
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
 
-static inline void put_message(const dns_message_t *dns_message, const struct sockaddr_in *const address) {
-    static const size_t buffer_size = 1 << 20;
-    static uint8_t *buffer = NULL;
-    if (!buffer)
-        buffer = malloc(buffer_size);
-    uint8_t *end = convert_dns_message_to_stream(dns_message, buffer);
-    size_t length = end - buffer;
-    sendto(sockfd, buffer, length, 0, (const struct sockaddr *)address, sizeof(*address));
+static uint8_t send_buffer[BUF_SIZE];
+static rate_limit_action_t client_rate_limit_action = RATE_LIMIT_ACTION_DROP;
+
+static inline void put_message(const uint8_t *const buffer, const size_t length, const struct sockaddr_in *const address) {
+    if (replay_active())
+        replay_transmit(buffer, length, address);
+    else
+        sendto(sockfd, buffer, length, 0, (const struct sockaddr *)address, sizeof(*address));
     return;
 }
 
-static inline void send_nx(const dns_message_t *dns_message, const struct sockaddr_in *const client_address) {
-    dns_message_t *send_message = clone_dns_message(dns_message);
-    send_message->header->flag.flags.qr = 1;
-    send_message->header->flag.flags.rcode = 3;
-    put_message(send_message, client_address);
-    dns_message_destroy(send_message);
+static inline void send_nx(const dns_message_view_t *view, const struct sockaddr_in *const client_address) {
+    dns_response_t response;
+    dns_response_init(&response, send_buffer, sizeof(send_buffer), view, 3);
+    put_message(send_buffer, dns_response_finish(&response), client_address);
     return;
 }
 
-static inline void send_configured_response(const dns_message_t *dns_message, forward_list_t result, const struct sockaddr_in *const client_address) {
-    dns_message_t *send_message = clone_dns_message(dns_message);
-    send_message->header->flag.flags.qr = 1;
-    send_message->header->flag.flags.rcode = 0;
-    send_message->answers = result;
-    send_message->header->ancount = 0;
-    forward_list_node_t *ptr = result;
-    while (ptr) {
-        ++send_message->header->ancount;
-        ptr = ptr->next;
-    }
-    put_message(send_message, client_address);
-    dns_message_destroy(send_message);
+/* An answer without records, such as REFUSED or a truncated response sending the client to TCP. */
+static inline void send_empty(const dns_message_view_t *view, const uint16_t id, const uint8_t rcode, const bool truncated,
+                              const struct sockaddr_in *const client_address) {
+    dns_response_t response;
+    dns_response_init(&response, send_buffer, sizeof(send_buffer), view, rcode);
+    send_buffer[0] = id >> 8;
+    send_buffer[1] = id & 0xff;
+    if (truncated)
+        send_buffer[2] |= 0x02;
+    put_message(send_buffer, dns_response_finish(&response), client_address);
     return;
 }
 
-static inline void send_cached_response(const dns_message_t *dns_message, forward_list_t result, const struct sockaddr_in *const client_address) {
-    dns_message_t *send_message = clone_dns_message(dns_message);
-    send_message->header->flag.flags.qr = 1;
-    send_message->header->flag.flags.rcode = 0;
-    send_message->answers = result;
-    send_message->header->ancount = 0;
-    forward_list_node_t *ptr = result;
-    while (ptr) {
-        ++send_message->header->ancount;
-        ptr = ptr->next;
+/* Returns whether a response may go out; one over the response rate limit is dropped or slipped instead. */
+static inline bool response_allowed(const dns_message_view_t *view, const uint16_t id, const uint8_t rcode, const struct sockaddr_in *const client_address) {
+    switch (rate_limit_response(client_address, view->question, rcode)) {
+    case RATE_LIMIT_PASS:
+        return true;
+    case RATE_LIMIT_SLIP:
+        statistics_increment(STATISTICS_RESPONSE_SLIPPED);
+        send_empty(view, id, rcode, true, client_address);
+        return false;
+    default:
+        statistics_increment(STATISTICS_RESPONSE_DROPPED);
+        return false;
     }
-    put_message(send_message, client_address);
-    dns_message_destroy(send_message);
-    return;
 }
 
-static inline void send_relay_request(const dns_message_t *dns_message, uint16_t nid, const struct sockaddr_in *const dns_server_address) {
-    dns_message_t *send_message = clone_dns_message(dns_message);
-    send_message->header->id = nid;
-    put_message(send_message, dns_server_address);
-    dns_message_destroy(send_message);
+static inline void send_relay_request(const dns_message_view_t *view, uint16_t nid, const struct sockaddr_in *const dns_server_address) {
+    memcpy(send_buffer, view->base, view->length);
+    send_buffer[0] = nid >> 8;
+    send_buffer[1] = nid & 0xff;
+    put_message(send_buffer, view->length, dns_server_address);
     return;
 }
 
-static inline void send_relay_response(const dns_message_t *dns_message, const uint16_t original_id, const struct sockaddr_in *const client_address) {
-    dns_message_t *send_message = clone_dns_message(dns_message);
-    send_message->header->id = original_id;
-    put_message(send_message, client_address);
-    dns_message_destroy(send_message);
+static inline void send_relay_response(const dns_message_view_t *view, const uint16_t original_id, const struct sockaddr_in *const client_address) {
+    memcpy(send_buffer, view->base, view->length);
+    send_buffer[0] = original_id >> 8;
+    send_buffer[1] = original_id & 0xff;
+    put_message(send_buffer, view->length, client_address);
+    return;
 }
 
-static inline void handle_query(const dns_message_t *dns_message, const struct sockaddr_in *const dns_server_address, const struct sockaddr_in *const client_addr) {
-    assert(dns_message->header->flag.flags.opcode == 0);
-    assert(dns_message->header->flag.flags.tc == 0);
-    assert(dns_message->header->flag.flags.z == 0);
-    assert(dns_message->header->qdcount == 1);
-
-    forward_list_node_t *questions;
-    bool banned = false;
-    questions = dns_message->questions;
-    for (size_t i = 0; i < dns_message->header->qdcount; ++i) {
-        assert(questions);
-        question_t *question = questions->value;
-        char *name = get_name_from_name_field(question->qname);
-        if (is_banned(name))
-            banned = true;
-        free(name);
-        questions = questions->next;
+static inline void handle_query(dns_message_view_t *view, const struct sockaddr_in *const dns_server_address, const struct sockaddr_in *const client_addr) {
+    assert(view->header.flag.flags.opcode == 0);
+    assert(view->header.flag.flags.tc == 0);
+    assert(view->header.flag.flags.z == 0);
+    assert(view->header.qdcount == 1);
+
+    const question_t *question = view->question;
+    assert(question);
+    hot_keys_query(question, client_addr);
+    if (!rate_limit_client(client_addr)) {
+        logger_write(LOG_LEVEL_INFO, "Rate Limited Query.");
+        statistics_increment(STATISTICS_CLIENT_LIMITED);
+        if (client_rate_limit_action != RATE_LIMIT_ACTION_DROP)
+            send_empty(view, view->header.id, client_rate_limit_action == RATE_LIMIT_ACTION_REFUSE ? 5 : 0,
+                       client_rate_limit_action == RATE_LIMIT_ACTION_TRUNCATE, client_addr);
+        return;
     }
-    assert(questions == NULL);
-    if (banned) {
+    if (is_banned(question->canonical_qname)) {
         logger_write(LOG_LEVEL_INFO, "Banned Query.");
-        send_nx(dns_message, client_addr);
+        statistics_increment(STATISTICS_BANNED);
+        if (response_allowed(view, view->header.id, 3, client_addr))
+            send_nx(view, client_addr);
         return;
     }
 
-    bool configured = true;
-    questions = dns_message->questions;
-    forward_list_node_t *configured_result = NULL;
-    for (size_t i = 0; i < dns_message->header->qdcount; ++i) {
-        assert(questions);
-        question_t *question = questions->value;
-        assert(question->qclass == 1);
-        char *name = get_name_from_name_field(question->qname);
-        forward_list_node_t *ptr = get_configured(name);
-        bool found = false;
-        while (ptr) {
-            resource_record_t *resource_record = ptr->value;
-            if (resource_record->type == question->qtype && resource_record->class == question->qclass) {
-                found = true;
-                configured_result = forward_list_node_create(configured_result);
-                configured_result->value = clone_resource_record(resource_record);
-            }
-            ptr = ptr->next;
-        }
-        assert(ptr == NULL);
-        if (!found)
-            configured = false;
-        free(name);
-        questions = questions->next;
-    }
-    assert(questions == NULL);
-    if (configured) {
+    assert(question->qclass == 1);
+    dns_response_t response;
+    dns_response_init(&response, send_buffer, sizeof(send_buffer), view, 0);
+    const dns_rrset_t *rrset = get_configured(question->canonical_qname, question->qtype, question->qclass);
+    if (rrset && dns_response_add_rrset(&response, rrset, 0)) {
         logger_write(LOG_LEVEL_INFO, "Configured Query.");
-        send_configured_response(dns_message, configured_result, client_addr);
+        statistics_increment(STATISTICS_CONFIGURED);
+        size_t length = dns_response_finish(&response);
+        if (response_allowed(view, view->header.id, 0, client_addr))
+            put_message(send_buffer, length, client_addr);
         return;
-    } else if (configured_result)
-        forward_list_destroy(configured_result, resource_record_destroy);
-
-    bool cached = true;
-    questions = dns_message->questions;
-    forward_list_node_t *cached_result = NULL;
-    for (size_t i = 0; i < dns_message->header->qdcount; ++i) {
-        assert(questions);
-        question_t *question = questions->value;
-        assert(question->qclass == 1);
-        bool found = false;
-        cached_result = dns_cache_query(question);
-        if (cached_result)
-            found = true;
-        if (!found)
-            cached = false;
-        questions = questions->next;
     }
-    assert(questions == NULL);
-    if (cached) {
+
+    if (dns_cache_answer(question, &response)) {
         logger_write(LOG_LEVEL_INFO, "Cached Query.");
-        send_cached_response(dns_message, cached_result, client_addr);
+        statistics_increment(STATISTICS_CACHED);
+        size_t length = dns_response_finish(&response);
+        if (response_allowed(view, view->header.id, 0, client_addr))
+            put_message(send_buffer, length, client_addr);
         return;
-    } else if (cached_result)
-        forward_list_destroy(cached_result, resource_record_destroy);
+    }
 
     logger_write(LOG_LEVEL_INFO, "Relay Query.");
+    statistics_increment(STATISTICS_RELAYED);
+    hot_keys_miss(question);
 
     uint16_t nid = nid_create();
     set_client_address(nid, client_addr);
-    set_original_id(nid, dns_message->header->id);
-    send_relay_request(dns_message, nid, dns_server_address);
+    set_original_id(nid, view->header.id);
+    send_relay_request(view, nid, dns_server_address);
 
     return;
 }
 
-static inline void handle_response(const dns_message_t *dns_message) {
-    assert(dns_message->header->qdcount == 1);
-    uint16_t nid = dns_message->header->id;
+static inline void handle_response(dns_message_view_t *view) {
+    assert(view->header.qdcount == 1);
+    uint16_t nid = view->header.id;
     struct sockaddr_in *client_addr = get_client_address(nid);
     uint16_t original_id = get_original_id(nid);
 
-    if (dns_message->header->flag.flags.rcode == 0) {
-        forward_list_node_t *p = dns_message->answers;
-        while (p) {
-            dns_cache_insert(dns_message->questions->value, p->value);
-            p = p->next;
-        }
-    }
-    send_relay_response(dns_message, original_id, client_addr);
+    if (view->header.flag.flags.rcode == 0 && view->header.ancount)
+        dns_cache_insert(view->question, dns_message_view_answers(view));
+    if (response_allowed(view, original_id, view->header.flag.flags.rcode, client_addr))
+        send_relay_response(view, original_id, client_addr);
     nid_release(nid);
     return;
 }
 
-static inline void distribute_frame(const dns_message_t *dns_message, const struct sockaddr_in *const dns_server_address, const struct sockaddr_in *const client_addr) {
-    if (dns_message->header->flag.flags.qr == 0) {
+static inline void distribute_frame(dns_message_view_t *view, const struct sockaddr_in *const dns_server_address, const struct sockaddr_in *const client_addr) {
+    if (view->header.flag.flags.qr == 0) {
         // query
-        handle_query(dns_message, dns_server_address, client_addr);
+        statistics_increment(STATISTICS_QUERY);
+        handle_query(view, dns_server_address, client_addr);
 
     } else {
         // response
-        handle_response(dns_message);
+        statistics_increment(STATISTICS_RESPONSE);
+        handle_response(view);
+    }
+    return;
+}
+
+static inline void process_frame(const char *const frame, const size_t length, const struct sockaddr_in *const dns_server_address, const struct sockaddr_in *const client_addr) {
+    if (logger_enabled(LOG_LEVEL_DEBUG)) {
+        logger_hex(LOG_LEVEL_DEBUG, (const uint8_t *)frame, length);
+        dns_message_t *message = parse_dns_message((const uint8_t *)frame, length);
+        if (message) {
+            logger_dns_message(LOG_LEVEL_DEBUG, message);
+            dns_message_destroy(message);
+        }
     }
+
+    dns_message_view_t view;
+    if (!dns_message_view_init(&view, (const uint8_t *)frame, length) || view.header.qdcount != 1 || !dns_message_view_question(&view)) {
+        logger_write(LOG_LEVEL_INFO, "Malformed message dropped.");
+        statistics_increment(STATISTICS_MALFORMED);
+        dns_message_view_release(&view);
+        return;
+    }
+
+    rule_table_reader_enter();
+    distribute_frame(&view, dns_server_address, client_addr);
+    rule_table_reader_leave();
+
+    dns_message_view_release(&view);
+    return;
+}
+
+/* The cache snapshot is loaded at the first query, once the clock follows the trace. */
+static void run_replay(const char *const filename, const char *const cache_filename, const struct sockaddr_in *const dns_server_address) {
+    replay_load(filename);
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    size_t frame_count = 0;
+    replay_frame_t frame;
+    while (replay_next_query(&frame)) {
+        relay_clock_simulate(frame.time);
+        if (cache_filename && !frame_count)
+            dns_cache_load(cache_filename);
+        process_frame((const char *)frame.data, frame.length, dns_server_address, &frame.address);
+        ++frame_count;
+        while (replay_next_upstream(&frame)) {
+            process_frame((const char *)frame.data, frame.length, dns_server_address, &frame.address);
+            ++frame_count;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (cache_filename)
+        dns_cache_save(cache_filename);
+
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    printf("replay.frames=%zu\n", frame_count);
+    printf("replay.seconds=%.6f\n", seconds);
+    printf("replay.frames_per_second=%.0f\n", seconds > 0 ? frame_count / seconds : 0);
+    replay_report(stdout);
+    statistics_report(stdout);
+    dns_cache_report(stdout);
+    hot_keys_report(stdout);
+    rate_limit_report(stdout);
+    object_pool_report(stdout);
+    return;
+}
+
+static volatile sig_atomic_t reload_requested = 0;
+static volatile sig_atomic_t report_requested = 0;
+static volatile sig_atomic_t save_requested = 0;
+static volatile sig_atomic_t shutdown_requested = 0;
+
+static void request_reload(int signal_number) {
+    (void)signal_number;
+    reload_requested = 1;
     return;
 }
+
+static void request_report(int signal_number) {
+    (void)signal_number;
+    report_requested = 1;
+    return;
+}
+
+static void request_save(int signal_number) {
+    (void)signal_number;
+    save_requested = 1;
+    return;
+}
+
+static void request_shutdown(int signal_number) {
+    (void)signal_number;
+    shutdown_requested = 1;
+    return;
+}
+
 char buf[BUF_SIZE];
 
 int main(int argc, char *argv[]) {
     cmd_opt_t options = get_options(argc, argv);
     logger_init(options.log_file_name, options.debug_level, options.stderr_enable);
     logger_write(LOG_LEVEL_INFO,
-                 "\nOptions:\n\t--debug = %zu,\n\t--cache-size = %zu item,\n\t--listen-port = %" PRIu16 ",\n\t--hosts-file = %s,\n\t--dns-server = %s,\n\t--log-file = %s,\n\t--stderr-enable = %d.",
+                 "\nOptions:\n\t--debug = %zu,\n\t--cache-size = %zu item,\n\t--cache-memory = %zu byte,\n\t--cache-policy = %s,\n\t--listen-port = %" PRIu16 ",\n\t--hosts-file = %s,\n\t--dns-server = %s,\n\t--log-file = %s,\n\t--stderr-enable = %d,\n\t--replay = %s,\n\t--huge-pages = %d,\n\t--cache-file = %s,\n\t--cache-save-interval = %u s,\n\t--shared-cache = %s,\n\t--hot-keys = %zu,\n\t--rate-limit = %" PRIu32 " qps,\n\t--rate-limit-action = %s,\n\t--response-rate-limit = %" PRIu32 " rps.",
                  options.debug_level,
                  options.cache_size,
+                 options.cache_memory,
+                 options.cache_admission ? "tinylfu" : "lru",
                  options.listen_port,
                  options.hosts_file_name,
                  options.isp_dns_server_ip,
                  options.log_file_name,
-                 options.stderr_enable);
+                 options.stderr_enable,
+                 options.replay_file_name ? options.replay_file_name : "(none)",
+                 options.huge_pages,
+                 options.cache_file_name ? options.cache_file_name : "(none)",
+                 options.cache_save_interval,
+                 options.shared_cache_name ? options.shared_cache_name : "(none)",
+                 options.hot_key_count,
+                 options.client_rate_limit,
+                 options.rate_limit_action == RATE_LIMIT_ACTION_DROP ? "drop" : options.rate_limit_action == RATE_LIMIT_ACTION_REFUSE ? "refuse" : "truncate",
+                 options.response_rate_limit);
+    object_pool_use_huge_pages(options.huge_pages);
     load_rule_table(options.hosts_file_name);
 
-    dns_cache_init(options.cache_size);
+    dns_cache_init(options.cache_size, options.cache_memory, options.cache_admission);
+    hot_keys_init(options.hot_key_count);
+    rate_limit_init(options.client_rate_limit, options.response_rate_limit);
+    client_rate_limit_action = options.rate_limit_action;
+    if (options.shared_cache_name && !dns_cache_share(options.shared_cache_name, options.cache_memory))
+        logger_write(LOG_LEVEL_WARNING, "Falling back to a private cache.");
+
+    struct sockaddr_in dns_server_address;
+    memset(&dns_server_address, 0, sizeof(dns_server_address));
+    dns_server_address.sin_family = AF_INET;
+    dns_server_address.sin_port = htons(DNS_PORT);
+    dns_server_address.sin_addr.s_addr = inet_addr(options.isp_dns_server_ip);
+
+    if (options.replay_file_name) {
+        run_replay(options.replay_file_name, options.cache_file_name, &dns_server_address);
+        return 0;
+    }
+    if (options.cache_file_name)
+        dns_cache_load(options.cache_file_name);
 
     sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
@@ -238,16 +330,57 @@ int main(int argc, char *argv[]) {
     }
     logger_write(LOG_LEVEL_INFO, "Socket bind %d successfully.", DNS_PORT);
 
-    struct sockaddr_in dns_server_address;
-    memset(&dns_server_address, 0, sizeof(dns_server_address));
-    dns_server_address.sin_family = AF_INET;
-    dns_server_address.sin_port = htons(DNS_PORT);
-    dns_server_address.sin_addr.s_addr = inet_addr(options.isp_dns_server_ip);
+    struct sigaction reload_action;
+    memset(&reload_action, 0, sizeof(reload_action));
+    reload_action.sa_handler = request_reload;
+    sigemptyset(&reload_action.sa_mask);
+    sigaction(SIGHUP, &reload_action, NULL);
+
+    struct sigaction report_action;
+    memset(&report_action, 0, sizeof(report_action));
+    report_action.sa_handler = request_report;
+    sigemptyset(&report_action.sa_mask);
+    sigaction(SIGUSR1, &report_action, NULL);
+
+    struct sigaction shutdown_action;
+    memset(&shutdown_action, 0, sizeof(shutdown_action));
+    shutdown_action.sa_handler = request_shutdown;
+    sigemptyset(&shutdown_action.sa_mask);
+    sigaction(SIGTERM, &shutdown_action, NULL);
+    sigaction(SIGINT, &shutdown_action, NULL);
+
+    if (options.cache_file_name && options.cache_save_interval) {
+        struct sigaction save_action;
+        memset(&save_action, 0, sizeof(save_action));
+        save_action.sa_handler = request_save;
+        sigemptyset(&save_action.sa_mask);
+        sigaction(SIGALRM, &save_action, NULL);
+        alarm(options.cache_save_interval);
+    }
 
     struct sockaddr_in client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
 
-    while (1) {
+    while (!shutdown_requested) {
+        if (reload_requested) {
+            reload_requested = 0;
+            logger_write(LOG_LEVEL_INFO, "Reloading rule table %s.", options.hosts_file_name);
+            reload_rule_table(options.hosts_file_name);
+        }
+        if (report_requested) {
+            report_requested = 0;
+            statistics_report(stdout);
+            dns_cache_report(stdout);
+            hot_keys_report(stdout);
+            rate_limit_report(stdout);
+            object_pool_report(stdout);
+            fflush(stdout);
+        }
+        if (save_requested) {
+            save_requested = 0;
+            dns_cache_save(options.cache_file_name);
+            alarm(options.cache_save_interval);
+        }
         ssize_t recv_len = recvfrom(sockfd, buf, BUF_SIZE, 0, (struct sockaddr *)&client_addr, &client_addr_len);
         if (recv_len < 0) {
             assert(recv_len == -1);
@@ -257,15 +390,12 @@ int main(int argc, char *argv[]) {
         }
         logger_write(LOG_LEVEL_INFO, "Received %zd byte(s) from client %s:%d.", recv_len, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
 
-        logger_hex(LOG_LEVEL_DEBUG, (uint8_t *)buf, recv_len);
-        dns_message_t *message = parse_dns_message(buf);
-
-        logger_dns_message(LOG_LEVEL_DEBUG, message);
-        distribute_frame(message, &dns_server_address, &client_addr);
-
-        dns_message_destroy(message);
-        message = NULL;
+        process_frame(buf, recv_len, &dns_server_address, &client_addr);
     }
 
+    logger_write(LOG_LEVEL_INFO, "Shutting down.");
+    if (options.cache_file_name)
+        dns_cache_save(options.cache_file_name);
+    close(sockfd);
     return 0;
 }
@@ -1,33 +1,79 @@
 #include "module/cmd_interpreter.h"
 
+#include <ctype.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/* A byte count may end with k, m or g for binary multiples. */
+static size_t parse_bytes(const char *const text) {
+    char *end;
+    size_t value = strtoull(text, &end, 10);
+    switch (tolower((unsigned char)*end)) {
+    case 'g':
+        value <<= 10;
+        /* fall through */
+    case 'm':
+        value <<= 10;
+        /* fall through */
+    case 'k':
+        value <<= 10;
+        break;
+    case '\0':
+        break;
+    default:
+        fprintf(stderr, "Invalid byte count %s.\n", text);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
 cmd_opt_t get_options(int argc, char *argv[]) {
     cmd_opt_t options = {
         .debug_level = 0,
         .cache_size = -1,
+        .cache_memory = -1,
+        .cache_admission = true,
         .listen_port = 53,
         .hosts_file_name = "hosts.txt",
         .isp_dns_server_ip = "114.114.114.114",
         .log_file_name = "dns_relay.log",
-        .stderr_enable = false};
+        .stderr_enable = false,
+        .replay_file_name = NULL,
+        .huge_pages = false,
+        .cache_file_name = NULL,
+        .cache_save_interval = 0,
+        .shared_cache_name = NULL,
+        .hot_key_count = 10,
+        .client_rate_limit = 0,
+        .rate_limit_action = RATE_LIMIT_ACTION_DROP,
+        .response_rate_limit = 0};
 
     struct option long_options[] = {
         {"debug-level", required_argument, NULL, 'd'},
         {"cache-size", required_argument, NULL, 'c'},
+        {"cache-memory", required_argument, NULL, 'm'},
+        {"cache-policy", required_argument, NULL, 'P'},
         {"listen-port", required_argument, NULL, 'p'},
         {"file-hosts", required_argument, NULL, 'f'},
         {"dns-server", required_argument, NULL, 's'},
         {"log-file", required_argument, NULL, 'l'},
         {"stderr-enable", no_argument, NULL, 'e'},
+        {"replay", required_argument, NULL, 'r'},
+        {"huge-pages", no_argument, NULL, 'H'},
+        {"cache-file", required_argument, NULL, 'C'},
+        {"cache-save-interval", required_argument, NULL, 'i'},
+        {"shared-cache", required_argument, NULL, 'S'},
+        {"hot-keys", required_argument, NULL, 'k'},
+        {"rate-limit", required_argument, NULL, 'R'},
+        {"rate-limit-action", required_argument, NULL, 'A'},
+        {"response-rate-limit", required_argument, NULL, 'L'},
         {NULL, 0, NULL, 0}};
 
     int opt;
     int option_index = 0;
-    while ((opt = getopt_long(argc, argv, "d:c:p:f:s:l:e", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:c:m:P:p:f:s:l:er:HC:i:S:k:R:A:L:", long_options, &option_index)) != -1) {
         switch (opt) {
         case 'd':
             if (optarg)
@@ -41,6 +87,19 @@ cmd_opt_t get_options(int argc, char *argv[]) {
             else
                 options.cache_size = 512;
             break;
+        case 'm':
+            options.cache_memory = parse_bytes(optarg);
+            break;
+        case 'P':
+            if (strcmp(optarg, "lru") == 0)
+                options.cache_admission = false;
+            else if (strcmp(optarg, "tinylfu") == 0)
+                options.cache_admission = true;
+            else {
+                fprintf(stderr, "Unknown cache policy %s.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'p':
             if (optarg)
                 options.listen_port = strtoul(optarg, NULL, 10);
@@ -75,8 +134,49 @@ cmd_opt_t get_options(int argc, char *argv[]) {
             options.stderr_enable = true;
             break;
         }
+        case 'r':
+            if (optarg)
+                options.replay_file_name = strdup(optarg);
+            else {
+                fprintf(stderr, "Missing argument for replay file.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'H':
+            options.huge_pages = true;
+            break;
+        case 'C':
+            options.cache_file_name = strdup(optarg);
+            break;
+        case 'i':
+            options.cache_save_interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'S':
+            options.shared_cache_name = strdup(optarg);
+            break;
+        case 'k':
+            options.hot_key_count = strtoul(optarg, NULL, 10);
+            break;
+        case 'R':
+            options.client_rate_limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'A':
+            if (strcmp(optarg, "drop") == 0)
+                options.rate_limit_action = RATE_LIMIT_ACTION_DROP;
+            else if (strcmp(optarg, "refuse") == 0)
+                options.rate_limit_action = RATE_LIMIT_ACTION_REFUSE;
+            else if (strcmp(optarg, "truncate") == 0)
+                options.rate_limit_action = RATE_LIMIT_ACTION_TRUNCATE;
+            else {
+                fprintf(stderr, "Unknown rate limit action %s.\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'L':
+            options.response_rate_limit = strtoul(optarg, NULL, 10);
+            break;
         default:
-            fprintf(stderr, "Usage: %s [-d debug-level] [-c cache-size] [-p listen-port] [-h hosts-file] [-s dns-server] [-l log-file] [-e stderr-enable]\n", argv[0]);
+            fprintf(stderr, "Usage: %s [-d debug-level] [-c cache-size] [-m cache-memory] [-P lru|tinylfu] [-p listen-port] [-h hosts-file] [-s dns-server] [-l log-file] [-e stderr-enable] [-r replay-file] [-H huge-pages] [-C cache-file] [-i cache-save-interval] [-S shared-cache] [-k hot-keys] [-R rate-limit] [-A drop|refuse|truncate] [-L response-rate-limit]\n", argv[0]);
             exit(EXIT_FAILURE);
         }
     }
@@ -1,61 +1,685 @@
 #include "module/dns_cache.h"
+#include "module/relay_clock.h"
+#include "data_structure/frequency_sketch.h"
+#include "data_structure/intern_table.h"
 #include "data_structure/list.h"
-#include "data_structure/trie.h"
+#include "data_structure/miss_ratio_curve.h"
+#include "module/logger.h"
+#include "module/shared_cache.h"
+#include "network/dns_rrset.h"
 #include "network/dns_utility.h"
 
-#include <time.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-static trie_t cache_trie = NULL;
+#define DNS_CACHE_INITIAL_COUNT 1024
+#define DNS_CACHE_HASH_SEED 0x9e3779b97f4a7c15u
+#define DNS_CACHE_HASH_MULTIPLIER 0xff51afd7ed558ccdu
+#define DNS_CACHE_WINDOW_PERCENT 1
+#define DNS_CACHE_PROTECTED_PERCENT 80
+#define DNS_CACHE_CHAIN_LIMIT 8
+#define DNS_TYPE_CNAME 5
+#define DNS_CACHE_SHARED_SIZE (64 << 20)
+#define DNS_CACHE_CURVE_SAMPLES 8192
+#define DNS_CACHE_CURVE_WINDOW (1u << 24)
+#define DNS_CACHE_CURVE_MIN_SIZE 256
+#define DNS_CACHE_CURVE_MAX_SIZE (4u << 20)
+#define DNS_CACHE_SNAPSHOT_MAGIC "DNSCACH1"
+#define DNS_CACHE_SNAPSHOT_VERSION 1
+
+/*
+ * With admission, new entries enter a small LRU window. An entry pushed out of the window is
+ * admitted to the main space only if the sketch has seen its key more often than the key of the
+ * entry it would evict. The main space is a segmented LRU: hits in probation promote entries to
+ * the protected segment, whose overflow falls back to probation. Without admission every entry
+ * stays in the window, which is then a plain LRU list.
+ */
+typedef enum cache_segment {
+    CACHE_SEGMENT_WINDOW,
+    CACHE_SEGMENT_PROBATION,
+    CACHE_SEGMENT_PROTECTED,
+    CACHE_SEGMENT_COUNT,
+} cache_segment_t;
+
+/*
+ * RRsets are cached under their owner names, which are interned: each is stored once, with the
+ * chain of entries cached under it as its value, so the name table is also the index of the cache.
+ * An entry is one allocation: its place in its segment and in the chain of its name, then the
+ * RRset without an owner.
+ */
+typedef struct cache_entry {
+    list_node_t lru;
+    struct cache_entry *next;
+    interned_t *name;
+    uint32_t footprint;
+    uint8_t segment;
+    dns_rrset_t rrset[];
+} cache_entry_t;
+
+typedef enum cache_bytes {
+    CACHE_BYTES_ENTRIES,
+    CACHE_BYTES_RRSETS,
+    CACHE_BYTES_RDATA,
+    CACHE_BYTES_OVERHEAD,
+    CACHE_BYTES_COUNT,
+} cache_bytes_t;
+
+/*
+ * A snapshot is the header, then every entry as an RRset with its owner and its absolute expiry
+ * time, segment by segment from the least to the most recently used, then the blocks of the sketch
+ * aligned to a block. Loading the entries in file order rebuilds every segment in its order.
+ */
+typedef struct cache_snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t segment_counts[CACHE_SEGMENT_COUNT];
+    uint32_t reserved;
+    uint64_t sketch_offset;
+    uint64_t sketch_block_count;
+    uint64_t sketch_additions;
+    uint64_t file_size;
+} cache_snapshot_header_t;
+
+_Static_assert(sizeof(cache_snapshot_header_t) == 64, "cache snapshot header must stay 64 bytes");
+
+static const char *const cache_bytes_names[CACHE_BYTES_COUNT] = {
+    [CACHE_BYTES_ENTRIES] = "entries",
+    [CACHE_BYTES_RRSETS] = "rrsets",
+    [CACHE_BYTES_RDATA] = "rdata",
+    [CACHE_BYTES_OVERHEAD] = "overhead",
+};
+
+static shared_cache_t *shared = NULL;
+static intern_table_t *names = NULL;
+static frequency_sketch_t *sketch = NULL;
+static miss_ratio_curve_t *curve = NULL;
+static list_node_t segments[CACHE_SEGMENT_COUNT];
+static size_t segment_counts[CACHE_SEGMENT_COUNT];
 static size_t limit = -1;
+static size_t byte_limit = -1;
 static size_t item_count = 0;
+static size_t entry_count = 0;
+static size_t entry_bytes[CACHE_BYTES_COUNT];
+static size_t entry_bytes_total = 0;
+static size_t eviction_count = 0;
+static size_t expiration_count = 0;
+static size_t rejection_count = 0;
 
-void dns_cache_init(size_t item_limit) {
+static inline const dns_rrset_t *entry_rrset(const cache_entry_t *const entry) {
+    return entry->rrset;
+}
+
+/* Names are hashed a word at a time. */
+static inline uint64_t name_hash(const uint8_t *const name, const size_t length) {
+    uint64_t state = DNS_CACHE_HASH_SEED;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, name + i, sizeof(word));
+        state = (state ^ word) * DNS_CACHE_HASH_MULTIPLIER;
+        state ^= state >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, name + i, length - i);
+    state = (state ^ tail ^ (uint64_t)length << 56) * DNS_CACHE_HASH_MULTIPLIER;
+    state = (state ^ (state >> 33)) * 0xc4ceb9fe1a85ec53u;
+    return state ^ (state >> 33);
+}
+
+/* The sketch counts keys by a hash derived from the hash of their name. */
+static inline uint64_t key_hash(const uint64_t name_hash, const uint16_t type, const uint16_t class) {
+    uint64_t state = (name_hash ^ ((uint64_t)type << 16 | class)) * DNS_CACHE_HASH_MULTIPLIER;
+    return state ^ (state >> 29);
+}
+
+/* The RRset is copied without its owner, which is the name the entry is cached under. */
+static cache_entry_t *entry_create(interned_t *const name, const dns_rrset_t *const rrset) {
+    size_t size = rrset->size - rrset->owner_length;
+    cache_entry_t *entry = malloc(sizeof(cache_entry_t) + sizeof(dns_rrset_t) + size);
+    assert(entry);
+    entry->lru.value = entry;
+    entry->footprint = malloc_usable_size(entry) + sizeof(size_t);
+    entry->name = name;
+    *entry->rrset = *rrset;
+    entry->rrset->owner_length = 0;
+    entry->rrset->size = size;
+    memcpy(entry->rrset->data, rrset->data + rrset->owner_length, size);
+    return entry;
+}
+
+static void entry_destroy(cache_entry_t *entry) {
+    intern_table_release(names, entry->name, name_hash(entry->name->data, entry->name->length));
+    free(entry);
+    return;
+}
+
+/* The footprint of an entry counts the allocator's rounding and header as overhead. */
+static void entry_account(const cache_entry_t *const entry, const bool added) {
+    const dns_rrset_t *rrset = entry_rrset(entry);
+    size_t rdata = rrset->size - rrset->count * sizeof(uint16_t);
+    size_t sizes[CACHE_BYTES_COUNT] = {
+        [CACHE_BYTES_ENTRIES] = sizeof(cache_entry_t),
+        [CACHE_BYTES_RRSETS] = dns_rrset_size(rrset) - rdata,
+        [CACHE_BYTES_RDATA] = rdata,
+        [CACHE_BYTES_OVERHEAD] = entry->footprint - sizeof(cache_entry_t) - dns_rrset_size(rrset),
+    };
+    for (size_t i = 0; i < CACHE_BYTES_COUNT; ++i)
+        entry_bytes[i] = added ? entry_bytes[i] + sizes[i] : entry_bytes[i] - sizes[i];
+    entry_bytes_total = added ? entry_bytes_total + entry->footprint : entry_bytes_total - entry->footprint;
+    item_count = added ? item_count + rrset->count : item_count - rrset->count;
+    entry_count = added ? entry_count + 1 : entry_count - 1;
+    return;
+}
+
+static inline uint64_t entry_hash(const cache_entry_t *const entry) {
+    const dns_rrset_t *rrset = entry_rrset(entry);
+    return key_hash(name_hash(entry->name->data, entry->name->length), rrset->type, rrset->class);
+}
+
+/* A name rarely has more than a few RRsets cached, so its chain is searched linearly. */
+static cache_entry_t **chain_find(interned_t *const name, const uint16_t type, const uint16_t class) {
+    cache_entry_t **link = (cache_entry_t **)&name->value;
+    while (*link && (entry_rrset(*link)->type != type || entry_rrset(*link)->class != class))
+        link = &(*link)->next;
+    return link;
+}
+
+static inline void segment_push(cache_entry_t *entry, const cache_segment_t segment) {
+    list_insert_after(&segments[segment], &entry->lru);
+    entry->segment = segment;
+    ++segment_counts[segment];
+    return;
+}
+
+static inline void segment_pop(cache_entry_t *entry) {
+    list_remove(&entry->lru);
+    --segment_counts[entry->segment];
+    return;
+}
+
+static inline cache_entry_t *segment_tail(const cache_segment_t segment) {
+    return list_empty(&segments[segment]) ? NULL : segments[segment].prev->value;
+}
+
+static void entry_remove(cache_entry_t *entry) {
+    *chain_find(entry->name, entry_rrset(entry)->type, entry_rrset(entry)->class) = entry->next;
+    segment_pop(entry);
+    entry_account(entry, false);
+    entry_destroy(entry);
+    return;
+}
+
+void dns_cache_init(size_t item_limit, size_t memory_limit, bool admission) {
     limit = item_limit;
-    cache_trie = trie_create();
+    byte_limit = memory_limit;
+    names = intern_table_create(DNS_CACHE_INITIAL_COUNT);
+    sketch = admission ? frequency_sketch_create(DNS_CACHE_INITIAL_COUNT) : NULL;
+    curve = miss_ratio_curve_create(DNS_CACHE_CURVE_SAMPLES, DNS_CACHE_CURVE_WINDOW);
+    for (size_t i = 0; i < CACHE_SEGMENT_COUNT; ++i) {
+        list_init(&segments[i]);
+        segment_counts[i] = 0;
+    }
     item_count = 0;
+    entry_count = 0;
     return;
 }
 
-static inline void resource_record_forward_list_destroy(void *q) {
-    forward_list_destroy(q, resource_record_destroy);
+bool dns_cache_share(const char *const name, size_t size) {
+    shared = shared_cache_attach(name, size != (size_t)-1 ? size : DNS_CACHE_SHARED_SIZE);
+    return shared;
+}
+
+static inline size_t cache_bytes(void) {
+    return intern_table_size(names) + (sketch ? frequency_sketch_size(sketch) : 0) + entry_bytes_total;
+}
+
+static inline bool cache_over_limit(void) {
+    return item_count > limit || cache_bytes() > byte_limit;
+}
+
+static inline void cache_evict(cache_entry_t *entry) {
+    entry_remove(entry);
+    ++eviction_count;
+    return;
+}
+
+/* The main space gives up its probation entries first; the candidate itself is never its own victim. */
+static cache_entry_t *main_victim(const cache_entry_t *const candidate) {
+    cache_entry_t *victim = segment_tail(CACHE_SEGMENT_PROBATION);
+    if (victim == candidate)
+        victim = victim->lru.prev != &segments[CACHE_SEGMENT_PROBATION] ? victim->lru.prev->value : NULL;
+    return victim ? victim : segment_tail(CACHE_SEGMENT_PROTECTED);
+}
+
+/* Ties go to the victim, so a flood of names seen once cannot displace entries seen before; expired victims always lose. */
+static void cache_admit(cache_entry_t *candidate) {
+    unsigned frequency = frequency_sketch_estimate(sketch, entry_hash(candidate));
+    time_t now = relay_clock_now();
+    while (cache_over_limit()) {
+        cache_entry_t *victim = main_victim(candidate);
+        if (!victim)
+            return;
+        if (entry_rrset(victim)->ttl > now && frequency <= frequency_sketch_estimate(sketch, entry_hash(victim))) {
+            cache_evict(candidate);
+            ++rejection_count;
+            return;
+        }
+        cache_evict(victim);
+    }
     return;
 }
 
 static inline void cache_refresh() {
-    if (item_count >= limit) {
-        trie_destroy(cache_trie, resource_record_forward_list_destroy);
-        cache_trie = NULL;
-        cache_trie = trie_create();
+    if (sketch) {
+        size_t window_limit = entry_count * DNS_CACHE_WINDOW_PERCENT / 100;
+        while (segment_counts[CACHE_SEGMENT_WINDOW] > (window_limit ? window_limit : 1)) {
+            cache_entry_t *candidate = segment_tail(CACHE_SEGMENT_WINDOW);
+            segment_pop(candidate);
+            segment_push(candidate, CACHE_SEGMENT_PROBATION);
+            cache_admit(candidate);
+        }
+    }
+    static const cache_segment_t eviction_order[CACHE_SEGMENT_COUNT] = {CACHE_SEGMENT_PROBATION, CACHE_SEGMENT_PROTECTED, CACHE_SEGMENT_WINDOW};
+    for (size_t i = 0; i < CACHE_SEGMENT_COUNT; ++i)
+        for (cache_entry_t *entry; cache_over_limit() && (entry = segment_tail(eviction_order[i]));)
+            cache_evict(entry);
+    return;
+}
+
+static void cache_touch(cache_entry_t *entry) {
+    cache_segment_t segment = entry->segment == CACHE_SEGMENT_WINDOW ? CACHE_SEGMENT_WINDOW : CACHE_SEGMENT_PROTECTED;
+    segment_pop(entry);
+    segment_push(entry, segment);
+    size_t main_count = entry_count - segment_counts[CACHE_SEGMENT_WINDOW];
+    while (segment_counts[CACHE_SEGMENT_PROTECTED] > main_count * DNS_CACHE_PROTECTED_PERCENT / 100) {
+        cache_entry_t *demoted = segment_tail(CACHE_SEGMENT_PROTECTED);
+        segment_pop(demoted);
+        segment_push(demoted, CACHE_SEGMENT_PROBATION);
     }
     return;
 }
 
-void dns_cache_insert(const question_t *const question, const resource_record_t *const resource_record) {
-    ++item_count;
-    trie_node_t *tree_node_ptr = trie_insert(cache_trie, question->qname->name, question->qname->length);
-    tree_node_ptr->value = forward_list_node_create(tree_node_ptr->value);
-    resource_record_t *cached_resource_record = clone_resource_record((void *)resource_record);
-    cached_resource_record->ttl = cached_resource_record->ttl + time(NULL);
-    ((forward_list_node_t *)tree_node_ptr->value)->value = cached_resource_record;
+static cache_entry_t *cache_put(const uint8_t *const owner, const size_t owner_length, const dns_rrset_t *const rrset) {
+    interned_t *name = intern_table_acquire(names, owner, owner_length, name_hash(owner, owner_length));
+    cache_entry_t *entry = entry_create(name, rrset);
+    cache_entry_t **link = chain_find(name, rrset->type, rrset->class);
+    cache_entry_t *replaced = *link;
+    cache_segment_t segment = CACHE_SEGMENT_WINDOW;
+    if (replaced) {
+        *link = replaced->next;
+        segment = replaced->segment;
+        segment_pop(replaced);
+        entry_account(replaced, false);
+        entry_destroy(replaced);
+    }
+    entry->next = name->value;
+    name->value = entry;
+    segment_push(entry, segment);
+    entry_account(entry, true);
+    return entry;
+}
+
+/* Whether a name is uncompressed, of at most DNS_NAME_MAX_LENGTH bytes and ends exactly at its root label. */
+static bool name_valid(const uint8_t *const name, const size_t length) {
+    if (!length || length > DNS_NAME_MAX_LENGTH)
+        return false;
+    size_t position = 0;
+    while (position < length && name[position] && !(name[position] & 0xc0))
+        position += name[position] + 1;
+    return position + 1 == length && !name[position];
+}
+
+/* The target of a CNAME RRset holding a single record whose rdata is a valid name, or 0 for any other RRset. */
+static size_t cname_target(const dns_rrset_t *const rrset, uint8_t *const target) {
+    if (rrset->count != 1)
+        return 0;
+    const uint8_t *record = dns_rrset_records(rrset);
+    size_t length = dns_rrset_rd_length(record);
+    if (!name_valid(record + sizeof(uint16_t), length))
+        return 0;
+    ascii_to_lower(target, record + sizeof(uint16_t), length);
+    return length;
+}
+
+/*
+ * Records are grouped into RRsets by owner, type and class, and each RRset is cached under its owner,
+ * replacing the one cached before it under the same key and taking its segment. Only the RRsets of
+ * the question name and of the names it is aliased to by CNAME records in the same answer are kept,
+ * so an upstream cannot plant records for unrelated names.
+ */
+void dns_cache_insert(const question_t *const question, forward_list_t answers) {
+    if (!answers)
+        return;
+    dns_rrsets_t *rrsets = NULL;
+    time_t now = relay_clock_now();
+    for (forward_list_node_t *ptr = answers; ptr; ptr = ptr->next) {
+        const resource_record_t *resource_record = ptr->value;
+        name_field_t *owner = canonicalize_name_field(resource_record->name);
+        rrsets = dns_rrsets_append(rrsets, owner->name, owner->length, resource_record->type, resource_record->class, resource_record->ttl + now,
+                                   resource_record->rdata, resource_record->rd_length);
+        name_field_destroy(owner);
+    }
+
+    uint8_t targets[2][DNS_NAME_MAX_LENGTH];
+    const uint8_t *owner = question->canonical_qname->name;
+    size_t owner_length = question->canonical_qname->length;
+    for (size_t depth = 0; depth < DNS_CACHE_CHAIN_LIMIT; ++depth) {
+        const dns_rrset_t *alias = NULL;
+        for (size_t i = 0; i < rrsets->count; ++i) {
+            const dns_rrset_t *rrset = rrsets->items[i];
+            if (rrset->owner_length != owner_length || memcmp(dns_rrset_owner(rrset), owner, owner_length) != 0)
+                continue;
+            if (shared)
+                shared_cache_put(shared, rrset, key_hash(name_hash(owner, owner_length), rrset->type, rrset->class), now);
+            else
+                cache_put(owner, owner_length, rrset);
+            if (rrset->type == DNS_TYPE_CNAME && rrset->class == question->qclass && rrset->count == 1)
+                alias = rrset;
+        }
+        if (!alias || !(owner_length = cname_target(alias, targets[depth % 2])))
+            break;
+        owner = targets[depth % 2];
+    }
+    dns_rrsets_destroy(rrsets);
+    if (shared)
+        return;
+    if (sketch && entry_count > sketch->expected)
+        frequency_sketch_reserve(sketch, entry_count);
     cache_refresh();
     return;
 }
 
-forward_list_node_t *dns_cache_query(const question_t *const question) {
-    trie_node_t *tree_node_ptr = trie_find(cache_trie, question->qname->name, question->qname->length);
-    if (!tree_node_ptr || !tree_node_ptr->value)
-        return NULL;
-    forward_list_node_t *list_ptr = tree_node_ptr->value;
-    forward_list_node_t *result = NULL;
-    while (list_ptr) {
-        resource_record_t *resource_record = list_ptr->value;
-        if (resource_record->type == question->qtype && resource_record->class == question->qclass && resource_record->ttl > time(NULL)) {
-            result = forward_list_node_create(result);
-            resource_record_t *delivered_resource_record = clone_resource_record(resource_record);
-            delivered_resource_record->ttl = delivered_resource_record->ttl - time(NULL);
-            result->value = delivered_resource_record;
+/* An expired entry is removed when it is found. */
+static bool entry_live(cache_entry_t *entry, const time_t now) {
+    if (entry_rrset(entry)->ttl > now)
+        return true;
+    entry_remove(entry);
+    ++expiration_count;
+    return false;
+}
+
+/*
+ * The shared cache is answered the same way, with each RRset copied out of its slot. Names are
+ * compared by hash to detect a loop, so a collision only turns a hit into a miss. The segment is
+ * written by other processes, so a CNAME RRset that cname_target refuses is a miss as well.
+ */
+static size_t shared_answer(const question_t *const question, dns_response_t *const response) {
+    uint64_t buffer[SHARED_CACHE_RRSET_MAX_SIZE / sizeof(uint64_t)];
+    dns_rrset_t *rrset = (dns_rrset_t *)buffer;
+    uint8_t targets[2][DNS_NAME_MAX_LENGTH];
+    uint64_t visited[DNS_CACHE_CHAIN_LIMIT];
+    const uint8_t *name = question->canonical_qname->name;
+    size_t name_length = question->canonical_qname->length;
+    dns_response_t saved;
+    size_t count = 0;
+    time_t now = relay_clock_now();
+    for (size_t depth = 0; depth < DNS_CACHE_CHAIN_LIMIT; ++depth) {
+        uint64_t hash = name_hash(name, name_length);
+        for (size_t i = 0; i < depth; ++i)
+            if (visited[i] == hash)
+                goto miss;
+        visited[depth] = hash;
+        const uint8_t *owner = depth ? name : NULL;
+        size_t owner_length = depth ? name_length : 0;
+        if (shared_cache_get(shared, name, name_length, question->qtype, question->qclass, key_hash(hash, question->qtype, question->qclass), now, rrset))
+            return count + dns_response_add_records(response, rrset, owner, owner_length, now);
+        if (question->qtype == DNS_TYPE_CNAME ||
+            !shared_cache_get(shared, name, name_length, DNS_TYPE_CNAME, question->qclass, key_hash(hash, DNS_TYPE_CNAME, question->qclass), now, rrset))
+            break;
+        size_t target_length = cname_target(rrset, targets[depth % 2]);
+        if (!target_length)
+            break;
+        if (!count)
+            saved = *response;
+        if (!dns_response_add_records(response, rrset, owner, owner_length, now))
+            break;
+        ++count;
+        name_length = target_length;
+        name = targets[depth % 2];
+    }
+miss:
+    if (count)
+        *response = saved;
+    return 0;
+}
+
+/*
+ * Without an RRset of the question type, the answer follows the CNAME RRsets cached for the name
+ * and its aliases, writing each alias under its own owner, until a name has one. A chain that ends
+ * without one, revisits a name or is longer than DNS_CACHE_CHAIN_LIMIT is a miss, and the response
+ * is restored. As on insert, only a CNAME RRset of a single record is followed. The CNAME of a name
+ * is looked up before its other entry may expire, since removing that entry can free the name when
+ * it was its last one.
+ */
+size_t dns_cache_answer(const question_t *const question, dns_response_t *const response) {
+    const name_field_t *qname = question->canonical_qname;
+    uint64_t hash = name_hash(qname->name, qname->length);
+    uint64_t key = key_hash(hash, question->qtype, question->qclass);
+    miss_ratio_curve_access(curve, key);
+    if (shared)
+        return shared_answer(question, response);
+    if (sketch)
+        frequency_sketch_increment(sketch, key);
+    interned_t *name = intern_table_find(names, qname->name, qname->length, hash);
+    interned_t *visited[DNS_CACHE_CHAIN_LIMIT];
+    dns_response_t saved;
+    size_t count = 0;
+    time_t now = relay_clock_now();
+    for (size_t depth = 0; name && depth < DNS_CACHE_CHAIN_LIMIT; ++depth) {
+        for (size_t i = 0; i < depth; ++i)
+            if (visited[i] == name)
+                goto miss;
+        visited[depth] = name;
+        const uint8_t *owner = depth ? name->data : NULL;
+        size_t owner_length = depth ? name->length : 0;
+        cache_entry_t *entry = *chain_find(name, question->qtype, question->qclass);
+        cache_entry_t *alias = question->qtype != DNS_TYPE_CNAME ? *chain_find(name, DNS_TYPE_CNAME, question->qclass) : NULL;
+        if (entry && entry_live(entry, now)) {
+            cache_touch(entry);
+            return count + dns_response_add_records(response, entry_rrset(entry), owner, owner_length, now);
+        }
+        if (!alias || !entry_live(alias, now) || entry_rrset(alias)->count != 1)
+            break;
+        if (!count)
+            saved = *response;
+        cache_touch(alias);
+        if (!dns_response_add_records(response, entry_rrset(alias), owner, owner_length, now))
+            break;
+        ++count;
+        uint8_t target[DNS_NAME_MAX_LENGTH];
+        size_t target_length = cname_target(entry_rrset(alias), target);
+        if (!target_length)
+            break;
+        name = intern_table_find(names, target, target_length, name_hash(target, target_length));
+    }
+miss:
+    if (count)
+        *response = saved;
+    return 0;
+}
+
+static inline uint64_t snapshot_sketch_offset(const uint64_t entries_end) {
+    return (entries_end + FREQUENCY_SKETCH_BLOCK_SIZE - 1) / FREQUENCY_SKETCH_BLOCK_SIZE * FREQUENCY_SKETCH_BLOCK_SIZE;
+}
+
+static bool write_entry(FILE *file, const cache_entry_t *const entry) {
+    static const uint8_t padding[DNS_RRSET_ALIGNMENT];
+    dns_rrset_t header = *entry_rrset(entry);
+    header.owner_length = entry->name->length;
+    header.size += entry->name->length;
+    size_t padding_size = dns_rrset_size(&header) - sizeof(dns_rrset_t) - header.size;
+    return fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(entry->name->data, entry->name->length, 1, file) == 1 &&
+           (!entry_rrset(entry)->size || fwrite(entry_rrset(entry)->data, entry_rrset(entry)->size, 1, file) == 1) &&
+           (!padding_size || fwrite(padding, padding_size, 1, file) == 1);
+}
+
+/* The snapshot is written next to the file and renamed over it, so a crash never leaves a partial snapshot behind. */
+bool dns_cache_save(const char *const filename) {
+    if (shared)
+        return false;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    cache_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DNS_CACHE_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = DNS_CACHE_SNAPSHOT_VERSION;
+    header.entry_count = entry_count;
+    uint64_t entries_size = 0;
+    for (size_t i = 0; i < CACHE_SEGMENT_COUNT; ++i) {
+        header.segment_counts[i] = segment_counts[i];
+        for (list_node_t *node = segments[i].next; node != &segments[i]; node = node->next) {
+            const cache_entry_t *entry = node->value;
+            dns_rrset_t rrset = *entry_rrset(entry);
+            rrset.size += entry->name->length;
+            entries_size += dns_rrset_size(&rrset);
+        }
+    }
+    header.sketch_offset = snapshot_sketch_offset(sizeof(header) + entries_size);
+    header.sketch_block_count = sketch ? sketch->block_count : 0;
+    header.sketch_additions = sketch ? sketch->additions : 0;
+    header.file_size = header.sketch_offset + header.sketch_block_count * FREQUENCY_SKETCH_BLOCK_SIZE;
+
+    size_t temporary_length = strlen(filename) + 5;
+    char *temporary_filename = malloc(temporary_length);
+    assert(temporary_filename);
+    snprintf(temporary_filename, temporary_length, "%s.tmp", filename);
+    FILE *file = fopen(temporary_filename, "wb");
+    if (!file) {
+        logger_write(LOG_LEVEL_WARNING, "Failed when creating %s!", temporary_filename);
+        free(temporary_filename);
+        return false;
+    }
+    static const uint8_t padding[FREQUENCY_SKETCH_BLOCK_SIZE];
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; i < CACHE_SEGMENT_COUNT; ++i)
+        for (list_node_t *node = segments[i].prev; written && node != &segments[i]; node = node->prev)
+            written = write_entry(file, node->value);
+    size_t padding_size = header.sketch_offset - sizeof(header) - entries_size;
+    written = written && (!padding_size || fwrite(padding, padding_size, 1, file) == 1);
+    written = written && (!sketch || fwrite(sketch->blocks, sketch->block_count * FREQUENCY_SKETCH_BLOCK_SIZE, 1, file) == 1);
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary_filename, filename) != 0) {
+        logger_write(LOG_LEVEL_WARNING, "Failed when writing cache snapshot %s!", filename);
+        unlink(temporary_filename);
+        free(temporary_filename);
+        return false;
+    }
+    free(temporary_filename);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    logger_write(LOG_LEVEL_INFO, "Cache snapshot %s: %zu RRset(s), %" PRIu64 " byte(s), saved in %.3f s.", filename, entry_count, header.file_size,
+                 (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9);
+    return true;
+}
+
+/*
+ * Every entry goes back to the segment it was saved from, which is the window when admission is
+ * now off. The sketch is restored only when it keeps its size, since its counters are placed by it.
+ * Loading stops at the first entry whose owner is not a valid name or which is a CNAME RRset that
+ * could not be followed, as the answer path trusts both.
+ */
+static size_t load_entries(const uint8_t *const data, const cache_snapshot_header_t *const header, size_t *const expired) {
+    time_t now = relay_clock_now();
+    size_t offset = sizeof(cache_snapshot_header_t), restored = 0, index = 0;
+    for (size_t segment = 0; segment < CACHE_SEGMENT_COUNT; ++segment)
+        for (size_t i = 0; i < header->segment_counts[segment]; ++i, ++index) {
+            const dns_rrset_t *rrset = (const dns_rrset_t *)(data + offset);
+            uint8_t target[DNS_NAME_MAX_LENGTH];
+            if (!dns_rrset_valid(rrset, header->sketch_offset - offset) || !name_valid(dns_rrset_owner(rrset), rrset->owner_length) ||
+                (rrset->type == DNS_TYPE_CNAME && !cname_target(rrset, target)))
+                return restored;
+            offset += dns_rrset_size(rrset);
+            if (rrset->ttl <= now) {
+                ++*expired;
+                continue;
+            }
+            cache_entry_t *entry = cache_put(dns_rrset_owner(rrset), rrset->owner_length, rrset);
+            segment_pop(entry);
+            segment_push(entry, sketch ? segment : CACHE_SEGMENT_WINDOW);
+            ++restored;
+        }
+    return restored;
+}
+
+bool dns_cache_load(const char *const filename) {
+    if (shared)
+        return false;
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        logger_write(LOG_LEVEL_INFO, "No cache snapshot %s, starting cold.", filename);
+        return false;
+    }
+    struct stat file_stat;
+    const uint8_t *data = MAP_FAILED;
+    if (fstat(fd, &file_stat) == 0 && (size_t)file_stat.st_size >= sizeof(cache_snapshot_header_t))
+        data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        logger_write(LOG_LEVEL_WARNING, "Failed when mapping cache snapshot %s!", filename);
+        return false;
+    }
+    size_t size = file_stat.st_size;
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+    const cache_snapshot_header_t *header = (const cache_snapshot_header_t *)data;
+    uint64_t segment_total = 0;
+    for (size_t i = 0; i < CACHE_SEGMENT_COUNT; ++i)
+        segment_total += header->segment_counts[i];
+    if (memcmp(header->magic, DNS_CACHE_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != DNS_CACHE_SNAPSHOT_VERSION ||
+        header->file_size != size || segment_total != header->entry_count || header->sketch_offset < sizeof(cache_snapshot_header_t) ||
+        header->sketch_offset % FREQUENCY_SKETCH_BLOCK_SIZE || header->sketch_offset + header->sketch_block_count * FREQUENCY_SKETCH_BLOCK_SIZE != size) {
+        logger_write(LOG_LEVEL_WARNING, "Cache snapshot %s is corrupted or of another version, starting cold!", filename);
+        munmap((void *)data, size);
+        return false;
+    }
+    if (sketch && header->sketch_block_count) {
+        frequency_sketch_reserve(sketch, header->sketch_block_count * FREQUENCY_SKETCH_BLOCK_SIZE / sizeof(uint64_t));
+        if (sketch->block_count == header->sketch_block_count) {
+            memcpy(sketch->blocks, data + header->sketch_offset, header->sketch_block_count * FREQUENCY_SKETCH_BLOCK_SIZE);
+            sketch->additions = header->sketch_additions;
         }
-        list_ptr = list_ptr->next;
     }
-    return result;
+    size_t expired = 0;
+    size_t restored = load_entries(data, header, &expired);
+    size_t saved_count = header->entry_count;
+    munmap((void *)data, size);
+    if (restored + expired < saved_count)
+        logger_write(LOG_LEVEL_WARNING, "Cache snapshot %s is truncated after %zu RRset(s)!", filename, restored + expired);
+    if (sketch && entry_count > sketch->expected)
+        frequency_sketch_reserve(sketch, entry_count);
+    cache_refresh();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    logger_write(LOG_LEVEL_INFO, "Cache snapshot %s: %zu RRset(s) restored, %zu expired, loaded in %.3f s.", filename, restored, expired,
+                 (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9);
+    return true;
+}
+
+void dns_cache_report(FILE *stream) {
+    if (shared)
+        shared_cache_report(shared, stream);
+    fprintf(stream, "cache.entries=%zu\n", entry_count);
+    fprintf(stream, "cache.records=%zu\n", item_count);
+    fprintf(stream, "cache.evictions=%zu\n", eviction_count);
+    fprintf(stream, "cache.expirations=%zu\n", expiration_count);
+    fprintf(stream, "cache.rejections=%zu\n", rejection_count);
+    fprintf(stream, "cache.names=%zu\n", names->table->count);
+    fprintf(stream, "cache.bytes.names=%zu\n", intern_table_size(names));
+    fprintf(stream, "cache.bytes.sketch=%zu\n", sketch ? frequency_sketch_size(sketch) : 0);
+    for (size_t i = 0; i < CACHE_BYTES_COUNT; ++i)
+        fprintf(stream, "cache.bytes.%s=%zu\n", cache_bytes_names[i], entry_bytes[i]);
+    fprintf(stream, "cache.bytes.total=%zu\n", cache_bytes());
+    fprintf(stream, "cache.mrc.sample_rate=%.6f\n", miss_ratio_curve_sample_rate(curve));
+    fprintf(stream, "cache.mrc.bytes=%zu\n", miss_ratio_curve_size(curve));
+    fprintf(stream, "cache.mrc.entry_bytes=%zu\n", entry_count ? cache_bytes() / entry_count : 0);
+    for (size_t size = DNS_CACHE_CURVE_MIN_SIZE; size <= DNS_CACHE_CURVE_MAX_SIZE; size *= 2)
+        fprintf(stream, "cache.mrc.hit_ratio.%zu=%.4f\n", size, miss_ratio_curve_hit_ratio(curve, size));
+    return;
 }
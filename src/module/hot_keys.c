@@ -0,0 +1,125 @@
+#include "module/hot_keys.h"
+#include "data_structure/space_saving.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HOT_KEYS_NAME_SIZE 255
+#define HOT_KEYS_CAPACITY_FACTOR 32
+#define HOT_KEYS_WINDOW (1u << 20)
+#define HOT_KEYS_HASH_MULTIPLIER 0x9e3779b97f4a7c15u
+
+typedef enum hot_keys_kind {
+    HOT_KEYS_QNAME,
+    HOT_KEYS_CLIENT,
+    HOT_KEYS_MISS,
+    HOT_KEYS_KIND_COUNT,
+} hot_keys_kind_t;
+
+static const char *const kind_names[HOT_KEYS_KIND_COUNT] = {
+    [HOT_KEYS_QNAME] = "qname",
+    [HOT_KEYS_CLIENT] = "client",
+    [HOT_KEYS_MISS] = "miss",
+};
+
+static space_saving_t *summaries[HOT_KEYS_KIND_COUNT];
+static size_t top_count = 0;
+static uint32_t countdown = 0;
+static uint64_t random_state = HOT_KEYS_HASH_MULTIPLIER;
+static bool sampled = false;
+
+static inline uint64_t name_hash(const uint8_t *const name, const size_t length) {
+    uint64_t state = length;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, name + i, sizeof(word));
+        state = (state ^ word) * HOT_KEYS_HASH_MULTIPLIER;
+        state ^= state >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, name + i, length - i);
+    state = (state ^ tail) * HOT_KEYS_HASH_MULTIPLIER;
+    return state ^ (state >> 29);
+}
+
+/* The gaps between samples are uniform over [1, 2 * period - 1], so periodic traffic is not aliased. */
+static inline uint32_t next_gap(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return 1 + random_state % (2 * HOT_KEYS_SAMPLE_PERIOD - 1);
+}
+
+void hot_keys_init(size_t report_count) {
+    top_count = report_count;
+    if (!report_count)
+        return;
+    size_t capacity = report_count * HOT_KEYS_CAPACITY_FACTOR;
+    summaries[HOT_KEYS_QNAME] = space_saving_create(capacity, HOT_KEYS_NAME_SIZE, HOT_KEYS_WINDOW);
+    summaries[HOT_KEYS_CLIENT] = space_saving_create(capacity, sizeof(in_addr_t), HOT_KEYS_WINDOW);
+    summaries[HOT_KEYS_MISS] = space_saving_create(capacity, HOT_KEYS_NAME_SIZE, HOT_KEYS_WINDOW);
+    countdown = next_gap();
+    return;
+}
+
+void hot_keys_query(const question_t *const question, const struct sockaddr_in *const client_address) {
+    sampled = false;
+    if (!top_count || --countdown)
+        return;
+    countdown = next_gap();
+    sampled = true;
+    const name_field_t *name = question->canonical_qname;
+    space_saving_offer(summaries[HOT_KEYS_QNAME], name->name, name->length, name_hash(name->name, name->length), HOT_KEYS_SAMPLE_PERIOD);
+    in_addr_t address = client_address->sin_addr.s_addr;
+    space_saving_offer(summaries[HOT_KEYS_CLIENT], (const uint8_t *)&address, sizeof(address), (uint64_t)address * HOT_KEYS_HASH_MULTIPLIER >> 16,
+                       HOT_KEYS_SAMPLE_PERIOD);
+    return;
+}
+
+void hot_keys_miss(const question_t *const question) {
+    if (!sampled)
+        return;
+    const name_field_t *name = question->canonical_qname;
+    space_saving_offer(summaries[HOT_KEYS_MISS], name->name, name->length, name_hash(name->name, name->length), HOT_KEYS_SAMPLE_PERIOD);
+    return;
+}
+
+static void report_key(FILE *stream, const hot_keys_kind_t kind, const space_saving_t *summary, const space_saving_counter_t *counter) {
+    const uint8_t *key = space_saving_key(summary, counter);
+    if (kind == HOT_KEYS_CLIENT) {
+        char text[INET_ADDRSTRLEN];
+        fputs(inet_ntop(AF_INET, key, text, sizeof(text)), stream);
+        return;
+    }
+    name_field_t name = {counter->length, (uint8_t *)key};
+    char *text = get_name_from_name_field(&name);
+    fputs(text, stream);
+    free(text);
+    return;
+}
+
+void hot_keys_report(FILE *stream) {
+    if (!top_count)
+        return;
+    const space_saving_counter_t **top = malloc(sizeof(space_saving_counter_t *) * top_count);
+    assert(top);
+    size_t bytes = 0;
+    for (size_t kind = 0; kind < HOT_KEYS_KIND_COUNT; ++kind) {
+        const space_saving_t *summary = summaries[kind];
+        bytes += space_saving_size(summary);
+        size_t count = space_saving_top(summary, top, top_count);
+        for (size_t i = 0; i < count; ++i) {
+            fprintf(stream, "hot_keys.%s.%zu=", kind_names[kind], i + 1);
+            report_key(stream, kind, summary, top[i]);
+            fprintf(stream, " count=%" PRIu64 " error=%" PRIu64 "\n", top[i]->count, top[i]->error);
+        }
+    }
+    fprintf(stream, "hot_keys.bytes=%zu\n", bytes);
+    free(top);
+    return;
+}
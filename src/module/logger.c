@@ -2,6 +2,7 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -38,7 +39,20 @@ void logger_init(const char *const filename, const size_t debug_level, const boo
     return;
 }
 
+bool logger_enabled(const log_level level) {
+    assert(p_logger);
+    switch (level) {
+    case LOG_LEVEL_INFO:
+        return p_logger->debug_level >= 1;
+    case LOG_LEVEL_DEBUG:
+        return p_logger->debug_level >= 2;
+    default:
+        return true;
+    }
+}
+
 static char logger_buffer[1 << 20];
+static pthread_mutex_t logger_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 int logger_write(const log_level level, const char *const format, ...) {
     assert(p_logger);
@@ -66,11 +80,13 @@ int logger_write(const log_level level, const char *const format, ...) {
         abort();
     }
 
+    pthread_mutex_lock(&logger_mutex);
     time_t rawtime;
-    struct tm *timeinfo;
+    struct tm timeinfo;
+    char time_str[32];
     time(&rawtime);
-    timeinfo = localtime(&rawtime);
-    char *time_str = asctime(timeinfo);
+    localtime_r(&rawtime, &timeinfo);
+    asctime_r(&timeinfo, time_str);
     *(time_str + strlen(time_str) - 1) = '\0';
 
     char *ptr = logger_buffer;
@@ -92,6 +108,7 @@ int logger_write(const log_level level, const char *const format, ...) {
         fprintf(stderr, "%s", logger_buffer);
     if (level == LOG_LEVEL_ERROR || level == LOG_LEVEL_WARNING || p_logger->debug_level == 2)
         fflush(p_logger->log_file);
+    pthread_mutex_unlock(&logger_mutex);
     return result;
 }
 
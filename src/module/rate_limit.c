@@ -0,0 +1,130 @@
+#include "module/rate_limit.h"
+#include "module/relay_clock.h"
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <string.h>
+
+#define RATE_LIMIT_WAYS 4
+#define RATE_LIMIT_SET_COUNT 4096
+#define RATE_LIMIT_HASH_MULTIPLIER 0x9e3779b97f4a7c15u
+
+typedef struct rate_limit_entry {
+    uint64_t key;    /* 0 when the entry is empty. */
+    uint32_t second; /* The time the bucket was last refilled. */
+    uint32_t tokens;
+} rate_limit_entry_t;
+
+typedef struct rate_limit_table {
+    _Alignas(64) rate_limit_entry_t entries[RATE_LIMIT_SET_COUNT][RATE_LIMIT_WAYS];
+    uint32_t rate;
+    uint32_t burst;
+    size_t used;
+    size_t evictions;
+} rate_limit_table_t;
+
+static rate_limit_table_t clients;
+static rate_limit_table_t responses;
+static size_t slip_count = 0;
+
+static inline uint64_t mix(uint64_t state) {
+    state *= RATE_LIMIT_HASH_MULTIPLIER;
+    return state ^ (state >> 29);
+}
+
+static inline uint64_t name_hash(const uint8_t *const name, const size_t length) {
+    uint64_t state = length;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, name + i, sizeof(word));
+        state = mix(state ^ word);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, name + i, length - i);
+    return mix(state ^ tail);
+}
+
+/* A key missing from its set replaces the entry refilled longest ago, an empty one if any. */
+static bool take_token(rate_limit_table_t *table, const uint64_t key, const uint64_t hash) {
+    rate_limit_entry_t *set = table->entries[hash >> 52 & (RATE_LIMIT_SET_COUNT - 1)];
+    uint32_t now = relay_clock_now();
+    rate_limit_entry_t *entry = &set[0];
+    for (size_t way = 0; way < RATE_LIMIT_WAYS; ++way) {
+        if (set[way].key == key) {
+            entry = &set[way];
+            break;
+        }
+        if (set[way].second < entry->second)
+            entry = &set[way];
+    }
+    if (entry->key != key) {
+        if (!entry->key)
+            ++table->used;
+        else if (now - entry->second < RATE_LIMIT_BURST_SECONDS)
+            ++table->evictions;
+        entry->key = key;
+        entry->second = now;
+        entry->tokens = table->burst;
+    } else if (now != entry->second) {
+        uint32_t elapsed = now - entry->second;
+        entry->tokens = elapsed >= RATE_LIMIT_BURST_SECONDS || entry->tokens + elapsed * table->rate > table->burst ? table->burst
+                                                                                                                   : entry->tokens + elapsed * table->rate;
+        entry->second = now;
+    }
+    if (!entry->tokens)
+        return false;
+    --entry->tokens;
+    return true;
+}
+
+static void table_init(rate_limit_table_t *table, const uint32_t rate) {
+    memset(table->entries, 0, sizeof(table->entries));
+    table->rate = rate;
+    table->burst = rate * RATE_LIMIT_BURST_SECONDS;
+    table->used = 0;
+    table->evictions = 0;
+    return;
+}
+
+void rate_limit_init(uint32_t client_rate, uint32_t response_rate) {
+    table_init(&clients, client_rate);
+    table_init(&responses, response_rate);
+    slip_count = 0;
+    return;
+}
+
+bool rate_limit_client(const struct sockaddr_in *const client_address) {
+    if (!clients.rate)
+        return true;
+    uint64_t key = (uint64_t)1 << 32 | client_address->sin_addr.s_addr;
+    return take_token(&clients, key, mix(key));
+}
+
+/* NXDOMAIN responses are keyed by the parent of the question name, the closest thing to the zone at hand. */
+rate_limit_verdict_t rate_limit_response(const struct sockaddr_in *const client_address, const question_t *const question, const uint8_t rcode) {
+    if (!responses.rate)
+        return RATE_LIMIT_PASS;
+    const uint8_t *name = question->canonical_qname->name;
+    size_t length = question->canonical_qname->length;
+    if (rcode == 3 && (size_t)name[0] + 1 < length) {
+        length -= name[0] + 1;
+        name += name[0] + 1;
+    }
+    uint64_t network = client_address->sin_addr.s_addr & htonl(0xffffff00);
+    uint64_t hash = mix(name_hash(name, length) ^ network << 24 ^ (uint64_t)question->qtype << 8 ^ rcode);
+    if (take_token(&responses, hash | 1, hash))
+        return RATE_LIMIT_PASS;
+    return ++slip_count % RATE_LIMIT_SLIP_PERIOD ? RATE_LIMIT_DROP : RATE_LIMIT_SLIP;
+}
+
+void rate_limit_report(FILE *stream) {
+    fprintf(stream, "rate_limit.clients.rate=%" PRIu32 "\n", clients.rate);
+    fprintf(stream, "rate_limit.clients.entries=%zu\n", clients.used);
+    fprintf(stream, "rate_limit.clients.evictions=%zu\n", clients.evictions);
+    fprintf(stream, "rate_limit.responses.rate=%" PRIu32 "\n", responses.rate);
+    fprintf(stream, "rate_limit.responses.entries=%zu\n", responses.used);
+    fprintf(stream, "rate_limit.responses.evictions=%zu\n", responses.evictions);
+    fprintf(stream, "rate_limit.bytes=%zu\n", sizeof(clients.entries) + sizeof(responses.entries));
+    return;
+}
@@ -0,0 +1,18 @@
+#include "module/relay_clock.h"
+
+#include <stdbool.h>
+
+static bool simulated = false;
+static time_t simulated_now = 0;
+
+void relay_clock_simulate(time_t now) {
+    simulated = true;
+    simulated_now = now;
+    return;
+}
+
+time_t relay_clock_now(void) {
+    if (simulated)
+        return simulated_now;
+    return time(NULL);
+}
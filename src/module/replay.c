@@ -0,0 +1,369 @@
+#include "module/replay.h"
+#include "module/logger.h"
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define REPLAY_DUMP_MAGIC "DNSRPLY1"
+#define REPLAY_PENDING_LIMIT 64
+
+typedef struct recorded_message {
+    time_t time;
+    struct sockaddr_in address;
+    const uint8_t *data;
+    size_t length;
+    size_t key_length;
+    size_t order;
+    bool served;
+} recorded_message_t;
+
+typedef struct recorded_array {
+    recorded_message_t *items;
+    size_t count;
+    size_t capacity;
+} recorded_array_t;
+
+typedef struct pending_response {
+    uint8_t *data;
+    size_t length;
+    struct sockaddr_in address;
+} pending_response_t;
+
+static bool active = false;
+static const uint8_t *trace = NULL;
+static size_t trace_size = 0;
+
+static recorded_array_t queries = {NULL, 0, 0};
+static recorded_array_t responses = {NULL, 0, 0};
+static size_t next_query = 0;
+static time_t current_time = 0;
+
+static pending_response_t pending[REPLAY_PENDING_LIMIT];
+static size_t pending_head = 0;
+static size_t pending_count = 0;
+static uint8_t *returned_data = NULL;
+
+static size_t skipped_count = 0;
+static size_t upstream_answered_count = 0;
+static size_t upstream_missed_count = 0;
+static size_t pending_dropped_count = 0;
+static size_t delivered_count = 0;
+
+static inline uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t read_u32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint32_t read_u32_swapped(const uint8_t *p, bool swapped) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return swapped ? __builtin_bswap32(value) : value;
+}
+
+static inline bool is_response(const uint8_t *data) {
+    return data[2] & 0x80;
+}
+
+/* The key of a message is its single uncompressed question: the name followed by qtype and qclass. */
+static bool question_key_length(const uint8_t *data, size_t length, size_t *key_length) {
+    if (length < 12 || read_u16(data + 4) != 1)
+        return false;
+    size_t offset = 12;
+    while (offset < length && data[offset]) {
+        if (data[offset] & 0xc0)
+            return false;
+        offset += data[offset] + 1;
+    }
+    if (offset + 5 > length)
+        return false;
+    *key_length = offset + 5 - 12;
+    return true;
+}
+
+static int key_compare(const uint8_t *a, size_t a_length, const uint8_t *b, size_t b_length) {
+    size_t length = a_length < b_length ? a_length : b_length;
+    int result = memcmp(a, b, length);
+    if (result)
+        return result;
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+static int recorded_message_compare(const void *x, const void *y) {
+    const recorded_message_t *a = x;
+    const recorded_message_t *b = y;
+    int result = key_compare(a->data + 12, a->key_length, b->data + 12, b->key_length);
+    if (result)
+        return result;
+    return (a->order > b->order) - (a->order < b->order);
+}
+
+static void recorded_array_push(recorded_array_t *array, const recorded_message_t *message) {
+    if (array->count == array->capacity) {
+        array->capacity = array->capacity ? array->capacity * 2 : 1024;
+        array->items = realloc(array->items, sizeof(recorded_message_t) * array->capacity);
+        assert(array->items);
+    }
+    array->items[array->count++] = *message;
+    return;
+}
+
+static void record(uint64_t timestamp_us, uint32_t address, uint16_t port, const uint8_t *data, size_t length) {
+    recorded_message_t message;
+    if (!question_key_length(data, length, &message.key_length)) {
+        ++skipped_count;
+        return;
+    }
+    message.time = timestamp_us / 1000000;
+    memset(&message.address, 0, sizeof(message.address));
+    message.address.sin_family = AF_INET;
+    message.address.sin_addr.s_addr = htonl(address);
+    message.address.sin_port = htons(port);
+    message.data = data;
+    message.length = length;
+    message.served = false;
+    if (is_response(data)) {
+        message.order = responses.count;
+        recorded_array_push(&responses, &message);
+    } else {
+        message.order = queries.count;
+        recorded_array_push(&queries, &message);
+    }
+    return;
+}
+
+static void load_dump(void) {
+    size_t offset = strlen(REPLAY_DUMP_MAGIC);
+    while (offset + 16 <= trace_size) {
+        const uint8_t *p = trace + offset;
+        uint64_t timestamp_us = ((uint64_t)read_u32(p) << 32) | read_u32(p + 4);
+        uint32_t address = read_u32(p + 8);
+        uint16_t port = read_u16(p + 12);
+        uint16_t length = read_u16(p + 14);
+        if (offset + 16 + length > trace_size)
+            break;
+        record(timestamp_us, address, port, p + 16, length);
+        offset += 16 + length;
+    }
+    if (offset != trace_size)
+        logger_write(LOG_LEVEL_WARNING, "Replay trace is truncated at offset %zu.", offset);
+    return;
+}
+
+static void load_udp(uint64_t timestamp_us, const uint8_t *ip, size_t length) {
+    if (length < 20 || (ip[0] >> 4) != 4)
+        return;
+    size_t header_length = (ip[0] & 0x0f) * 4;
+    if (header_length < 20 || header_length + 8 > length || ip[9] != IPPROTO_UDP)
+        return;
+    if (read_u16(ip + 6) & 0x3fff) // fragments
+        return;
+    const uint8_t *udp = ip + header_length;
+    uint16_t source_port = read_u16(udp);
+    uint16_t destination_port = read_u16(udp + 2);
+    if (source_port != 53 && destination_port != 53)
+        return;
+    size_t udp_length = read_u16(udp + 4);
+    if (udp_length < 8 || header_length + udp_length > length)
+        return;
+    record(timestamp_us, read_u32(ip + 12), source_port, udp + 8, udp_length - 8);
+    return;
+}
+
+static void load_pcap(void) {
+    uint32_t magic;
+    memcpy(&magic, trace, sizeof(magic));
+    bool swapped = magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1;
+    bool nanosecond = magic == 0xa1b23c4d || magic == 0x4d3cb2a1;
+    uint32_t link_type = read_u32_swapped(trace + 20, swapped);
+
+    size_t offset = 24;
+    while (offset + 16 <= trace_size) {
+        const uint8_t *p = trace + offset;
+        uint64_t seconds = read_u32_swapped(p, swapped);
+        uint64_t fraction = read_u32_swapped(p + 4, swapped);
+        size_t captured = read_u32_swapped(p + 8, swapped);
+        if (offset + 16 + captured > trace_size)
+            break;
+        offset += 16 + captured;
+        uint64_t timestamp_us = seconds * 1000000 + (nanosecond ? fraction / 1000 : fraction);
+
+        const uint8_t *frame = p + 16;
+        size_t link_length;
+        uint16_t protocol = 0x0800;
+        switch (link_type) {
+        case 0: // BSD loopback
+            link_length = 4;
+            break;
+        case 1: // Ethernet
+            link_length = 14;
+            if (captured >= 18 && read_u16(frame + 12) == 0x8100)
+                link_length = 18;
+            if (captured >= link_length)
+                protocol = read_u16(frame + link_length - 2);
+            break;
+        case 101: // raw IP
+        case 228: // raw IPv4
+            link_length = 0;
+            break;
+        case 113: // Linux cooked capture
+            link_length = 16;
+            if (captured >= link_length)
+                protocol = read_u16(frame + 14);
+            break;
+        default:
+            logger_write(LOG_LEVEL_ERROR, "Unsupported pcap link type %" PRIu32 ".", link_type);
+            abort();
+        }
+        if (captured < link_length || protocol != 0x0800)
+            continue;
+        load_udp(timestamp_us, frame + link_length, captured - link_length);
+    }
+    if (offset != trace_size)
+        logger_write(LOG_LEVEL_WARNING, "Replay trace is truncated at offset %zu.", offset);
+    return;
+}
+
+void replay_load(const char *const filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        logger_write(LOG_LEVEL_ERROR, "Failed when opening replay trace %s!", filename);
+        abort();
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0 || file_stat.st_size < 24) {
+        logger_write(LOG_LEVEL_ERROR, "Replay trace %s is too short!", filename);
+        abort();
+    }
+    trace_size = file_stat.st_size;
+    trace = mmap(NULL, trace_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (trace == MAP_FAILED) {
+        logger_write(LOG_LEVEL_ERROR, "Failed when mapping replay trace %s!", filename);
+        abort();
+    }
+
+    uint32_t magic;
+    memcpy(&magic, trace, sizeof(magic));
+    if (memcmp(trace, REPLAY_DUMP_MAGIC, strlen(REPLAY_DUMP_MAGIC)) == 0)
+        load_dump();
+    else if (magic == 0xa1b2c3d4 || magic == 0xd4c3b2a1 || magic == 0xa1b23c4d || magic == 0x4d3cb2a1)
+        load_pcap();
+    else {
+        logger_write(LOG_LEVEL_ERROR, "Unknown replay trace format in %s!", filename);
+        abort();
+    }
+
+    qsort(responses.items, responses.count, sizeof(recorded_message_t), recorded_message_compare);
+    active = true;
+    logger_write(LOG_LEVEL_INFO, "Replay trace %s loaded: %zu queries, %zu responses, %zu skipped.", filename, queries.count, responses.count, skipped_count);
+    return;
+}
+
+bool replay_active(void) {
+    return active;
+}
+
+bool replay_next_query(replay_frame_t *const frame) {
+    if (next_query == queries.count)
+        return false;
+    const recorded_message_t *message = &queries.items[next_query++];
+    current_time = message->time;
+    frame->time = message->time;
+    frame->address = message->address;
+    frame->data = message->data;
+    frame->length = message->length;
+    return true;
+}
+
+bool replay_next_upstream(replay_frame_t *const frame) {
+    free(returned_data);
+    returned_data = NULL;
+    if (!pending_count)
+        return false;
+    pending_response_t *response = &pending[pending_head];
+    pending_head = (pending_head + 1) % REPLAY_PENDING_LIMIT;
+    --pending_count;
+    returned_data = response->data;
+    frame->time = current_time;
+    frame->address = response->address;
+    frame->data = response->data;
+    frame->length = response->length;
+    return true;
+}
+
+static recorded_message_t *find_response(const uint8_t *key, size_t key_length) {
+    size_t l = 0, r = responses.count;
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        if (key_compare(responses.items[m].data + 12, responses.items[m].key_length, key, key_length) < 0)
+            l = m + 1;
+        else
+            r = m;
+    }
+    recorded_message_t *found = NULL;
+    for (size_t i = l; i < responses.count; ++i) {
+        recorded_message_t *message = &responses.items[i];
+        if (key_compare(message->data + 12, message->key_length, key, key_length) != 0)
+            break;
+        found = message;
+        if (!message->served)
+            break;
+    }
+    return found;
+}
+
+void replay_transmit(const uint8_t *const buffer, const size_t length, const struct sockaddr_in *const address) {
+    assert(active);
+    if (length < 12)
+        return;
+    if (is_response(buffer)) {
+        ++delivered_count;
+        return;
+    }
+
+    size_t key_length;
+    recorded_message_t *response = NULL;
+    if (question_key_length(buffer, length, &key_length))
+        response = find_response(buffer + 12, key_length);
+    if (!response) {
+        ++upstream_missed_count;
+        return;
+    }
+    if (pending_count == REPLAY_PENDING_LIMIT) {
+        ++pending_dropped_count;
+        return;
+    }
+    response->served = true;
+    ++upstream_answered_count;
+
+    pending_response_t *p = &pending[(pending_head + pending_count) % REPLAY_PENDING_LIMIT];
+    ++pending_count;
+    p->data = malloc(response->length);
+    assert(p->data);
+    memcpy(p->data, response->data, response->length);
+    memcpy(p->data, buffer, sizeof(uint16_t)); // the relay matches upstream responses by id
+    p->length = response->length;
+    p->address = *address;
+    return;
+}
+
+void replay_report(FILE *stream) {
+    fprintf(stream, "replay.queries=%zu\n", queries.count);
+    fprintf(stream, "replay.recorded_responses=%zu\n", responses.count);
+    fprintf(stream, "replay.skipped=%zu\n", skipped_count);
+    fprintf(stream, "replay.upstream_answered=%zu\n", upstream_answered_count);
+    fprintf(stream, "replay.upstream_missed=%zu\n", upstream_missed_count);
+    fprintf(stream, "replay.upstream_dropped=%zu\n", pending_dropped_count);
+    fprintf(stream, "replay.delivered=%zu\n", delivered_count);
+    return;
+}
@@ -1,82 +1,971 @@
 #include "module/rule_table.h"
-#include "data_structure/forward_list.h"
+#include "data_structure/bloom_filter.h"
 #include "data_structure/trie.h"
 #include "module/logger.h"
+#include "network/dns_rrset.h"
 #include "network/dns_utility.h"
 #include "network/ipv4_utility.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-static const size_t rule_table_buffer_size = 1 << 20;
-static trie_t banned_name_trie = NULL;
-static trie_t configured_name_trie = NULL;
+#define RULE_TABLE_THREAD_LIMIT 16
+#define RULE_TABLE_CHUNK_MIN_SIZE (1 << 20)
+#define RULE_TABLE_NAME_MAX_LENGTH 253
+#define RULE_TABLE_IP_MAX_LENGTH 15
+#define RULE_TABLE_KEY_MAX_LENGTH (RULE_TABLE_NAME_MAX_LENGTH + 2)
+#define RULE_TABLE_LABEL_MAX_COUNT 128
+#define RULE_TABLE_FILTER_PROBE_COUNT 65536
 
-static inline void handle_banned_name(const char *const name) {
-    assert(banned_name_trie);
-    trie_insert(banned_name_trie, (trie_radix_t *)name, strlen(name));
+#define BANNED_HASH_BASIS 14695981039346656037u
+#define BANNED_HASH_PRIME 1099511628211u
+#define BANNED_HASH_WILDCARD 0x5bd1e995u
+#define BANNED_KEY_WILDCARD 0xff
+
+#define RULE_SNAPSHOT_MAGIC "DNSRULE1"
+#define RULE_SNAPSHOT_VERSION 5
+#define RULE_SNAPSHOT_BANNED 1
+#define RULE_SNAPSHOT_CONFIGURED 2
+
+typedef struct rule_snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint64_t entries_offset;
+    uint64_t names_offset;
+    uint64_t names_size;
+    uint64_t rrsets_offset;
+    uint64_t rrsets_size;
+    uint64_t file_size;
+} rule_snapshot_header_t;
+
+typedef struct rule_snapshot_entry {
+    uint32_t name_offset;
+    uint16_t name_length;
+    uint16_t flags;
+    uint32_t rrset_offset;
+    uint32_t rrset_count;
+} rule_snapshot_entry_t;
+
+_Static_assert(sizeof(rule_snapshot_header_t) == 64, "rule snapshot header must stay 64 bytes");
+_Static_assert(sizeof(rule_snapshot_entry_t) == 16, "rule snapshot entry must stay 16 bytes");
+
+typedef struct rule_table {
+    bloom_filter_t *banned_filter;
+    trie_t banned_name_trie;
+    trie_t configured_name_trie;
+    const uint8_t *snapshot;
+    size_t snapshot_size;
+    const rule_snapshot_header_t *snapshot_header;
+    const rule_snapshot_entry_t *snapshot_entries;
+    const uint8_t *snapshot_names;
+    const uint8_t *snapshot_rrsets;
+} rule_table_t;
+
+static _Atomic(rule_table_t *) active_table = NULL;
+static atomic_bool reader_active = false;
+static atomic_uint_fast64_t reader_generation = 0;
+static atomic_bool reloading = false;
+
+typedef struct rule {
+    const char *name;
+    in_addr_t address;
+    uint8_t name_length;
+    bool banned;
+} rule_t;
+
+typedef struct rule_array {
+    rule_t *items;
+    size_t count;
+    size_t capacity;
+} rule_array_t;
+
+typedef struct load_chunk {
+    const char *begin;
+    const char *end;
+    size_t partition_count;
+    rule_array_t partitions[RULE_TABLE_THREAD_LIMIT];
+    size_t line_count;
+    size_t invalid_count;
+    size_t banned_count;
+} load_chunk_t;
+
+typedef struct load_partition {
+    rule_table_t *table;
+    load_chunk_t *chunks;
+    size_t chunk_count;
+    size_t partition;
+} load_partition_t;
+
+static atomic_size_t parsed_bytes;
+static atomic_size_t inserted_rules;
+static atomic_size_t finished_threads;
+
+static inline double elapsed_seconds(const struct timespec *begin) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - begin->tv_sec) + (now.tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+static inline size_t last_label(const char *const name, const size_t end) {
+    size_t begin = end;
+    while (begin > 0 && name[begin - 1] != '.')
+        --begin;
+    return begin;
+}
+
+/*
+ * Banned names are keyed by their lowercase wire-format labels in reverse order, so that "ads.example.com"
+ * becomes "\3com\7example\3ads" and every ancestor of a name is a prefix of its key.
+ * A wildcard "*.example.com" becomes "\3com\7example" followed by BANNED_KEY_WILDCARD,
+ * which is never a label length and matches the subdomains only.
+ */
+static size_t banned_key(const char *name, size_t length, uint8_t *key) {
+    bool wildcard = length >= 1 && name[0] == '*' && (length == 1 || name[1] == '.');
+    if (wildcard) {
+        size_t skip = length == 1 ? 1 : 2;
+        name += skip;
+        length -= skip;
+    }
+    size_t key_length = 0;
+    size_t end = length;
+    while (end > 0) {
+        size_t begin = last_label(name, end);
+        key[key_length++] = end - begin;
+        ascii_to_lower(key + key_length, (const uint8_t *)name + begin, end - begin);
+        key_length += end - begin;
+        end = begin ? begin - 1 : 0;
+    }
+    if (wildcard)
+        key[key_length++] = BANNED_KEY_WILDCARD;
+    return key_length;
+}
+
+static inline size_t banned_key_prefix_length(const uint8_t *const key, const size_t key_length) {
+    if (key_length == 0 || key[0] == BANNED_KEY_WILDCARD)
+        return key_length;
+    return (size_t)key[0] + 1 < key_length ? (size_t)key[0] + 1 : key_length;
+}
+
+/*
+ * Configured names are keyed by their lowercase wire format. The key prefix of a name is its first label
+ * with the length byte, followed by the byte after it: the length of the second label, or the terminator.
+ */
+static size_t configured_key_prefix(const char *name, size_t length, uint8_t *key) {
+    size_t first = 0;
+    while (first < length && name[first] != '.')
+        ++first;
+    key[0] = first;
+    ascii_to_lower(key + 1, (const uint8_t *)name, first);
+    size_t second = first < length ? first + 1 : length;
+    while (second < length && name[second] != '.')
+        ++second;
+    key[first + 1] = first < length ? second - first - 1 : 0;
+    return first + 2;
+}
+
+/* Collect the offsets of the labels of a wire-format name, the root excluded. */
+static inline size_t name_labels(const name_field_t *const name, size_t *labels) {
+    size_t count = 0;
+    for (size_t i = 0; i < name->length && name->name[i]; i += name->name[i] + 1) {
+        if (count == RULE_TABLE_LABEL_MAX_COUNT || i + name->name[i] + 1 > name->length)
+            return count;
+        labels[count++] = i;
+    }
+    return count;
+}
+
+static inline uint64_t banned_hash_update(uint64_t state, const uint8_t *const bytes, const size_t length) {
+    for (size_t i = 0; i < length; ++i)
+        state = (state ^ bytes[i]) * BANNED_HASH_PRIME;
+    return state;
+}
+
+static inline uint64_t banned_hash_finish(uint64_t state) {
+    state = (state ^ (state >> 33)) * 0xff51afd7ed558ccdu;
+    state = (state ^ (state >> 33)) * 0xc4ceb9fe1a85ec53u;
+    return state ^ (state >> 33);
+}
+
+/*
+ * The filter hashes a key prefix incrementally, one label at a time. A wildcard only flips
+ * the low 32 bits of the hash of its parent, so it lands in the same filter block.
+ */
+static inline uint64_t banned_key_hash(const uint8_t *const key, const size_t key_length) {
+    bool wildcard = key_length && key[key_length - 1] == BANNED_KEY_WILDCARD;
+    uint64_t hash = banned_hash_finish(banned_hash_update(BANNED_HASH_BASIS, key, key_length - wildcard));
+    return wildcard ? hash ^ BANNED_HASH_WILDCARD : hash;
+}
+
+static inline void handle_banned_name(rule_table_t *table, const char *const name, const size_t length) {
+    assert(table->banned_name_trie);
+    uint8_t key[RULE_TABLE_KEY_MAX_LENGTH];
+    size_t key_length = banned_key(name, length, key);
+    trie_insert(table->banned_name_trie, key, key_length);
+    bloom_filter_add(table->banned_filter, banned_key_hash(key, key_length));
+    return;
+}
+
+static bool banned_filter_match(const bloom_filter_t *filter, const uint8_t *const name, const size_t *const labels, const size_t label_count) {
+    uint64_t state = BANNED_HASH_BASIS;
+    for (size_t i = label_count; i-- > 0;) {
+        if (bloom_filter_contains(filter, banned_hash_finish(state) ^ BANNED_HASH_WILDCARD))
+            return true;
+        const uint8_t *label = name + labels[i];
+        state = banned_hash_update(state, label, (size_t)label[0] + 1);
+        if (bloom_filter_contains(filter, banned_hash_finish(state)))
+            return true;
+    }
+    return false;
+}
+
+static void report_banned_filter(const rule_table_t *table, const char *const filename) {
+    const bloom_filter_t *filter = table->banned_filter;
+    double rate = bloom_filter_false_positive_rate(filter, RULE_TABLE_FILTER_PROBE_COUNT) * 100;
+    if (filter->owned)
+        logger_write(LOG_LEVEL_INFO, "Rule table %s: banned name filter uses %zu byte(s) for %zu name(s), false-positive rate %.4f%% per label.",
+                     filename, bloom_filter_size(filter), filter->key_count, rate);
+    else
+        logger_write(LOG_LEVEL_INFO, "Rule table %s: banned name filter uses %zu byte(s), false-positive rate %.4f%% per label.",
+                     filename, bloom_filter_size(filter), rate);
     return;
 }
 
-static inline void handle_configured_name(const char *const ipv4, const char *const name) {
-    in_addr_t address = get_ipv4_from_string(ipv4);
-    name_field_t *name_field = name_field_create(name, strlen(name));
-    resource_record_t *record = malloc(sizeof(resource_record_t));
-    record->name = name_field;
-    record->type = 1;  // A
-    record->class = 1; // IN
-    record->ttl = 0;
-    record->rd_length = sizeof(in_addr_t);
-    record->rdata = malloc(record->rd_length);
-    memcpy(record->rdata, &address, sizeof(in_addr_t));
+/* Walk the key of a name top-down and stop at the first banned ancestor. */
+static bool banned_name_trie_match(const trie_t root, const uint8_t *const name, const size_t *const labels, const size_t label_count) {
+    trie_node_t *p = root;
+    for (size_t i = label_count; i-- > 0;) {
+        trie_node_t *wildcard = p->ch[BANNED_KEY_WILDCARD];
+        if (wildcard && wildcard->count)
+            return true;
+        const uint8_t *label = name + labels[i];
+        if (!(p = trie_find(p, label, (size_t)label[0] + 1)))
+            return false;
+        if (p->count)
+            return true;
+    }
+    return false;
+}
 
-    trie_node_t *p = trie_insert(configured_name_trie, (trie_radix_t *)name, strlen(name));
-    p->value = forward_list_node_create(p->value);
-    ((forward_list_node_t *)p->value)->value = record;
+static inline void handle_configured_name(rule_table_t *table, const in_addr_t address, const char *const name, const size_t length) {
+    name_field_t *name_field = name_field_create(name, length);
+    ascii_to_lower(name_field->name, name_field->name, name_field->length);
+    trie_node_t *p = trie_insert(table->configured_name_trie, name_field->name, name_field->length);
+    p->value = dns_rrsets_append(p->value, NULL, 0, 1, 1, 0, (const uint8_t *)&address, sizeof(in_addr_t)); // A, IN
+    name_field_destroy(name_field);
     return;
 }
 
-static inline void handle(const char *const ip, const char *const name) {
-    if (strcmp(ip, banned_ip) == 0)
-        handle_banned_name(name);
+static inline void handle(rule_table_t *table, const rule_t *const rule) {
+    if (rule->banned)
+        handle_banned_name(table, rule->name, rule->name_length);
     else
-        handle_configured_name(ip, name);
+        handle_configured_name(table, rule->address, rule->name, rule->name_length);
+    return;
+}
+
+static inline bool is_blank(const char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool next_token(const char **ptr, const char *const end, const char **token, size_t *length) {
+    const char *p = *ptr;
+    while (p < end && is_blank(*p))
+        ++p;
+    if (p == end || *p == '#') {
+        *ptr = end;
+        return false;
+    }
+    *token = p;
+    while (p < end && !is_blank(*p) && *p != '#')
+        ++p;
+    *length = p - *token;
+    *ptr = p;
+    return true;
+}
+
+static void rule_array_push(rule_array_t *array, const rule_t *const rule) {
+    if (array->count == array->capacity) {
+        array->capacity = array->capacity ? array->capacity * 2 : 1024;
+        array->items = realloc(array->items, sizeof(rule_t) * array->capacity);
+        assert(array->items);
+    }
+    array->items[array->count++] = *rule;
+    return;
+}
+
+/* Each line is "<ip> <name> [<name>...]", anything after '#' is a comment. */
+static void parse_line(load_chunk_t *chunk, const char *ptr, const char *const end) {
+    const char *ip;
+    size_t ip_length;
+    if (!next_token(&ptr, end, &ip, &ip_length))
+        return;
+    char ip_buffer[RULE_TABLE_IP_MAX_LENGTH + 1];
+    if (ip_length > RULE_TABLE_IP_MAX_LENGTH) {
+        ++chunk->invalid_count;
+        return;
+    }
+    memcpy(ip_buffer, ip, ip_length);
+    ip_buffer[ip_length] = '\0';
+
+    rule_t rule;
+    rule.banned = strcmp(ip_buffer, banned_ip) == 0;
+    rule.address = get_ipv4_from_string(ip_buffer);
+    if (!rule.banned && rule.address == INADDR_NONE) {
+        ++chunk->invalid_count;
+        return;
+    }
+
+    const char *name;
+    size_t name_length;
+    while (next_token(&ptr, end, &name, &name_length)) {
+        if (name_length > RULE_TABLE_NAME_MAX_LENGTH) {
+            ++chunk->invalid_count;
+            continue;
+        }
+        if (name_length > 1 && name[name_length - 1] == '.')
+            --name_length;
+        rule.name = name;
+        rule.name_length = name_length;
+        uint8_t key[RULE_TABLE_KEY_MAX_LENGTH];
+        size_t key_length, prefix_length;
+        if (rule.banned) {
+            ++chunk->banned_count;
+            key_length = banned_key(name, name_length, key);
+            prefix_length = banned_key_prefix_length(key, key_length) + 1;
+        } else
+            prefix_length = key_length = configured_key_prefix(name, name_length, key);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < prefix_length; ++i)
+            hash = (hash ^ (i < key_length ? key[i] : 0)) * 16777619u;
+        rule_array_push(&chunk->partitions[hash % chunk->partition_count], &rule);
+    }
+    return;
+}
+
+static void *parse_chunk(void *arg) {
+    load_chunk_t *chunk = arg;
+    const char *ptr = chunk->begin;
+    const char *reported = ptr;
+    while (ptr < chunk->end) {
+        const char *line_end = memchr(ptr, '\n', chunk->end - ptr);
+        if (!line_end)
+            line_end = chunk->end;
+        parse_line(chunk, ptr, line_end);
+        ++chunk->line_count;
+        ptr = line_end + 1;
+        if (ptr - reported >= RULE_TABLE_CHUNK_MIN_SIZE) {
+            atomic_fetch_add(&parsed_bytes, ptr - reported);
+            reported = ptr;
+        }
+    }
+    if (chunk->end > reported)
+        atomic_fetch_add(&parsed_bytes, chunk->end - reported);
+    atomic_fetch_add(&finished_threads, 1);
+    return NULL;
+}
+
+/*
+ * Rules are partitioned by the first label of their key and the byte after it, so every partition owns
+ * whole subtrees below that label. The first label paths are shared between partitions, so they are
+ * created before the partitions are inserted concurrently without locking.
+ */
+static void *insert_partition(void *arg) {
+    load_partition_t *job = arg;
+    size_t count = 0;
+    for (size_t c = 0; c < job->chunk_count; ++c) {
+        rule_array_t *array = &job->chunks[c].partitions[job->partition];
+        for (size_t i = 0; i < array->count; ++i) {
+            handle(job->table, &array->items[i]);
+            if (++count % 65536 == 0)
+                atomic_fetch_add(&inserted_rules, 65536);
+        }
+        free(array->items);
+        array->items = NULL;
+    }
+    atomic_fetch_add(&inserted_rules, count % 65536);
+    atomic_fetch_add(&finished_threads, 1);
+    return NULL;
+}
+
+static void run_threads(void *(*routine)(void *), void *args, size_t arg_size, size_t count, const char *const phase, atomic_size_t *progress, size_t total) {
+    pthread_t threads[RULE_TABLE_THREAD_LIMIT];
+    atomic_store(&finished_threads, 0);
+    for (size_t i = 1; i < count; ++i)
+        if (pthread_create(&threads[i], NULL, routine, (char *)args + i * arg_size) != 0) {
+            logger_write(LOG_LEVEL_ERROR, "Failed when creating rule table loader thread!");
+            abort();
+        }
+    routine(args);
+    struct timespec reported;
+    clock_gettime(CLOCK_MONOTONIC, &reported);
+    while (atomic_load(&finished_threads) < count) {
+        struct timespec interval = {0, 10000000};
+        nanosleep(&interval, NULL);
+        if (elapsed_seconds(&reported) >= 1) {
+            logger_write(LOG_LEVEL_INFO, "Rule table %s: %zu / %zu.", phase, atomic_load(progress), total);
+            clock_gettime(CLOCK_MONOTONIC, &reported);
+        }
+    }
+    for (size_t i = 1; i < count; ++i)
+        pthread_join(threads[i], NULL);
+    return;
+}
+
+static size_t loader_thread_count(const size_t size) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t count = cpus > 0 ? (size_t)cpus : 1;
+    if (count > RULE_TABLE_THREAD_LIMIT)
+        count = RULE_TABLE_THREAD_LIMIT;
+    if (count > size / RULE_TABLE_CHUNK_MIN_SIZE + 1)
+        count = size / RULE_TABLE_CHUNK_MIN_SIZE + 1;
+    return count;
+}
+
+typedef struct parsed_hosts {
+    const char *data;
+    size_t size;
+    load_chunk_t *chunks;
+    size_t chunk_count;
+    size_t rule_count;
+    size_t banned_count;
+} parsed_hosts_t;
+
+static bool map_file(const char *const filename, const uint8_t **data, size_t *size) {
+    *data = NULL;
+    *size = 0;
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        logger_write(LOG_LEVEL_WARNING, "Failed when opening %s!", filename);
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) < 0) {
+        logger_write(LOG_LEVEL_WARNING, "Failed when reading %s!", filename);
+        close(fd);
+        return false;
+    }
+    *size = file_stat.st_size;
+    if (*size == 0) {
+        close(fd);
+        return true;
+    }
+    *data = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (*data == MAP_FAILED) {
+        logger_write(LOG_LEVEL_WARNING, "Failed when mapping %s!", filename);
+        *data = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void parse_hosts_file(const char *const filename, const uint8_t *data, size_t size, parsed_hosts_t *parsed, const struct timespec *begin) {
+    parsed->data = (const char *)data;
+    parsed->size = size;
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+
+    size_t thread_count = loader_thread_count(size);
+    load_chunk_t *chunks = calloc(thread_count, sizeof(load_chunk_t));
+    assert(chunks);
+    const char *ptr = parsed->data;
+    const char *const end = parsed->data + size;
+    for (size_t i = 0; i < thread_count; ++i) {
+        chunks[i].begin = ptr;
+        if (i + 1 == thread_count)
+            ptr = end;
+        else {
+            ptr = parsed->data + size / thread_count * (i + 1);
+            if (ptr < chunks[i].begin)
+                ptr = chunks[i].begin;
+            const char *line_end = memchr(ptr, '\n', end - ptr);
+            ptr = line_end ? line_end + 1 : end;
+        }
+        chunks[i].end = ptr;
+        chunks[i].partition_count = thread_count;
+    }
+
+    atomic_store(&parsed_bytes, 0);
+    run_threads(parse_chunk, chunks, sizeof(load_chunk_t), thread_count, "parsing", &parsed_bytes, size);
+
+    size_t line_count = 0, invalid_count = 0, rule_count = 0, banned_count = 0;
+    for (size_t i = 0; i < thread_count; ++i) {
+        line_count += chunks[i].line_count;
+        invalid_count += chunks[i].invalid_count;
+        banned_count += chunks[i].banned_count;
+        for (size_t j = 0; j < thread_count; ++j)
+            rule_count += chunks[i].partitions[j].count;
+    }
+    parsed->chunks = chunks;
+    parsed->chunk_count = thread_count;
+    parsed->rule_count = rule_count;
+    parsed->banned_count = banned_count;
+    logger_write(LOG_LEVEL_INFO, "Rule table %s: parsed %zu line(s), %zu rule(s), %zu invalid, in %.3f s with %zu thread(s).", filename, line_count, rule_count, invalid_count, elapsed_seconds(begin), thread_count);
+    return;
+}
+
+static void parsed_hosts_release(parsed_hosts_t *parsed) {
+    for (size_t i = 0; i < parsed->chunk_count; ++i)
+        for (size_t j = 0; j < parsed->chunk_count; ++j)
+            free(parsed->chunks[i].partitions[j].items);
+    free(parsed->chunks);
+    parsed->chunks = NULL;
+    munmap((void *)parsed->data, parsed->size);
+    parsed->data = NULL;
+    return;
+}
+
+static void load_hosts_file(rule_table_t *table, const char *const filename, const uint8_t *data, size_t size, const struct timespec *begin) {
+    parsed_hosts_t parsed;
+    parse_hosts_file(filename, data, size, &parsed, begin);
+    double parse_seconds = elapsed_seconds(begin);
+    table->banned_filter = bloom_filter_create(parsed.banned_count);
+
+    if (parsed.chunk_count > 1)
+        for (size_t c = 0; c < parsed.chunk_count; ++c)
+            for (size_t p = 0; p < parsed.chunk_count; ++p) {
+                rule_array_t *array = &parsed.chunks[c].partitions[p];
+                for (size_t i = 0; i < array->count; ++i) {
+                    uint8_t key[RULE_TABLE_KEY_MAX_LENGTH];
+                    if (array->items[i].banned) {
+                        size_t key_length = banned_key(array->items[i].name, array->items[i].name_length, key);
+                        trie_reserve(table->banned_name_trie, key, banned_key_prefix_length(key, key_length));
+                    } else
+                        trie_reserve(table->configured_name_trie, key, configured_key_prefix(array->items[i].name, array->items[i].name_length, key) - 1);
+                }
+            }
+
+    load_partition_t *partitions = malloc(sizeof(load_partition_t) * parsed.chunk_count);
+    assert(partitions);
+    for (size_t i = 0; i < parsed.chunk_count; ++i) {
+        partitions[i].table = table;
+        partitions[i].chunks = parsed.chunks;
+        partitions[i].chunk_count = parsed.chunk_count;
+        partitions[i].partition = i;
+    }
+    atomic_store(&inserted_rules, 0);
+    run_threads(insert_partition, partitions, sizeof(load_partition_t), parsed.chunk_count, "inserting", &inserted_rules, parsed.rule_count);
+    free(partitions);
+    parsed_hosts_release(&parsed);
+
+    logger_write(LOG_LEVEL_INFO, "Rule table %s: loaded in %.3f s (parse %.3f s, insert %.3f s).", filename, elapsed_seconds(begin), parse_seconds, elapsed_seconds(begin) - parse_seconds);
+    report_banned_filter(table, filename);
+    return;
+}
+
+/* Snapshot. */
+
+static inline int name_compare(const uint8_t *a, size_t a_length, const uint8_t *b, size_t b_length) {
+    size_t length = a_length < b_length ? a_length : b_length;
+    int result = memcmp(a, b, length);
+    if (result)
+        return result;
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+static inline bool is_snapshot(const uint8_t *data, size_t size) {
+    return size >= sizeof(rule_snapshot_header_t) && memcmp(data, RULE_SNAPSHOT_MAGIC, strlen(RULE_SNAPSHOT_MAGIC)) == 0;
+}
+
+/* The RRsets follow the names, aligned for their fields. */
+static inline uint64_t snapshot_rrsets_offset(const uint64_t names_end) {
+    return (names_end + DNS_RRSET_ALIGNMENT - 1) / DNS_RRSET_ALIGNMENT * DNS_RRSET_ALIGNMENT;
+}
+
+/* The banned name filter follows the RRsets, aligned to a filter block. */
+static inline uint64_t snapshot_filter_offset(const rule_snapshot_header_t *header) {
+    return (header->rrsets_offset + header->rrsets_size + BLOOM_FILTER_BLOCK_SIZE - 1) / BLOOM_FILTER_BLOCK_SIZE * BLOOM_FILTER_BLOCK_SIZE;
+}
+
+static bool load_snapshot(rule_table_t *table, const char *const filename, const uint8_t *data, size_t size) {
+    const rule_snapshot_header_t *header = (const rule_snapshot_header_t *)data;
+    if (header->version != RULE_SNAPSHOT_VERSION) {
+        logger_write(LOG_LEVEL_WARNING, "Rule snapshot %s has version %" PRIu32 " instead of %d, recompile it!", filename, header->version, RULE_SNAPSHOT_VERSION);
+        return false;
+    }
+    if (header->file_size != size ||
+        header->entries_offset + (uint64_t)header->entry_count * sizeof(rule_snapshot_entry_t) > size ||
+        header->names_offset + header->names_size > size ||
+        header->rrsets_offset % DNS_RRSET_ALIGNMENT || header->rrsets_offset + header->rrsets_size > size ||
+        snapshot_filter_offset(header) > size || (size - snapshot_filter_offset(header)) % BLOOM_FILTER_BLOCK_SIZE) {
+        logger_write(LOG_LEVEL_WARNING, "Rule snapshot %s is corrupted!", filename);
+        return false;
+    }
+    table->snapshot = data;
+    table->snapshot_size = size;
+    table->snapshot_header = header;
+    table->snapshot_entries = (const rule_snapshot_entry_t *)(data + header->entries_offset);
+    table->snapshot_names = data + header->names_offset;
+    table->snapshot_rrsets = data + header->rrsets_offset;
+    if (snapshot_filter_offset(header) < size)
+        table->banned_filter = bloom_filter_wrap(data + snapshot_filter_offset(header), size - snapshot_filter_offset(header));
+    madvise((void *)data, size, MADV_RANDOM);
+    return true;
+}
+
+static const rule_snapshot_entry_t *snapshot_find(const rule_table_t *table, const uint8_t *const name, const size_t length) {
+    size_t l = 0, r = table->snapshot_header->entry_count;
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        const rule_snapshot_entry_t *entry = &table->snapshot_entries[m];
+        if (entry->name_offset + entry->name_length > table->snapshot_header->names_size)
+            return NULL;
+        int result = name_compare(table->snapshot_names + entry->name_offset, entry->name_length, name, length);
+        if (result == 0)
+            return entry;
+        if (result < 0)
+            l = m + 1;
+        else
+            r = m;
+    }
+    return NULL;
+}
+
+/*
+ * Every ancestor of a wire-format name is a tail of it, so the name, each ancestor and the
+ * wildcard "\1*" in front of each proper ancestor, the root included, are looked up in turn.
+ */
+static bool snapshot_banned_match(const rule_table_t *table, const name_field_t *const name) {
+    uint8_t wildcard[RULE_TABLE_KEY_MAX_LENGTH + 2] = {1, '*'};
+    for (size_t begin = 0; begin < name->length; begin += name->name[begin] + 1) {
+        const uint8_t *suffix = name->name + begin;
+        size_t suffix_length = name->length - begin;
+        const rule_snapshot_entry_t *entry = snapshot_find(table, suffix, suffix_length);
+        if (entry && (entry->flags & RULE_SNAPSHOT_BANNED))
+            return true;
+        if (begin > 0 && suffix_length + 2 <= sizeof(wildcard)) {
+            memcpy(wildcard + 2, suffix, suffix_length);
+            entry = snapshot_find(table, wildcard, suffix_length + 2);
+            if (entry && (entry->flags & RULE_SNAPSHOT_BANNED))
+                return true;
+        }
+        if (!suffix[0])
+            break;
+    }
+    return false;
+}
+
+/* RRsets are used where they are mapped; each is checked to lie within its section first. */
+static const dns_rrset_t *snapshot_find_rrset(const rule_table_t *table, const rule_snapshot_entry_t *entry, const uint16_t type, const uint16_t class) {
+    size_t offset = entry->rrset_offset;
+    for (size_t i = 0; i < entry->rrset_count; ++i) {
+        if (offset > table->snapshot_header->rrsets_size || !dns_rrset_valid(table->snapshot_rrsets + offset, table->snapshot_header->rrsets_size - offset))
+            return NULL;
+        const dns_rrset_t *rrset = (const dns_rrset_t *)(table->snapshot_rrsets + offset);
+        if (rrset->type == type && rrset->class == class)
+            return rrset;
+        offset += dns_rrset_size(rrset);
+    }
+    return NULL;
+}
+
+typedef struct sorted_rule {
+    const rule_t *rule;
+    const uint8_t *name;
+    size_t name_length;
+    size_t order;
+} sorted_rule_t;
+
+static int sorted_rule_compare(const void *x, const void *y) {
+    const sorted_rule_t *a = x;
+    const sorted_rule_t *b = y;
+    int result = name_compare(a->name, a->name_length, b->name, b->name_length);
+    if (result)
+        return result;
+    return (a->order > b->order) - (a->order < b->order);
+}
+
+static size_t encode_name(const char *const name, const size_t length, uint8_t *wire) {
+    size_t wire_length = 0;
+    for (size_t l = 0, r; l < length; l = r + 1) {
+        for (r = l; r < length && name[r] != '.';)
+            ++r;
+        wire[wire_length++] = r - l;
+        ascii_to_lower(wire + wire_length, (const uint8_t *)name + l, r - l);
+        wire_length += r - l;
+    }
+    wire[wire_length++] = 0;
+    return wire_length;
+}
+
+static void write_or_abort(FILE *file, const void *data, size_t size, const char *const filename) {
+    if (size && fwrite(data, size, 1, file) != 1) {
+        logger_write(LOG_LEVEL_ERROR, "Failed when writing %s!", filename);
+        abort();
+    }
+    return;
+}
+
+void compile_rule_table(const char *const hosts_filename, const char *const snapshot_filename) {
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    size_t size;
+    const uint8_t *data;
+    if (!map_file(hosts_filename, &data, &size)) {
+        logger_write(LOG_LEVEL_ERROR, "Failed when loading hosts file %s!", hosts_filename);
+        abort();
+    }
+    parsed_hosts_t parsed = {NULL, 0, NULL, 0, 0, 0};
+    if (data)
+        parse_hosts_file(hosts_filename, data, size, &parsed, &begin);
+
+    sorted_rule_t *rules = malloc(sizeof(sorted_rule_t) * (parsed.rule_count + 1));
+    uint8_t *wire_names = malloc(parsed.size + parsed.rule_count * 2 + 1);
+    assert(rules && wire_names);
+    size_t count = 0, wire_names_size = 0;
+    for (size_t c = 0; c < parsed.chunk_count; ++c)
+        for (size_t p = 0; p < parsed.chunk_count; ++p) {
+            rule_array_t *array = &parsed.chunks[c].partitions[p];
+            for (size_t i = 0; i < array->count; ++i) {
+                rules[count].rule = &array->items[i];
+                rules[count].name = wire_names + wire_names_size;
+                rules[count].name_length = encode_name(array->items[i].name, array->items[i].name_length, wire_names + wire_names_size);
+                rules[count].order = count;
+                wire_names_size += rules[count].name_length;
+                ++count;
+            }
+        }
+    qsort(rules, count, sizeof(sorted_rule_t), sorted_rule_compare);
+
+    bloom_filter_t *filter = bloom_filter_create(parsed.banned_count);
+    rule_snapshot_entry_t *entries = malloc(sizeof(rule_snapshot_entry_t) * (count + 1));
+    uint8_t *names = malloc(wire_names_size + 1);
+    uint8_t *rrsets = malloc((sizeof(dns_rrset_t) + DNS_RRSET_ALIGNMENT + sizeof(uint16_t) + sizeof(in_addr_t)) * (count + 1));
+    assert(entries && names && rrsets);
+    size_t entry_count = 0, names_size = 0, rrsets_size = 0;
+    for (size_t i = 0; i < count;) {
+        size_t j = i;
+        rule_snapshot_entry_t *entry = &entries[entry_count++];
+        entry->name_offset = names_size;
+        entry->name_length = rules[i].name_length;
+        entry->flags = 0;
+        entry->rrset_offset = rrsets_size;
+        entry->rrset_count = 0;
+        memcpy(names + names_size, rules[i].name, entry->name_length);
+        names_size += entry->name_length;
+        dns_rrset_t *rrset = dns_rrset_create(NULL, 0, 1, 1, 0); // A, IN
+        for (; j < count && name_compare(rules[i].name, rules[i].name_length, rules[j].name, rules[j].name_length) == 0; ++j) {
+            const rule_t *rule = rules[j].rule;
+            if (rule->banned) {
+                if (!(entry->flags & RULE_SNAPSHOT_BANNED)) {
+                    uint8_t key[RULE_TABLE_KEY_MAX_LENGTH];
+                    size_t key_length = banned_key(rule->name, rule->name_length, key);
+                    bloom_filter_add(filter, banned_key_hash(key, key_length));
+                }
+                entry->flags |= RULE_SNAPSHOT_BANNED;
+                continue;
+            }
+            entry->flags |= RULE_SNAPSHOT_CONFIGURED;
+            rrset = dns_rrset_append(rrset, 0, (const uint8_t *)&rule->address, sizeof(in_addr_t));
+        }
+        if (rrset->count) {
+            memset(rrsets + rrsets_size, 0, dns_rrset_size(rrset));
+            memcpy(rrsets + rrsets_size, rrset, sizeof(dns_rrset_t) + rrset->size);
+            rrsets_size += dns_rrset_size(rrset);
+            entry->rrset_count = 1;
+        }
+        dns_rrset_destroy(rrset);
+        i = j;
+    }
+
+    if (names_size > UINT32_MAX || rrsets_size > UINT32_MAX) {
+        logger_write(LOG_LEVEL_ERROR, "Rule table %s is too large for a snapshot!", hosts_filename);
+        abort();
+    }
+
+    rule_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RULE_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = RULE_SNAPSHOT_VERSION;
+    header.entry_count = entry_count;
+    header.entries_offset = sizeof(header);
+    header.names_offset = header.entries_offset + sizeof(rule_snapshot_entry_t) * entry_count;
+    header.names_size = names_size;
+    header.rrsets_offset = snapshot_rrsets_offset(header.names_offset + names_size);
+    header.rrsets_size = rrsets_size;
+    header.file_size = snapshot_filter_offset(&header) + bloom_filter_size(filter);
+
+    size_t temporary_length = strlen(snapshot_filename) + 5;
+    char *temporary_filename = malloc(temporary_length);
+    assert(temporary_filename);
+    snprintf(temporary_filename, temporary_length, "%s.tmp", snapshot_filename);
+    FILE *file = fopen(temporary_filename, "wb");
+    if (!file) {
+        logger_write(LOG_LEVEL_ERROR, "Failed when creating %s!", temporary_filename);
+        abort();
+    }
+    write_or_abort(file, &header, sizeof(header), temporary_filename);
+    write_or_abort(file, entries, sizeof(rule_snapshot_entry_t) * entry_count, temporary_filename);
+    static const uint8_t padding[BLOOM_FILTER_BLOCK_SIZE];
+    write_or_abort(file, names, names_size, temporary_filename);
+    write_or_abort(file, padding, header.rrsets_offset - header.names_offset - names_size, temporary_filename);
+    write_or_abort(file, rrsets, rrsets_size, temporary_filename);
+    write_or_abort(file, padding, snapshot_filter_offset(&header) - header.rrsets_offset - rrsets_size, temporary_filename);
+    write_or_abort(file, filter->blocks, bloom_filter_size(filter), temporary_filename);
+    if (fclose(file) != 0 || rename(temporary_filename, snapshot_filename) != 0) {
+        logger_write(LOG_LEVEL_ERROR, "Failed when writing %s!", snapshot_filename);
+        abort();
+    }
+    logger_write(LOG_LEVEL_INFO, "Rule snapshot %s: %zu name(s), %zu byte(s), compiled in %.3f s.", snapshot_filename, entry_count, (size_t)header.file_size, elapsed_seconds(&begin));
+    logger_write(LOG_LEVEL_INFO, "Rule snapshot %s: banned name filter uses %zu byte(s) for %zu name(s), false-positive rate %.4f%% per label.",
+                 snapshot_filename, bloom_filter_size(filter), filter->key_count, bloom_filter_false_positive_rate(filter, RULE_TABLE_FILTER_PROBE_COUNT) * 100);
+
+    bloom_filter_destroy(filter);
+    free(temporary_filename);
+    free(rrsets);
+    free(names);
+    free(entries);
+    free(wire_names);
+    free(rules);
+    if (data)
+        parsed_hosts_release(&parsed);
     return;
 }
 
+static void rule_table_destroy(rule_table_t *table) {
+    if (table->banned_filter)
+        bloom_filter_destroy(table->banned_filter);
+    trie_destroy(table->banned_name_trie, NULL);
+    trie_destroy(table->configured_name_trie, dns_rrsets_destroy);
+    if (table->snapshot)
+        munmap((void *)table->snapshot, table->snapshot_size);
+    free(table);
+    return;
+}
+
+static rule_table_t *rule_table_create(const char *const filename) {
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    size_t size;
+    const uint8_t *data;
+    if (!map_file(filename, &data, &size))
+        return NULL;
+
+    rule_table_t *table = calloc(1, sizeof(rule_table_t));
+    assert(table);
+    table->banned_name_trie = trie_create();
+    table->configured_name_trie = trie_create();
+    if (!data) {
+        logger_write(LOG_LEVEL_INFO, "Rule table %s is empty.", filename);
+        return table;
+    }
+    if (is_snapshot(data, size)) {
+        if (!load_snapshot(table, filename, data, size)) {
+            munmap((void *)data, size);
+            rule_table_destroy(table);
+            return NULL;
+        }
+        logger_write(LOG_LEVEL_INFO, "Rule snapshot %s: mapped %" PRIu32 " name(s) in %.3f s.", filename, table->snapshot_header->entry_count, elapsed_seconds(&begin));
+        if (table->banned_filter)
+            report_banned_filter(table, filename);
+        return table;
+    }
+    load_hosts_file(table, filename, data, size, &begin);
+    return table;
+}
+
 void load_rule_table(const char *const filename) {
-    banned_name_trie = trie_create();
-    configured_name_trie = trie_create();
-    FILE *file = fopen(filename, "r");
-    assert(file);
-    char *ip_buffer = malloc(sizeof(char) * rule_table_buffer_size);
-    assert(ip_buffer);
-    char *name_buffer = malloc(sizeof(char) * rule_table_buffer_size);
-    assert(name_buffer);
-    while (fscanf(file, "%s %s", ip_buffer, name_buffer) != EOF)
-        handle(ip_buffer, name_buffer);
-    fclose(file);
-    file = NULL;
-    free(ip_buffer);
-    ip_buffer = NULL;
-    free(name_buffer);
-    name_buffer = NULL;
-    return;
-}
-
-bool is_banned(const char *const name) {
-    assert(banned_name_trie);
-    trie_node_t *p = trie_find(banned_name_trie, (trie_radix_t *)name, strlen(name));
-    return p != NULL && p->count;
-}
-
-forward_list_t get_configured(const char *const name) {
-    assert(configured_name_trie);
-    trie_node_t *p = trie_find(configured_name_trie, (trie_radix_t *)name, strlen(name));
-    if (p)
-        return p->value;
-    else
+    rule_table_t *table = rule_table_create(filename);
+    if (!table) {
+        logger_write(LOG_LEVEL_ERROR, "Failed when loading rule table %s!", filename);
+        abort();
+    }
+    atomic_store(&active_table, table);
+    return;
+}
+
+static void *reload(void *arg) {
+    char *filename = arg;
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    rule_table_t *table = rule_table_create(filename);
+    if (!table) {
+        logger_write(LOG_LEVEL_WARNING, "Rule table %s reload failed, keeping the previous table.", filename);
+        free(filename);
+        atomic_store(&reloading, false);
         return NULL;
+    }
+
+    /*
+     * Once the reader has left its critical section or started another one after the exchange,
+     * it can no longer hold the previous table, which is then freed on this thread.
+     */
+    rule_table_t *previous = atomic_exchange(&active_table, table);
+    uint_fast64_t generation = atomic_load(&reader_generation);
+    while (atomic_load(&reader_active) && atomic_load(&reader_generation) == generation) {
+        struct timespec interval = {0, 1000000};
+        nanosleep(&interval, NULL);
+    }
+    double swap_seconds = elapsed_seconds(&begin);
+    if (previous)
+        rule_table_destroy(previous);
+    logger_write(LOG_LEVEL_INFO, "Rule table %s reloaded: swapped after %.3f s, previous table freed after %.3f s.", filename, swap_seconds, elapsed_seconds(&begin));
+
+    free(filename);
+    atomic_store(&reloading, false);
+    return NULL;
+}
+
+void reload_rule_table(const char *const filename) {
+    if (atomic_exchange(&reloading, true)) {
+        logger_write(LOG_LEVEL_WARNING, "Rule table reload already in progress, request ignored.");
+        return;
+    }
+    char *filename_copy = strdup(filename);
+    assert(filename_copy);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reload, filename_copy) != 0) {
+        logger_write(LOG_LEVEL_WARNING, "Failed when creating rule table reload thread!");
+        free(filename_copy);
+        atomic_store(&reloading, false);
+        return;
+    }
+    pthread_detach(thread);
+    return;
+}
+
+void rule_table_reader_enter(void) {
+    atomic_store(&reader_active, true);
+    return;
+}
+
+void rule_table_reader_leave(void) {
+    atomic_store(&reader_active, false);
+    atomic_fetch_add(&reader_generation, 1);
+    return;
+}
+
+bool is_banned(const name_field_t *const name) {
+    rule_table_t *table = atomic_load(&active_table);
+    assert(table);
+    size_t labels[RULE_TABLE_LABEL_MAX_COUNT];
+    size_t label_count = name_labels(name, labels);
+    if (table->banned_filter && !banned_filter_match(table->banned_filter, name->name, labels, label_count))
+        return false;
+    if (table->snapshot)
+        return snapshot_banned_match(table, name);
+    return banned_name_trie_match(table->banned_name_trie, name->name, labels, label_count);
+}
+
+const dns_rrset_t *get_configured(const name_field_t *const name, const uint16_t type, const uint16_t class) {
+    rule_table_t *table = atomic_load(&active_table);
+    assert(table);
+    if (table->snapshot) {
+        const rule_snapshot_entry_t *entry = snapshot_find(table, name->name, name->length);
+        if (!entry || !(entry->flags & RULE_SNAPSHOT_CONFIGURED))
+            return NULL;
+        return snapshot_find_rrset(table, entry, type, class);
+    }
+    trie_node_t *p = trie_find(table->configured_name_trie, name->name, name->length);
+    return p ? dns_rrsets_find(p->value, type, class) : NULL;
 }
@@ -0,0 +1,319 @@
+#include "module/shared_cache.h"
+#include "module/logger.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHARED_CACHE_MAGIC "DNSSHMC1"
+#define SHARED_CACHE_VERSION 1
+#define SHARED_CACHE_WAYS 8
+#define SHARED_CACHE_STRIPE_LIMIT 1024
+#define SHARED_CACHE_NAME_MAX_LENGTH 256
+
+typedef struct shared_cache_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t size;
+    uint64_t set_count;
+    uint64_t stripe_count;
+    uint64_t stripes_offset;
+    uint64_t slots_offset;
+    _Atomic uint32_t ready;
+    uint32_t reserved;
+} shared_cache_header_t;
+
+_Static_assert(sizeof(shared_cache_header_t) == 64, "shared cache header must stay 64 bytes");
+
+/* A stripe guards every stripe_count-th set; it fills whole cache lines so stripes do not share them. */
+typedef struct shared_cache_stripe {
+    _Alignas(64) pthread_mutex_t mutex;
+    uint64_t clock;
+    uint64_t used;
+    uint64_t insertions;
+    uint64_t evictions;
+    uint64_t expirations;
+    uint64_t recoveries;
+} shared_cache_stripe_t;
+
+/* A slot is empty while its stamp is 0; the RRset keeps its owner. */
+typedef struct shared_cache_slot {
+    uint64_t hash;
+    uint64_t stamp;
+    _Alignas(uint64_t) uint8_t rrset[SHARED_CACHE_RRSET_MAX_SIZE];
+} shared_cache_slot_t;
+
+_Static_assert(sizeof(shared_cache_slot_t) == SHARED_CACHE_SLOT_SIZE, "shared cache slot must stay SHARED_CACHE_SLOT_SIZE bytes");
+
+static inline shared_cache_header_t *header_of(const shared_cache_t *cache) {
+    return (shared_cache_header_t *)cache->base;
+}
+
+static inline shared_cache_stripe_t *stripe_at(const shared_cache_t *cache, const size_t index) {
+    return (shared_cache_stripe_t *)(cache->base + header_of(cache)->stripes_offset) + index;
+}
+
+static inline shared_cache_slot_t *set_at(const shared_cache_t *cache, const size_t set) {
+    return (shared_cache_slot_t *)(cache->base + header_of(cache)->slots_offset) + set * SHARED_CACHE_WAYS;
+}
+
+/* The high half of the hash is scaled to the number of sets, which need not be a power of two. */
+static inline size_t set_of(const shared_cache_t *cache, const uint64_t hash) {
+    return ((hash >> 32) * header_of(cache)->set_count) >> 32;
+}
+
+static inline dns_rrset_t *slot_rrset(shared_cache_slot_t *slot) {
+    return (dns_rrset_t *)slot->rrset;
+}
+
+/* The stripes are a power of two, at most one per set; the sets fill the rest of the segment. */
+static void layout(shared_cache_header_t *header, const size_t size) {
+    size_t stripe_count = 1;
+    while (stripe_count < SHARED_CACHE_STRIPE_LIMIT && stripe_count * 4 * SHARED_CACHE_WAYS * SHARED_CACHE_SLOT_SIZE <= size)
+        stripe_count *= 2;
+    size_t slots_offset = sizeof(shared_cache_header_t) + stripe_count * sizeof(shared_cache_stripe_t);
+    slots_offset = (slots_offset + SHARED_CACHE_SLOT_SIZE - 1) / SHARED_CACHE_SLOT_SIZE * SHARED_CACHE_SLOT_SIZE;
+    size_t set_count = size > slots_offset ? (size - slots_offset) / (SHARED_CACHE_WAYS * SHARED_CACHE_SLOT_SIZE) : 0;
+    set_count = set_count > stripe_count ? set_count : stripe_count;
+    memcpy(header->magic, SHARED_CACHE_MAGIC, sizeof(header->magic));
+    header->version = SHARED_CACHE_VERSION;
+    header->slot_size = SHARED_CACHE_SLOT_SIZE;
+    header->set_count = set_count;
+    header->stripe_count = stripe_count;
+    header->stripes_offset = sizeof(shared_cache_header_t);
+    header->slots_offset = slots_offset;
+    header->size = slots_offset + set_count * SHARED_CACHE_WAYS * SHARED_CACHE_SLOT_SIZE;
+    return;
+}
+
+static bool initialize(shared_cache_t *cache) {
+    shared_cache_header_t *header = header_of(cache);
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    bool initialized = true;
+    for (size_t i = 0; i < header->stripe_count; ++i)
+        initialized = initialized && pthread_mutex_init(&stripe_at(cache, i)->mutex, &attributes) == 0;
+    pthread_mutexattr_destroy(&attributes);
+    if (initialized)
+        atomic_store_explicit(&header->ready, 1, memory_order_release);
+    return initialized;
+}
+
+/*
+ * The segment is truncated to nothing first, so one left behind by a process that died while
+ * initializing it starts out zeroed like a new one.
+ */
+static bool create(const int fd, shared_cache_t *cache, const size_t size) {
+    if (cache->base)
+        munmap(cache->base, cache->size);
+    cache->base = NULL;
+    shared_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    layout(&header, size);
+    cache->size = header.size;
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, cache->size) != 0)
+        return false;
+    void *base = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED)
+        return false;
+    cache->base = base;
+    memcpy(cache->base, &header, sizeof(header));
+    return initialize(cache);
+}
+
+/*
+ * Processes attach one at a time under a lock on the segment, which is released when its holder
+ * dies. A segment that is not ready under the lock was left by a process that died initializing
+ * it, so it is initialized again like a new one.
+ */
+shared_cache_t *shared_cache_attach(const char *const name, size_t size) {
+    char path[SHARED_CACHE_NAME_MAX_LENGTH];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+    shared_cache_t *cache = calloc(1, sizeof(shared_cache_t));
+    assert(cache);
+    int fd = shm_open(path, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || flock(fd, LOCK_EX) < 0) {
+        logger_write(LOG_LEVEL_WARNING, "Failed when opening shared cache %s!", path);
+        if (fd >= 0)
+            close(fd);
+        free(cache);
+        return NULL;
+    }
+    struct stat file_stat;
+    bool ready = false, created = false, existing = fstat(fd, &file_stat) == 0 && file_stat.st_size > 0;
+    if (existing && (size_t)file_stat.st_size >= sizeof(shared_cache_header_t)) {
+        void *base = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        cache->base = base != MAP_FAILED ? base : NULL;
+        cache->size = file_stat.st_size;
+        ready = cache->base && atomic_load_explicit(&header_of(cache)->ready, memory_order_acquire);
+    }
+    if (!ready) {
+        if (existing)
+            logger_write(LOG_LEVEL_WARNING, "Shared cache %s was left not ready by a dead process, initializing it again.", path);
+        ready = created = create(fd, cache, size);
+    }
+    close(fd);
+
+    shared_cache_header_t *header = cache->base ? header_of(cache) : NULL;
+    if (!ready)
+        logger_write(LOG_LEVEL_WARNING, "Failed when initializing shared cache %s!", path);
+    else if (memcmp(header->magic, SHARED_CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != SHARED_CACHE_VERSION ||
+             header->slot_size != SHARED_CACHE_SLOT_SIZE || header->size != cache->size) {
+        logger_write(LOG_LEVEL_WARNING, "Shared cache %s is of another version, remove it from /dev/shm!", path);
+        ready = false;
+    }
+    if (!ready) {
+        if (cache->base)
+            munmap(cache->base, cache->size);
+        free(cache);
+        return NULL;
+    }
+    logger_write(LOG_LEVEL_INFO, "Shared cache %s %s: %zu byte(s), %zu slot(s) in %zu stripe(s).", path, created ? "created" : "attached", cache->size,
+                 (size_t)(header->set_count * SHARED_CACHE_WAYS), (size_t)header->stripe_count);
+    return cache;
+}
+
+void shared_cache_detach(shared_cache_t *cache) {
+    assert(cache);
+    munmap(cache->base, cache->size);
+    free(cache);
+    return;
+}
+
+/* The process that held the stripe died in the middle of an update, so its sets are emptied. */
+static void stripe_recover(shared_cache_t *cache, shared_cache_stripe_t *stripe, const size_t index) {
+    const shared_cache_header_t *header = header_of(cache);
+    for (size_t set = index; set < header->set_count; set += header->stripe_count) {
+        shared_cache_slot_t *slots = set_at(cache, set);
+        for (size_t way = 0; way < SHARED_CACHE_WAYS; ++way)
+            slots[way].stamp = 0;
+    }
+    stripe->used = 0;
+    ++stripe->recoveries;
+    pthread_mutex_consistent(&stripe->mutex);
+    logger_write(LOG_LEVEL_WARNING, "Shared cache stripe %zu recovered from a dead process.", index);
+    return;
+}
+
+static shared_cache_stripe_t *stripe_lock(shared_cache_t *cache, const size_t set) {
+    size_t index = set & (header_of(cache)->stripe_count - 1);
+    shared_cache_stripe_t *stripe = stripe_at(cache, index);
+    int result = pthread_mutex_lock(&stripe->mutex);
+    if (result == EOWNERDEAD)
+        stripe_recover(cache, stripe, index);
+    else if (result != 0)
+        return NULL;
+    return stripe;
+}
+
+static inline bool slot_matches(shared_cache_slot_t *slot, const uint8_t *const owner, const size_t owner_length, const uint16_t type,
+                                const uint16_t class, const uint64_t hash) {
+    const dns_rrset_t *rrset = slot_rrset(slot);
+    return slot->stamp && slot->hash == hash && rrset->type == type && rrset->class == class && rrset->owner_length == owner_length &&
+           rrset->size <= SHARED_CACHE_RRSET_MAX_SIZE - sizeof(dns_rrset_t) && owner_length <= rrset->size &&
+           memcmp(dns_rrset_owner(rrset), owner, owner_length) == 0;
+}
+
+/* Empty slots are replaced first, then expired ones, then the least recently used. */
+static inline uint64_t slot_worth(shared_cache_slot_t *slot, const time_t now) {
+    if (!slot->stamp)
+        return 0;
+    return slot_rrset(slot)->ttl <= now ? 1 : slot->stamp + 1;
+}
+
+bool shared_cache_put(shared_cache_t *cache, const dns_rrset_t *const rrset, uint64_t hash, time_t now) {
+    assert(cache && rrset);
+    if (dns_rrset_size(rrset) > SHARED_CACHE_RRSET_MAX_SIZE)
+        return false;
+    size_t set = set_of(cache, hash);
+    shared_cache_stripe_t *stripe = stripe_lock(cache, set);
+    if (!stripe)
+        return false;
+    shared_cache_slot_t *slots = set_at(cache, set), *victim = NULL;
+    bool replaced = false;
+    for (size_t way = 0; way < SHARED_CACHE_WAYS && !replaced; ++way) {
+        shared_cache_slot_t *slot = &slots[way];
+        replaced = slot_matches(slot, dns_rrset_owner(rrset), rrset->owner_length, rrset->type, rrset->class, hash);
+        if (replaced || !victim || slot_worth(slot, now) < slot_worth(victim, now))
+            victim = slot;
+    }
+    uint64_t worth = slot_worth(victim, now);
+    if (!worth)
+        ++stripe->used;
+    else if (!replaced && worth == 1)
+        ++stripe->expirations;
+    else if (!replaced)
+        ++stripe->evictions;
+    victim->hash = hash;
+    victim->stamp = ++stripe->clock;
+    memcpy(victim->rrset, rrset, sizeof(dns_rrset_t) + rrset->size);
+    ++stripe->insertions;
+    pthread_mutex_unlock(&stripe->mutex);
+    return true;
+}
+
+bool shared_cache_get(shared_cache_t *cache, const uint8_t *const owner, const size_t owner_length, const uint16_t type, const uint16_t class,
+                      uint64_t hash, time_t now, dns_rrset_t *rrset) {
+    assert(cache && owner && rrset);
+    size_t set = set_of(cache, hash);
+    shared_cache_stripe_t *stripe = stripe_lock(cache, set);
+    if (!stripe)
+        return false;
+    shared_cache_slot_t *slots = set_at(cache, set);
+    bool found = false;
+    for (size_t way = 0; way < SHARED_CACHE_WAYS; ++way) {
+        shared_cache_slot_t *slot = &slots[way];
+        if (!slot_matches(slot, owner, owner_length, type, class, hash))
+            continue;
+        if (!dns_rrset_valid(slot->rrset, SHARED_CACHE_RRSET_MAX_SIZE)) {
+            slot->stamp = 0;
+            --stripe->used;
+            break;
+        }
+        if (slot_rrset(slot)->ttl <= now) {
+            slot->stamp = 0;
+            --stripe->used;
+            ++stripe->expirations;
+            break;
+        }
+        slot->stamp = ++stripe->clock;
+        memcpy(rrset, slot->rrset, sizeof(dns_rrset_t) + slot_rrset(slot)->size);
+        found = true;
+        break;
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+    return found;
+}
+
+/* The counters are read without locking the stripes, so they may be slightly out of date. */
+void shared_cache_report(const shared_cache_t *cache, FILE *stream) {
+    const shared_cache_header_t *header = header_of(cache);
+    uint64_t used = 0, insertions = 0, evictions = 0, expirations = 0, recoveries = 0;
+    for (size_t i = 0; i < header->stripe_count; ++i) {
+        const shared_cache_stripe_t *stripe = stripe_at(cache, i);
+        used += stripe->used;
+        insertions += stripe->insertions;
+        evictions += stripe->evictions;
+        expirations += stripe->expirations;
+        recoveries += stripe->recoveries;
+    }
+    fprintf(stream, "cache.shared.bytes=%zu\n", cache->size);
+    fprintf(stream, "cache.shared.slots=%zu\n", (size_t)(header->set_count * SHARED_CACHE_WAYS));
+    fprintf(stream, "cache.shared.used=%zu\n", (size_t)used);
+    fprintf(stream, "cache.shared.insertions=%zu\n", (size_t)insertions);
+    fprintf(stream, "cache.shared.evictions=%zu\n", (size_t)evictions);
+    fprintf(stream, "cache.shared.expirations=%zu\n", (size_t)expirations);
+    fprintf(stream, "cache.shared.recoveries=%zu\n", (size_t)recoveries);
+    return;
+}
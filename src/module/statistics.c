@@ -0,0 +1,36 @@
+#include "module/statistics.h"
+
+#include <assert.h>
+#include <inttypes.h>
+
+static uint64_t counters[STATISTICS_COUNTER_COUNT];
+
+static const char *const counter_names[STATISTICS_COUNTER_COUNT] = {
+    [STATISTICS_QUERY] = "query",
+    [STATISTICS_RESPONSE] = "response",
+    [STATISTICS_BANNED] = "banned",
+    [STATISTICS_CONFIGURED] = "configured",
+    [STATISTICS_CACHED] = "cached",
+    [STATISTICS_RELAYED] = "relayed",
+    [STATISTICS_MALFORMED] = "malformed",
+    [STATISTICS_CLIENT_LIMITED] = "client_limited",
+    [STATISTICS_RESPONSE_DROPPED] = "response_dropped",
+    [STATISTICS_RESPONSE_SLIPPED] = "response_slipped",
+};
+
+void statistics_increment(const statistics_counter_t counter) {
+    assert(counter < STATISTICS_COUNTER_COUNT);
+    ++counters[counter];
+    return;
+}
+
+uint64_t statistics_get(const statistics_counter_t counter) {
+    assert(counter < STATISTICS_COUNTER_COUNT);
+    return counters[counter];
+}
+
+void statistics_report(FILE *stream) {
+    for (size_t i = 0; i < STATISTICS_COUNTER_COUNT; ++i)
+        fprintf(stream, "statistics.%s=%" PRIu64 "\n", counter_names[i], counters[i]);
+    return;
+}
@@ -0,0 +1,125 @@
+#include "network/dns_rrset.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline size_t aligned_size(const size_t size) {
+    return (size + DNS_RRSET_ALIGNMENT - 1) / DNS_RRSET_ALIGNMENT * DNS_RRSET_ALIGNMENT;
+}
+
+dns_rrset_t *dns_rrset_create(const uint8_t *const owner, const size_t owner_length, const uint16_t type, const uint16_t class, const uint32_t ttl) {
+    assert(owner_length <= UINT8_MAX);
+    size_t length = owner ? owner_length : 0;
+    dns_rrset_t *rrset = malloc(aligned_size(sizeof(dns_rrset_t) + length));
+    assert(rrset);
+    rrset->type = type;
+    rrset->class = class;
+    rrset->ttl = ttl;
+    rrset->count = 0;
+    rrset->owner_length = length;
+    rrset->reserved = 0;
+    rrset->size = length;
+    if (length)
+        memcpy(rrset->data, owner, length);
+    return rrset;
+}
+
+dns_rrset_t *dns_rrset_append(dns_rrset_t *rrset, const uint32_t ttl, const uint8_t *const rdata, const uint16_t rd_length) {
+    assert(rrset->count < UINT16_MAX);
+    size_t size = rrset->size + sizeof(uint16_t) + rd_length;
+    rrset = realloc(rrset, aligned_size(sizeof(dns_rrset_t) + size));
+    assert(rrset);
+    memcpy(rrset->data + rrset->size, &rd_length, sizeof(uint16_t));
+    memcpy(rrset->data + rrset->size + sizeof(uint16_t), rdata, rd_length);
+    rrset->size = size;
+    if (rrset->count == 0 || ttl < rrset->ttl)
+        rrset->ttl = ttl;
+    ++rrset->count;
+    return rrset;
+}
+
+const uint8_t *dns_rrset_owner(const dns_rrset_t *const rrset) {
+    return rrset->owner_length ? rrset->data : NULL;
+}
+
+const uint8_t *dns_rrset_records(const dns_rrset_t *const rrset) {
+    return rrset->data + rrset->owner_length;
+}
+
+uint16_t dns_rrset_rd_length(const uint8_t *const record) {
+    uint16_t rd_length;
+    memcpy(&rd_length, record, sizeof(uint16_t));
+    return rd_length;
+}
+
+const uint8_t *dns_rrset_next(const uint8_t *const record) {
+    return record + sizeof(uint16_t) + dns_rrset_rd_length(record);
+}
+
+size_t dns_rrset_size(const dns_rrset_t *const rrset) {
+    return aligned_size(sizeof(dns_rrset_t) + rrset->size);
+}
+
+bool dns_rrset_valid(const void *const data, const size_t size) {
+    if ((uintptr_t)data % DNS_RRSET_ALIGNMENT || size < sizeof(dns_rrset_t))
+        return false;
+    const dns_rrset_t *rrset = data;
+    if (rrset->size > size - sizeof(dns_rrset_t) || rrset->owner_length > rrset->size)
+        return false;
+    const uint8_t *record = dns_rrset_records(rrset);
+    const uint8_t *const end = rrset->data + rrset->size;
+    for (size_t i = 0; i < rrset->count; ++i) {
+        if ((size_t)(end - record) < sizeof(uint16_t) || (size_t)(end - record) < sizeof(uint16_t) + dns_rrset_rd_length(record))
+            return false;
+        record = dns_rrset_next(record);
+    }
+    return record == end;
+}
+
+dns_rrset_t *dns_rrset_clone(const dns_rrset_t *const rrset) {
+    dns_rrset_t *clone = malloc(dns_rrset_size(rrset));
+    assert(clone);
+    memcpy(clone, rrset, sizeof(dns_rrset_t) + rrset->size);
+    return clone;
+}
+
+void dns_rrset_destroy(void *rrset) {
+    free(rrset);
+    return;
+}
+
+dns_rrsets_t *dns_rrsets_append(dns_rrsets_t *rrsets, const uint8_t *const owner, const size_t owner_length, const uint16_t type, const uint16_t class,
+                                const uint32_t ttl, const uint8_t *const rdata, const uint16_t rd_length) {
+    size_t length = owner ? owner_length : 0;
+    size_t count = rrsets ? rrsets->count : 0;
+    size_t i = 0;
+    while (i < count && !(rrsets->items[i]->type == type && rrsets->items[i]->class == class && rrsets->items[i]->owner_length == length &&
+                          (!length || memcmp(rrsets->items[i]->data, owner, length) == 0)))
+        ++i;
+    if (i == count) {
+        rrsets = realloc(rrsets, sizeof(dns_rrsets_t) + sizeof(dns_rrset_t *) * (count + 1));
+        assert(rrsets);
+        rrsets->count = count + 1;
+        rrsets->items[i] = dns_rrset_create(owner, owner_length, type, class, ttl);
+    }
+    rrsets->items[i] = dns_rrset_append(rrsets->items[i], ttl, rdata, rd_length);
+    return rrsets;
+}
+
+dns_rrset_t *dns_rrsets_find(const dns_rrsets_t *const rrsets, const uint16_t type, const uint16_t class) {
+    if (!rrsets)
+        return NULL;
+    for (size_t i = 0; i < rrsets->count; ++i)
+        if (rrsets->items[i]->type == type && rrsets->items[i]->class == class)
+            return rrsets->items[i];
+    return NULL;
+}
+
+void dns_rrsets_destroy(void *rrsets) {
+    dns_rrsets_t *p = rrsets;
+    for (size_t i = 0; i < p->count; ++i)
+        dns_rrset_destroy(p->items[i]);
+    free(p);
+    return;
+}
@@ -1,12 +1,20 @@
 #include "network/dns_utility.h"
+#include "data_structure/object_pool.h"
 #include "network/ipv4_utility.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+static object_pool_t name_field_pool = OBJECT_POOL_INITIALIZER("name_field", sizeof(name_field_t));
+static object_pool_t resource_record_pool = OBJECT_POOL_INITIALIZER("resource_record", sizeof(resource_record_t));
+
 name_field_t *name_field_create(const char *const name, size_t length) {
-    name_field_t *p = malloc(sizeof(name_field_t));
+    name_field_t *p = object_pool_alloc(&name_field_pool);
     assert(p);
     p->length = length + 2;
     p->name = malloc(p->length);
@@ -26,8 +34,76 @@ name_field_t *name_field_create(const char *const name, size_t length) {
     return p;
 }
 
+static inline void ascii_to_lower_scalar(uint8_t *const destination, const uint8_t *const source, size_t i, const size_t length) {
+    for (; i < length; ++i)
+        destination[i] = source[i] + ((uint8_t)(source[i] - 'A') < 26 ? 'a' - 'A' : 0);
+    return;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) static size_t ascii_to_lower_avx2(uint8_t *const destination, const uint8_t *const source, const size_t length) {
+    const __m256i before_a = _mm256_set1_epi8('A' - 1);
+    const __m256i after_z = _mm256_set1_epi8('Z' + 1);
+    const __m256i bit = _mm256_set1_epi8('a' - 'A');
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(source + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, before_a), _mm256_cmpgt_epi8(after_z, v));
+        _mm256_storeu_si256((__m256i *)(destination + i), _mm256_or_si256(v, _mm256_and_si256(upper, bit)));
+    }
+    return i;
+}
+
+__attribute__((target("sse2"))) static size_t ascii_to_lower_sse2(uint8_t *const destination, const uint8_t *const source, size_t i, const size_t length) {
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i bit = _mm_set1_epi8('a' - 'A');
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(source + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmplt_epi8(v, after_z));
+        _mm_storeu_si128((__m128i *)(destination + i), _mm_or_si128(v, _mm_and_si128(upper, bit)));
+    }
+    return i;
+}
+#endif
+
+void ascii_to_lower(uint8_t *const destination, const uint8_t *const source, const size_t length) {
+    size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (length >= 32 && __builtin_cpu_supports("avx2"))
+        i = ascii_to_lower_avx2(destination, source, length);
+    if (__builtin_cpu_supports("sse2"))
+        i = ascii_to_lower_sse2(destination, source, i, length);
+#endif
+    ascii_to_lower_scalar(destination, source, i, length);
+    return;
+}
+
+/* Compare a name with one already in lowercase. */
+static bool name_equals_ignoring_case(const uint8_t *const name, const uint8_t *const lowercase, const size_t length) {
+    uint8_t buffer[DNS_NAME_MAX_LENGTH];
+    if (length > sizeof(buffer))
+        return false;
+    ascii_to_lower(buffer, name, length);
+    return memcmp(buffer, lowercase, length) == 0;
+}
+
+name_field_t *canonicalize_name_field(const name_field_t *const name_field) {
+    name_field_t *p = object_pool_alloc(&name_field_pool);
+    assert(p);
+    p->length = name_field->length;
+    p->name = malloc(p->length);
+    assert(p->name);
+    ascii_to_lower(p->name, name_field->name, p->length);
+    return p;
+}
+
 char *get_name_from_name_field(const name_field_t *const name_field) {
-    assert(name_field->length > 1);
+    if (name_field->length <= 1) {
+        char *root = strdup(".");
+        assert(root);
+        return root;
+    }
     char *result = malloc(name_field->length - 1);
     char *base = result;
     assert(result);
@@ -42,263 +118,553 @@ char *get_name_from_name_field(const name_field_t *const name_field) {
     return result;
 }
 
-static size_t name_length_default = 512;
+/* Parse a possibly compressed name at *offset, leaving *offset after its last byte in place. */
+static name_field_t *parse_name(const uint8_t *const base, const size_t length, size_t *const offset) {
+    uint8_t buffer[DNS_NAME_MAX_LENGTH];
+    size_t name_length = 0;
+    size_t position = *offset, run = position, end = 0;
+    size_t hops = 0;
+    for (;;) {
+        if (position >= length)
+            return NULL;
+        uint8_t label = base[position];
+        if ((label & 0xc0) == 0xc0) {
+            if (position + 1 >= length || ++hops > DNS_NAME_POINTER_LIMIT)
+                return NULL;
+            size_t target = ((size_t)(label & 0x3f) << 8) | base[position + 1];
+            if (target >= position)
+                return NULL;
+            memcpy(buffer + name_length, base + run, position - run);
+            name_length += position - run;
+            if (!end)
+                end = position + 2;
+            position = run = target;
+            continue;
+        }
+        if (label & 0xc0)
+            return NULL;
+        if (name_length + (position - run) + label + 1 > DNS_NAME_MAX_LENGTH)
+            return NULL;
+        if (label == 0)
+            break;
+        position += label + 1;
+    }
+    memcpy(buffer + name_length, base + run, position + 1 - run);
+    name_length += position + 1 - run;
+    *offset = end ? end : position + 1;
 
-dns_message_t *parse_dns_message(const char *const base) {
-    const char *ptr = base;
-    dns_message_t *p = malloc(sizeof(dns_message_t));
+    name_field_t *p = object_pool_alloc(&name_field_pool);
     assert(p);
+    p->length = name_length;
+    p->name = malloc(name_length);
+    assert(p->name);
+    memcpy(p->name, buffer, name_length);
+    return p;
+}
+
+static inline uint16_t read_short(const uint8_t *const ptr) {
+    uint16_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return ntohs(value);
+}
+
+static inline uint32_t read_long(const uint8_t *const ptr) {
+    uint32_t value;
+    memcpy(&value, ptr, sizeof(value));
+    return ntohl(value);
+}
+
+/*
+ * Names embedded in the rdata of these types may be compressed against the whole message,
+ * so they are expanded. The rdata is a sequence of names (0) and fixed-size fields.
+ */
+static const struct rdata_layout {
+    uint16_t type;
+    uint8_t field_count;
+    uint8_t fields[3];
+} rdata_layouts[] = {
+    {2, 1, {0}},         // NS
+    {5, 1, {0}},         // CNAME
+    {6, 3, {0, 0, 20}},  // SOA
+    {12, 1, {0}},        // PTR
+    {15, 2, {2, 0}},     // MX
+};
+
+static inline const struct rdata_layout *find_rdata_layout(const uint16_t type) {
+    for (size_t i = 0; i < sizeof(rdata_layouts) / sizeof(rdata_layouts[0]); ++i)
+        if (rdata_layouts[i].type == type)
+            return &rdata_layouts[i];
+    return NULL;
+}
+
+static bool parse_rdata(const uint8_t *const base, const size_t offset, resource_record_t *const record) {
+    const struct rdata_layout *layout = find_rdata_layout(record->type);
+    if (!layout) {
+        record->rdata = malloc(record->rd_length);
+        assert(record->rdata || !record->rd_length);
+        memcpy(record->rdata, base + offset, record->rd_length);
+        return true;
+    }
+
+    uint8_t buffer[DNS_NAME_MAX_LENGTH * 2 + 32];
+    size_t rdata_length = 0;
+    size_t position = offset;
+    const size_t end = offset + record->rd_length;
+    for (size_t i = 0; i < layout->field_count; ++i) {
+        if (layout->fields[i]) {
+            if (position + layout->fields[i] > end)
+                return false;
+            memcpy(buffer + rdata_length, base + position, layout->fields[i]);
+            rdata_length += layout->fields[i];
+            position += layout->fields[i];
+            continue;
+        }
+        name_field_t *name = parse_name(base, end, &position);
+        if (!name)
+            return false;
+        memcpy(buffer + rdata_length, name->name, name->length);
+        rdata_length += name->length;
+        name_field_destroy(name);
+    }
+    if (position != end)
+        return false;
+    record->rd_length = rdata_length;
+    record->rdata = malloc(rdata_length);
+    assert(record->rdata);
+    memcpy(record->rdata, buffer, rdata_length);
+    return true;
+}
+
+static resource_record_t *parse_resource_record(const uint8_t *const base, const size_t length, size_t *const offset) {
+    name_field_t *name = parse_name(base, length, offset);
+    if (!name)
+        return NULL;
+    if (*offset + DNS_RESOURCE_RECORD_FIXED_SIZE > length) {
+        name_field_destroy(name);
+        return NULL;
+    }
+    const uint8_t *ptr = base + *offset;
+    resource_record_t *record = object_pool_alloc(&resource_record_pool);
+    assert(record);
+    record->name = name;
+    record->type = read_short(ptr);
+    record->class = read_short(ptr + 2);
+    record->ttl = read_long(ptr + 4);
+    record->rd_length = read_short(ptr + 8);
+    *offset += DNS_RESOURCE_RECORD_FIXED_SIZE;
+    if (*offset + record->rd_length > length || !parse_rdata(base, *offset, record)) {
+        name_field_destroy(name);
+        object_pool_free(&resource_record_pool, record);
+        return NULL;
+    }
+    *offset += read_short(ptr + 8);
+    return record;
+}
 
+static question_t *parse_question(const uint8_t *const base, const size_t length, size_t *const offset) {
+    name_field_t *name = parse_name(base, length, offset);
+    if (!name)
+        return NULL;
+    if (*offset + DNS_QUESTION_FIXED_SIZE > length) {
+        name_field_destroy(name);
+        return NULL;
+    }
+    question_t *question = malloc(sizeof(question_t));
+    assert(question);
+    question->qname = name;
+    question->canonical_qname = canonicalize_name_field(name);
+    question->qtype = read_short(base + *offset);
+    question->qclass = read_short(base + *offset + 2);
+    *offset += DNS_QUESTION_FIXED_SIZE;
+    return question;
+}
+
+dns_message_t *parse_dns_message(const uint8_t *const base, const size_t length) {
+    if (length < sizeof(dns_header_t))
+        return NULL;
+    dns_message_t *p = malloc(sizeof(dns_message_t));
+    assert(p);
     p->header = malloc(sizeof(dns_header_t));
     assert(p->header);
-    memcpy(p->header, ptr, sizeof(dns_header_t));
-    p->header->id = ntohs(p->header->id);
-    p->header->flag.value = ntohs(p->header->flag.value);
-    p->header->qdcount = ntohs(p->header->qdcount);
-    p->header->ancount = ntohs(p->header->ancount);
-    p->header->nscount = ntohs(p->header->nscount);
-    p->header->arcount = ntohs(p->header->arcount);
+    p->header->id = read_short(base);
+    p->header->flag.value = read_short(base + 2);
+    p->header->qdcount = read_short(base + 4);
+    p->header->ancount = read_short(base + 6);
+    p->header->nscount = read_short(base + 8);
+    p->header->arcount = read_short(base + 10);
+    p->questions = NULL;
+    p->answers = NULL;
+    p->authorities = NULL;
+    p->additionals = NULL;
 
-    ptr += sizeof(dns_header_t);
+    /* Every entry takes at least 5 bytes, so the counts alone can reject a packet. */
+    size_t offset = sizeof(dns_header_t);
+    size_t total = (size_t)p->header->qdcount + p->header->ancount + p->header->nscount + p->header->arcount;
+    if (total * (1 + DNS_QUESTION_FIXED_SIZE) > length - offset) {
+        dns_message_destroy(p);
+        return NULL;
+    }
 
-    p->questions = NULL;
     for (size_t i = 0; i < p->header->qdcount; ++i) {
-        const char *x = ptr;
-        bool compressed = false;
-
-        name_field_t *name_field = malloc(sizeof(name_field_t));
-        name_field->name = malloc(name_length_default);
-        uint8_t *name_ptr = name_field->name;
-        name_field->length = 0;
-        while (*x) {
-            if (((*x) & 0xc0) == 0xc0) {
-                if (!compressed)
-                    ptr = x + 2;
-                compressed = true;
-                uint8_t first = (*x) & 0x3f;
-                uint8_t second = *(x + 1);
-                uint16_t offset = (((uint16_t)first) << 8) | second;
-                x = base + offset;
-            } else {
-                name_field->length += (*x + 1);
-                memcpy(name_ptr, x, *x + 1);
-                name_ptr += (*x + 1);
-                x += (*x + 1);
-            }
+        question_t *question = parse_question(base, length, &offset);
+        if (!question) {
+            dns_message_destroy(p);
+            return NULL;
         }
-        *name_ptr = 0;
-        ++name_field->length;
-        if (!compressed)
-            ptr = x + 1;
-
-        question_t *question = malloc(sizeof(question_t));
-        assert(question);
-        question->qname = name_field;
-        memcpy(&question->qtype, ptr, sizeof(question->qtype));
-        ptr += sizeof(question->qtype);
-        question->qtype = ntohs(question->qtype);
-
-        memcpy(&question->qclass, ptr, sizeof(question->qclass));
-        ptr += sizeof(question->qclass);
-        question->qclass = ntohs(question->qclass);
-
         p->questions = forward_list_node_create(p->questions);
         p->questions->value = question;
     }
 
-    p->answers = NULL;
-    for (size_t i = 0; i < p->header->ancount; ++i) {
-        const char *x = ptr;
-        bool compressed = false;
-
-        name_field_t *name_field = malloc(sizeof(name_field_t));
-        name_field->name = malloc(name_length_default);
-        uint8_t *name_ptr = name_field->name;
-        name_field->length = 0;
-        while (*x) {
-            if (((*x) & 0xc0) == 0xc0) {
-                if (!compressed)
-                    ptr = x + 2;
-                compressed = true;
-                uint8_t first = (*x) & 0x3f;
-                uint8_t second = *(x + 1);
-                uint16_t offset = (((uint16_t)first) << 8) | second;
-                x = base + offset;
-            } else {
-                name_field->length += (*x + 1);
-                memcpy(name_ptr, x, *x + 1);
-                name_ptr += (*x + 1);
-                x += (*x + 1);
+    const struct {
+        forward_list_t *list;
+        uint16_t count;
+    } sections[] = {
+        {&p->answers, p->header->ancount},
+        {&p->authorities, p->header->nscount},
+        {&p->additionals, p->header->arcount},
+    };
+    for (size_t s = 0; s < sizeof(sections) / sizeof(sections[0]); ++s)
+        for (size_t i = 0; i < sections[s].count; ++i) {
+            resource_record_t *record = parse_resource_record(base, length, &offset);
+            if (!record) {
+                dns_message_destroy(p);
+                return NULL;
             }
+            *sections[s].list = forward_list_node_create(*sections[s].list);
+            (*sections[s].list)->value = record;
         }
-        *name_ptr = 0;
-        ++name_field->length;
-        if (!compressed)
-            ptr = x + 1;
-
-        resource_record_t *answer = malloc(sizeof(resource_record_t));
-        assert(answer);
-        answer->name = name_field;
-
-        memcpy(&answer->type, ptr, sizeof(answer->type));
-        ptr += sizeof(answer->type);
-        answer->type = ntohs(answer->type);
-
-        memcpy(&answer->class, ptr, sizeof(answer->class));
-        ptr += sizeof(answer->class);
-        answer->class = ntohs(answer->class);
-
-        memcpy(&answer->ttl, ptr, sizeof(answer->ttl));
-        ptr += sizeof(answer->ttl);
-        answer->ttl = ntohl(answer->ttl);
-
-        memcpy(&answer->rd_length, ptr, sizeof(answer->rd_length));
-        ptr += sizeof(answer->rd_length);
-        answer->rd_length = ntohs(answer->rd_length);
+    return p;
+}
 
-        answer->rdata = malloc(answer->rd_length);
-        memcpy(answer->rdata, ptr, answer->rd_length);
-        ptr += answer->rd_length;
+bool dns_message_view_init(dns_message_view_t *const view, const uint8_t *const base, const size_t length) {
+    view->base = base;
+    view->length = length;
+    view->question_end = 0;
+    view->question = NULL;
+    view->answers = NULL;
+    view->answers_parsed = false;
+    if (length < sizeof(dns_header_t))
+        return false;
+    view->header.id = read_short(base);
+    view->header.flag.value = read_short(base + 2);
+    view->header.qdcount = read_short(base + 4);
+    view->header.ancount = read_short(base + 6);
+    view->header.nscount = read_short(base + 8);
+    view->header.arcount = read_short(base + 10);
+    return true;
+}
 
-        p->answers = forward_list_node_create(p->answers);
-        p->answers->value = answer;
+const question_t *dns_message_view_question(dns_message_view_t *const view) {
+    if (view->question || view->question_end)
+        return view->question;
+    size_t offset = sizeof(dns_header_t);
+    for (size_t i = 0; i < view->header.qdcount; ++i) {
+        question_t *question = parse_question(view->base, view->length, &offset);
+        if (!question) {
+            if (view->question)
+                question_destroy(view->question);
+            view->question = NULL;
+            return NULL;
+        }
+        if (i == 0)
+            view->question = question;
+        else
+            question_destroy(question);
     }
+    view->question_end = offset;
+    return view->question;
+}
 
-    p->authorities = NULL;
-    for (size_t i = 0; i < p->header->nscount; ++i) {
-        const char *x = ptr;
-        bool compressed = false;
-
-        name_field_t *name_field = malloc(sizeof(name_field_t));
-        name_field->name = malloc(name_length_default);
-        uint8_t *name_ptr = name_field->name;
-        name_field->length = 0;
-        while (*x) {
-            if (((*x) & 0xc0) == 0xc0) {
-                if (!compressed)
-                    ptr = x + 2;
-                compressed = true;
-                uint8_t first = (*x) & 0x3f;
-                uint8_t second = *(x + 1);
-                uint16_t offset = (((uint16_t)first) << 8) | second;
-                x = base + offset;
-            } else {
-                name_field->length += (*x + 1);
-                memcpy(name_ptr, x, *x + 1);
-                name_ptr += (*x + 1);
-                x += (*x + 1);
-            }
+forward_list_t dns_message_view_answers(dns_message_view_t *const view) {
+    if (view->answers_parsed)
+        return view->answers;
+    view->answers_parsed = true;
+    if (!dns_message_view_question(view) && view->header.qdcount)
+        return NULL;
+    size_t offset = view->question_end ? view->question_end : sizeof(dns_header_t);
+    for (size_t i = 0; i < view->header.ancount; ++i) {
+        resource_record_t *record = parse_resource_record(view->base, view->length, &offset);
+        if (!record) {
+            forward_list_destroy(view->answers, resource_record_destroy);
+            view->answers = NULL;
+            return NULL;
         }
-        *name_ptr = 0;
-        ++name_field->length;
-        if (!compressed)
-            ptr = x + 1;
+        view->answers = forward_list_node_create(view->answers);
+        view->answers->value = record;
+    }
+    return view->answers;
+}
 
-        resource_record_t *authority = malloc(sizeof(resource_record_t));
-        assert(authority);
-        authority->name = name_field;
+void dns_message_view_release(dns_message_view_t *const view) {
+    if (view->question)
+        question_destroy(view->question);
+    view->question = NULL;
+    if (view->answers)
+        forward_list_destroy(view->answers, resource_record_destroy);
+    view->answers = NULL;
+    return;
+}
 
-        memcpy(&authority->type, ptr, sizeof(authority->type));
-        ptr += sizeof(authority->type);
-        authority->type = ntohs(authority->type);
+static inline uint8_t *appends(uint8_t *ptr, uint16_t value) {
+    value = htons(value);
+    memcpy(ptr, &value, sizeof(uint16_t));
+    ptr += sizeof(uint16_t);
+    return ptr;
+}
 
-        memcpy(&authority->class, ptr, sizeof(authority->class));
-        ptr += sizeof(authority->class);
-        authority->class = ntohs(authority->class);
+static inline uint8_t *appendl(uint8_t *ptr, uint32_t value) {
+    value = htonl(value);
+    memcpy(ptr, &value, sizeof(uint32_t));
+    ptr += sizeof(uint32_t);
+    return ptr;
+}
 
-        memcpy(&authority->ttl, ptr, sizeof(authority->ttl));
-        ptr += sizeof(authority->ttl);
-        authority->ttl = ntohl(authority->ttl);
+static bool name_compression = true;
 
-        memcpy(&authority->rd_length, ptr, sizeof(authority->rd_length));
-        ptr += sizeof(authority->rd_length);
-        authority->rd_length = ntohs(authority->rd_length);
+void dns_use_name_compression(bool enable) {
+    name_compression = enable;
+    return;
+}
 
-        authority->rdata = malloc(authority->rd_length);
-        memcpy(authority->rdata, ptr, authority->rd_length);
-        ptr += authority->rd_length;
+/*
+ * Each label boundary of a written name is remembered by the hash of the suffix starting
+ * there. A later name looks its suffixes up longest first; a hit is checked against the
+ * bytes already written before a pointer to it is emitted, so collisions only cost a miss.
+ */
+void dns_name_compressor_init(dns_name_compressor_t *const compressor) {
+    memset(compressor->offsets, 0, sizeof(compressor->offsets));
+    compressor->last_length = 0;
+    return;
+}
 
-        p->authorities = forward_list_node_create(p->authorities);
-        p->authorities->value = authority;
+static inline size_t compressor_bucket(const uint32_t hash) {
+    return (hash & (DNS_COMPRESSION_SLOT_COUNT / DNS_COMPRESSION_BUCKET_SIZE - 1)) * DNS_COMPRESSION_BUCKET_SIZE;
+}
+
+/* The first and last 8 bytes of a label with its length byte, enough to tell most labels apart. */
+static inline uint64_t label_word(const uint8_t *const label, const size_t available) {
+    size_t size = label[0] + 1;
+    uint64_t head = 0, tail = 0;
+    if (available >= sizeof(head)) {
+        memcpy(&head, label, sizeof(head));
+        if (size < sizeof(head))
+            head &= ((uint64_t)1 << (size * 8)) - 1;
+    } else
+        for (size_t i = 0; i < size; ++i)
+            head |= (uint64_t)label[i] << (i * 8);
+    if (size > sizeof(tail))
+        memcpy(&tail, label + size - sizeof(tail), sizeof(tail));
+    return head ^ (tail * 0x9e3779b97f4a7c15u);
+}
+
+/* Find the label boundaries of an uncompressed name and hash every suffix from there. */
+static size_t suffix_hashes(const uint8_t *const name, const size_t length, size_t *const starts, uint32_t *const hashes) {
+    size_t count = 0;
+    size_t position = 0;
+    while (position < length && name[position]) {
+        if (name[position] & 0xc0 || count == DNS_NAME_MAX_LENGTH / 2)
+            return 0;
+        starts[count++] = position;
+        position += name[position] + 1;
+    }
+    if (position + 1 != length)
+        return 0;
+    uint64_t hash = 0;
+    for (size_t i = count; i-- > 0;) {
+        hash = (hash ^ label_word(name + starts[i], length - starts[i])) * 0xff51afd7ed558ccdu;
+        hashes[i] = hash >> 32;
     }
+    return count;
+}
 
-    p->additionals = NULL;
-    for (size_t i = 0; i < p->header->arcount; ++i) {
-        const char *x = ptr;
-        bool compressed = false;
-
-        name_field_t *name_field = malloc(sizeof(name_field_t));
-        name_field->name = malloc(name_length_default);
-        uint8_t *name_ptr = name_field->name;
-        name_field->length = 0;
-        while (*x) {
-            if (((*x) & 0xc0) == 0xc0) {
-                if (!compressed)
-                    ptr = x + 2;
-                compressed = true;
-                uint8_t first = (*x) & 0x3f;
-                uint8_t second = *(x + 1);
-                uint16_t offset = (((uint16_t)first) << 8) | second;
-                x = base + offset;
-            } else {
-                name_field->length += (*x + 1);
-                memcpy(name_ptr, x, *x + 1);
-                name_ptr += (*x + 1);
-                x += (*x + 1);
-            }
+/* Whether the name written at offset, pointers included, spells exactly the given suffix. */
+static bool suffix_matches(const uint8_t *const base, const size_t written, size_t offset, const uint8_t *const suffix, const size_t length) {
+    size_t position = 0, hops = 0;
+    while (offset < written) {
+        uint8_t label = base[offset];
+        if ((label & 0xc0) == 0xc0) {
+            if (offset + 1 >= written || ++hops > DNS_NAME_POINTER_LIMIT)
+                return false;
+            offset = ((size_t)(label & 0x3f) << 8) | base[offset + 1];
+            continue;
         }
-        *name_ptr = 0;
-        ++name_field->length;
-        if (!compressed)
-            ptr = x + 1;
-
-        resource_record_t *additional = malloc(sizeof(resource_record_t));
-        assert(additional);
-        additional->name = name_field;
+        if (position >= length || label != suffix[position] || offset + label >= written)
+            return false;
+        if (label == 0)
+            return position + 1 == length;
+        if (memcmp(base + offset + 1, suffix + position + 1, label) != 0)
+            return false;
+        position += label + 1;
+        offset += label + 1;
+    }
+    return false;
+}
 
-        memcpy(&additional->type, ptr, sizeof(additional->type));
-        ptr += sizeof(additional->type);
-        additional->type = ntohs(additional->type);
+static void remember_suffixes(dns_name_compressor_t *const compressor, const size_t offset, const size_t *const starts, const uint32_t *const hashes, const size_t count) {
+    for (size_t i = 0; i < count && offset + starts[i] <= DNS_NAME_OFFSET_MAX; ++i) {
+        size_t bucket = compressor_bucket(hashes[i]);
+        memmove(compressor->offsets + bucket + 1, compressor->offsets + bucket, (DNS_COMPRESSION_BUCKET_SIZE - 1) * sizeof(uint16_t));
+        memmove(compressor->tags + bucket + 1, compressor->tags + bucket, (DNS_COMPRESSION_BUCKET_SIZE - 1) * sizeof(uint16_t));
+        compressor->offsets[bucket] = offset + starts[i];
+        compressor->tags[bucket] = hashes[i] >> 16;
+    }
+    return;
+}
 
-        memcpy(&additional->class, ptr, sizeof(additional->class));
-        ptr += sizeof(additional->class);
-        additional->class = ntohs(additional->class);
+static uint16_t find_suffix(const dns_name_compressor_t *const compressor, const uint8_t *const base, const size_t written, const uint8_t *const suffix, const size_t length, const uint32_t hash) {
+    size_t bucket = compressor_bucket(hash);
+    for (size_t i = bucket; i < bucket + DNS_COMPRESSION_BUCKET_SIZE && compressor->offsets[i]; ++i)
+        if (compressor->tags[i] == hash >> 16 && suffix_matches(base, written, compressor->offsets[i], suffix, length))
+            return compressor->offsets[i];
+    return 0;
+}
 
-        memcpy(&additional->ttl, ptr, sizeof(additional->ttl));
-        ptr += sizeof(additional->ttl);
-        additional->ttl = ntohl(additional->ttl);
+static uint8_t *write_name(dns_name_compressor_t *const compressor, uint8_t *const base, uint8_t *ptr, const uint8_t *const name, const size_t length) {
+    if (!name_compression) {
+        memcpy(ptr, name, length);
+        return ptr + length;
+    }
+    if (length == compressor->last_length && memcmp(name, compressor->last_name, length) == 0)
+        return appends(ptr, 0xc000 | compressor->last_offset);
+    size_t starts[DNS_NAME_MAX_LENGTH / 2];
+    uint32_t hashes[DNS_NAME_MAX_LENGTH / 2];
+    size_t count = suffix_hashes(name, length, starts, hashes);
+    size_t offset = ptr - base;
+    size_t i = 0;
+    uint16_t target = 0;
+    while (i < count && !(target = find_suffix(compressor, base, offset, name + starts[i], length - starts[i], hashes[i])))
+        ++i;
+    remember_suffixes(compressor, offset, starts, hashes, i);
+    if (count && (i == 0 ? target : offset) <= DNS_NAME_OFFSET_MAX) {
+        memcpy(compressor->last_name, name, length);
+        compressor->last_length = length;
+        compressor->last_offset = i == 0 ? target : offset;
+    }
+    if (i == count) {
+        memcpy(ptr, name, length);
+        return ptr + length;
+    }
+    memcpy(ptr, name, starts[i]);
+    ptr += starts[i];
+    return appends(ptr, 0xc000 | target);
+}
 
-        memcpy(&additional->rd_length, ptr, sizeof(additional->rd_length));
-        ptr += sizeof(additional->rd_length);
-        additional->rd_length = ntohs(additional->rd_length);
+/* Names in rdata are compressed only for the RFC 1035 types listed in rdata_layouts. */
+static uint8_t *write_rdata(dns_name_compressor_t *const compressor, uint8_t *const base, uint8_t *const ptr, const uint16_t type, const uint8_t *const rdata, const uint16_t rd_length) {
+    const struct rdata_layout *layout = find_rdata_layout(type);
+    uint8_t *end = ptr;
+    size_t position = 0;
+    for (size_t i = 0; layout && i < layout->field_count; ++i) {
+        const uint8_t *field = rdata + position;
+        size_t field_length = layout->fields[i];
+        if (!field_length) {
+            while (position + field_length < rd_length && field[field_length])
+                field_length += field[field_length] + 1;
+            ++field_length;
+        }
+        if (position + field_length > rd_length) {
+            layout = NULL;
+            break;
+        }
+        if (layout->fields[i]) {
+            memcpy(end, field, field_length);
+            end += field_length;
+        } else
+            end = write_name(compressor, base, end, field, field_length);
+        position += field_length;
+    }
+    if (layout && position == rd_length)
+        return end;
+    memcpy(ptr, rdata, rd_length);
+    return ptr + rd_length;
+}
 
-        additional->rdata = malloc(additional->rd_length);
-        memcpy(additional->rdata, ptr, additional->rd_length);
-        ptr += additional->rd_length;
+static uint8_t *write_resource_record(dns_name_compressor_t *const compressor, uint8_t *const base, uint8_t *ptr, const uint8_t *const name, const size_t name_length, const uint16_t type, const uint16_t class, const uint32_t ttl, const uint8_t *const rdata, const uint16_t rd_length) {
+    ptr = write_name(compressor, base, ptr, name, name_length);
+    ptr = appends(ptr, type);
+    ptr = appends(ptr, class);
+    ptr = appendl(ptr, ttl);
+    uint8_t *end = write_rdata(compressor, base, ptr + sizeof(uint16_t), type, rdata, rd_length);
+    appends(ptr, end - ptr - sizeof(uint16_t));
+    return end;
+}
 
-        p->additionals = forward_list_node_create(p->additionals);
-        p->additionals->value = additional;
+void dns_response_init(dns_response_t *const response, uint8_t *const buffer, const size_t capacity, const dns_message_view_t *const query, const uint8_t rcode) {
+    assert(query->question && query->question_end <= capacity);
+    response->buffer = buffer;
+    response->capacity = capacity;
+    response->length = query->question_end;
+    response->question = query->question;
+    response->ancount = 0;
+    memcpy(buffer, query->base, query->question_end);
+    buffer[2] |= 0x80;
+    buffer[3] = (buffer[3] & 0xf0) | (rcode & 0x0f);
+    memset(buffer + 6, 0, 6);
+
+    dns_name_compressor_init(&response->compressor);
+    const name_field_t *qname = query->question->qname;
+    if (query->question_end == sizeof(dns_header_t) + qname->length + DNS_QUESTION_FIXED_SIZE) {
+        size_t starts[DNS_NAME_MAX_LENGTH / 2];
+        uint32_t hashes[DNS_NAME_MAX_LENGTH / 2];
+        size_t count = suffix_hashes(qname->name, qname->length, starts, hashes);
+        remember_suffixes(&response->compressor, sizeof(dns_header_t), starts, hashes, count);
     }
+    return;
+}
 
-    return p;
+size_t dns_response_add_rrset(dns_response_t *const response, const dns_rrset_t *const rrset, const uint32_t ttl_base) {
+    return dns_response_add_records(response, rrset, dns_rrset_owner(rrset), rrset->owner_length, ttl_base);
 }
 
-static inline uint8_t *appends(uint8_t *ptr, uint16_t value) {
-    value = htons(value);
-    memcpy(ptr, &value, sizeof(uint16_t));
-    ptr += sizeof(uint16_t);
-    return ptr;
+size_t dns_response_add_records(dns_response_t *const response, const dns_rrset_t *const rrset, const uint8_t *owner, size_t owner_length,
+                                const uint32_t ttl_base) {
+    const question_t *question = response->question;
+    if (!owner || (owner_length == question->canonical_qname->length && name_equals_ignoring_case(owner, question->canonical_qname->name, owner_length))) {
+        owner = question->qname->name;
+        owner_length = question->qname->length;
+    }
+    const uint8_t *record = dns_rrset_records(rrset);
+    for (size_t i = 0; i < rrset->count; ++i, record = dns_rrset_next(record)) {
+        uint16_t rd_length = dns_rrset_rd_length(record);
+        if (response->length + owner_length + DNS_RESOURCE_RECORD_FIXED_SIZE + rd_length > response->capacity || response->ancount == UINT16_MAX) {
+            response->buffer[2] |= 0x02;
+            return i;
+        }
+        uint8_t *end = write_resource_record(&response->compressor, response->buffer, response->buffer + response->length, owner, owner_length,
+                                             rrset->type, rrset->class, rrset->ttl - ttl_base, record + sizeof(uint16_t), rd_length);
+        response->length = end - response->buffer;
+        ++response->ancount;
+    }
+    return rrset->count;
 }
 
-static inline uint8_t *appendl(uint8_t *ptr, uint32_t value) {
-    value = htonl(value);
-    memcpy(ptr, &value, sizeof(uint32_t));
-    ptr += sizeof(uint32_t);
+size_t dns_response_finish(dns_response_t *const response) {
+    appends(response->buffer + 6, response->ancount);
+    return response->length;
+}
+
+/* A record never takes more than its uncompressed size, so that is what is checked against the end of the buffer. */
+static uint8_t *write_section(dns_name_compressor_t *const compressor, uint8_t *const base, uint8_t *ptr, const uint8_t *const limit, forward_list_t list,
+                              const size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        resource_record_t *resource_record = list->value;
+        if (!ptr || resource_record->name->length + DNS_RESOURCE_RECORD_FIXED_SIZE + resource_record->rd_length > (size_t)(limit - ptr))
+            return NULL;
+        ptr = write_resource_record(compressor, base, ptr, resource_record->name->name, resource_record->name->length,
+                                    resource_record->type, resource_record->class, resource_record->ttl, resource_record->rdata, resource_record->rd_length);
+        list = list->next;
+    }
+    assert(list == NULL);
     return ptr;
 }
 
-uint8_t *convert_dns_message_to_stream(const dns_message_t *const dns_message, uint8_t *const buffer) {
+uint8_t *convert_dns_message_to_stream(const dns_message_t *const dns_message, uint8_t *const buffer, const size_t capacity) {
+    if (capacity < sizeof(dns_header_t))
+        return NULL;
     uint8_t *ptr = buffer;
+    const uint8_t *const limit = buffer + capacity;
+    dns_name_compressor_t compressor;
+    dns_name_compressor_init(&compressor);
 
     ptr = appends(ptr, dns_message->header->id);
     ptr = appends(ptr, dns_message->header->flag.value);
@@ -312,9 +678,10 @@ uint8_t *convert_dns_message_to_stream(const dns_message_t *const dns_message, u
     list_ptr = dns_message->questions;
     for (size_t i = 0; i < dns_message->header->qdcount; ++i) {
         question_t *question = list_ptr->value;
+        if (question->qname->length + DNS_QUESTION_FIXED_SIZE > (size_t)(limit - ptr))
+            return NULL;
 
-        memcpy(ptr, question->qname->name, question->qname->length);
-        ptr += question->qname->length;
+        ptr = write_name(&compressor, buffer, ptr, question->qname->name, question->qname->length);
         ptr = appends(ptr, question->qtype);
         ptr = appends(ptr, question->qclass);
 
@@ -322,56 +689,9 @@ uint8_t *convert_dns_message_to_stream(const dns_message_t *const dns_message, u
     }
     assert(list_ptr == NULL);
 
-    list_ptr = dns_message->answers;
-    for (size_t i = 0; i < dns_message->header->ancount; ++i) {
-        resource_record_t *resource_record = list_ptr->value;
-
-        memcpy(ptr, resource_record->name->name, resource_record->name->length);
-        ptr += resource_record->name->length;
-        ptr = appends(ptr, resource_record->type);
-        ptr = appends(ptr, resource_record->class);
-        ptr = appendl(ptr, resource_record->ttl);
-        ptr = appends(ptr, resource_record->rd_length);
-        memcpy(ptr, resource_record->rdata, resource_record->rd_length);
-        ptr += resource_record->rd_length;
-
-        list_ptr = list_ptr->next;
-    }
-    assert(list_ptr == NULL);
-
-    list_ptr = dns_message->authorities;
-    for (size_t i = 0; i < dns_message->header->nscount; ++i) {
-        resource_record_t *resource_record = list_ptr->value;
-
-        memcpy(ptr, resource_record->name->name, resource_record->name->length);
-        ptr += resource_record->name->length;
-        ptr = appends(ptr, resource_record->type);
-        ptr = appends(ptr, resource_record->class);
-        ptr = appendl(ptr, resource_record->ttl);
-        ptr = appends(ptr, resource_record->rd_length);
-        memcpy(ptr, resource_record->rdata, resource_record->rd_length);
-        ptr += resource_record->rd_length;
-
-        list_ptr = list_ptr->next;
-    }
-    assert(list_ptr == NULL);
-
-    list_ptr = dns_message->additionals;
-    for (size_t i = 0; i < dns_message->header->arcount; ++i) {
-        resource_record_t *resource_record = list_ptr->value;
-
-        memcpy(ptr, resource_record->name->name, resource_record->name->length);
-        ptr += resource_record->name->length;
-        ptr = appends(ptr, resource_record->type);
-        ptr = appends(ptr, resource_record->class);
-        ptr = appendl(ptr, resource_record->ttl);
-        ptr = appends(ptr, resource_record->rd_length);
-        memcpy(ptr, resource_record->rdata, resource_record->rd_length);
-        ptr += resource_record->rd_length;
-
-        list_ptr = list_ptr->next;
-    }
-    assert(list_ptr == NULL);
+    ptr = write_section(&compressor, buffer, ptr, limit, dns_message->answers, dns_message->header->ancount);
+    ptr = write_section(&compressor, buffer, ptr, limit, dns_message->authorities, dns_message->header->nscount);
+    ptr = write_section(&compressor, buffer, ptr, limit, dns_message->additionals, dns_message->header->arcount);
 
     return ptr;
 }
@@ -384,7 +704,7 @@ dns_header_t *clone_dns_header(const dns_header_t *const dns_header) {
 }
 
 name_field_t *clone_name_field(const name_field_t *const name_field) {
-    name_field_t *new_name_field = malloc(sizeof(name_field_t));
+    name_field_t *new_name_field = object_pool_alloc(&name_field_pool);
     assert(new_name_field);
     new_name_field->length = name_field->length;
     new_name_field->name = malloc(new_name_field->length);
@@ -398,6 +718,7 @@ void *clone_question(void *q) {
     question_t *new_question = malloc(sizeof(question_t));
     assert(new_question);
     new_question->qname = clone_name_field(question->qname);
+    new_question->canonical_qname = clone_name_field(question->canonical_qname);
     new_question->qtype = question->qtype;
     new_question->qclass = question->qclass;
     return new_question;
@@ -405,7 +726,7 @@ void *clone_question(void *q) {
 
 void *clone_resource_record(void *q) {
     resource_record_t *resource_record = q;
-    resource_record_t *new_resource_record = malloc(sizeof(resource_record_t));
+    resource_record_t *new_resource_record = object_pool_alloc(&resource_record_pool);
     assert(new_resource_record);
     new_resource_record->name = clone_name_field(resource_record->name);
     new_resource_record->type = resource_record->type;
@@ -435,7 +756,7 @@ void name_field_destroy(name_field_t *p) {
     free(p->name);
     p->name = NULL;
     p->length = 0;
-    free(p);
+    object_pool_free(&name_field_pool, p);
     p = NULL;
     return;
 }
@@ -453,6 +774,8 @@ void question_destroy(void *q) {
     assert(p);
     name_field_destroy(p->qname);
     p->qname = NULL;
+    name_field_destroy(p->canonical_qname);
+    p->canonical_qname = NULL;
     p->qtype = 0;
     p->qclass = 0;
     free(p);
@@ -472,7 +795,7 @@ void resource_record_destroy(void *q) {
     assert(p->rdata);
     free(p->rdata);
     p->rdata = NULL;
-    free(p);
+    object_pool_free(&resource_record_pool, p);
     p = NULL;
     return;
 }
@@ -0,0 +1,15 @@
+#include "module/logger.h"
+#include "module/rule_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s hosts-file snapshot-file\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    logger_init("/dev/null", 1, true);
+    compile_rule_table(argv[1], argv[2]);
+    return 0;
+}